@@ -0,0 +1,205 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include "compress.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "RaftRegistry/common/util.h"
+
+namespace RR {
+
+namespace {
+// 最短的匹配长度
+constexpr size_t MIN_MATCH = 4;
+// 最后 5 个字节必须是字面量，最后一个匹配必须在结尾 12 字节之前开始，和 LZ4 的约定一致
+constexpr size_t LAST_LITERALS = 5;
+constexpr size_t MF_LIMIT = 12;
+// 匹配距离用两个字节表示
+constexpr size_t MAX_DISTANCE = 65535;
+// 哈希表大小为 2^HASH_LOG，保存 4 字节序列最近一次出现的位置
+constexpr int HASH_LOG = 12;
+// 每个长度字节最多表示 255，压缩比不会超过 255 倍，头部声明的原始长度超过这个比例的数据一定是损坏的
+constexpr size_t MAX_RATIO = 255;
+
+uint32_t Read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t Hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// 超过 15 的长度用后续的字节表示，每个字节最多 255，不足 255 的字节表示结束
+void WriteLength(std::string& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+// 长度超过 limit 时立即失败，构造的输入不会让 length 溢出
+bool ReadLength(std::string_view in, size_t& pos, size_t& length, size_t limit) {
+    uint8_t b;
+    do {
+        if (pos >= in.size()) {
+            return false;
+        }
+        b = static_cast<uint8_t>(in[pos++]);
+        length += b;
+        if (length > limit) {
+            return false;
+        }
+    } while (b == 255);
+    return true;
+}
+
+/**
+ * @brief 写入一个序列：token + 字面量长度 + 字面量 + 匹配距离 + 匹配长度，matchLength 为 0 时是最后一个只有字面量的序列
+ */
+void WriteSequence(std::string& out, const char* literals, size_t literalLength, size_t distance, size_t matchLength) {
+    const size_t tokenPos = out.size();
+    out.push_back(0);
+    uint8_t token = static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4);
+    if (literalLength >= 15) {
+        WriteLength(out, literalLength - 15);
+    }
+    out.append(literals, literalLength);
+    if (matchLength) {
+        out.push_back(static_cast<char>(distance & 0xFF));
+        out.push_back(static_cast<char>(distance >> 8));
+        size_t length = matchLength - MIN_MATCH;
+        token |= static_cast<uint8_t>(std::min<size_t>(length, 15));
+        if (length >= 15) {
+            WriteLength(out, length - 15);
+        }
+    }
+    out[tokenPos] = static_cast<char>(token);
+}
+
+std::string LZCompress(std::string_view in) {
+    const size_t n = in.size();
+    const char* src = in.data();
+    std::string out;
+    out.reserve(sizeof(uint32_t) + n + n / 255 + 16);
+    uint32_t size = EndianCast(static_cast<uint32_t>(n));
+    out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+
+    size_t anchor = 0;
+    if (n >= MF_LIMIT + 1) {
+        std::vector<uint32_t> table(1 << HASH_LOG, 0);
+        const size_t matchLimit = n - LAST_LITERALS;
+        const size_t ipLimit = n - MF_LIMIT;
+        size_t ip = 0;
+        while (ip < ipLimit) {
+            const uint32_t sequence = Read32(src + ip);
+            const uint32_t h = Hash(sequence);
+            const size_t candidate = table[h];
+            table[h] = static_cast<uint32_t>(ip);
+            if (candidate >= ip || ip - candidate > MAX_DISTANCE || Read32(src + candidate) != sequence) {
+                ++ip;
+                continue;
+            }
+            size_t length = MIN_MATCH;
+            while (ip + length < matchLimit && src[candidate + length] == src[ip + length]) {
+                ++length;
+            }
+            WriteSequence(out, src + anchor, ip - anchor, ip - candidate, length);
+            ip += length;
+            anchor = ip;
+        }
+    }
+    WriteSequence(out, src + anchor, n - anchor, 0, 0);
+    return out;
+}
+
+std::optional<std::string> LZDecompress(std::string_view in) {
+    if (in.size() < sizeof(uint32_t)) {
+        return std::nullopt;
+    }
+    uint32_t size;
+    memcpy(&size, in.data(), sizeof(size));
+    size = EndianCast(size);
+    in.remove_prefix(sizeof(size));
+    // 分配之前先检查头部的长度，损坏或者伪造的记录不能让这里分配任意大的内存
+    if (size > in.size() * MAX_RATIO) {
+        return std::nullopt;
+    }
+
+    std::string out(size, '\0');
+    size_t op = 0;
+    size_t ip = 0;
+    while (ip < in.size()) {
+        const uint8_t token = static_cast<uint8_t>(in[ip++]);
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLength(in, ip, literalLength, size - op)) {
+            return std::nullopt;
+        }
+        if (literalLength > in.size() - ip || literalLength > size - op) {
+            return std::nullopt;
+        }
+        memcpy(&out[op], in.data() + ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+        // 最后一个序列只有字面量
+        if (ip == in.size()) {
+            break;
+        }
+
+        if (in.size() - ip < 2) {
+            return std::nullopt;
+        }
+        const size_t distance = static_cast<uint8_t>(in[ip]) | static_cast<size_t>(static_cast<uint8_t>(in[ip + 1])) << 8;
+        ip += 2;
+        size_t matchLength = token & 0x0F;
+        if (matchLength == 15 && !ReadLength(in, ip, matchLength, size - op)) {
+            return std::nullopt;
+        }
+        matchLength += MIN_MATCH;
+        if (distance == 0 || distance > op || matchLength > size - op) {
+            return std::nullopt;
+        }
+        // 匹配可能和正在写入的部分重叠，逐字节复制
+        size_t from = op - distance;
+        if (distance >= matchLength) {
+            memcpy(&out[op], &out[from], matchLength);
+            op += matchLength;
+        } else {
+            for (size_t i = 0; i < matchLength; ++i) {
+                out[op++] = out[from++];
+            }
+        }
+    }
+    if (op != size) {
+        return std::nullopt;
+    }
+    return out;
+}
+}
+
+std::string Compress(Codec codec, std::string_view data) {
+    switch (codec) {
+        case Codec::LZ:
+            return LZCompress(data);
+        case Codec::None:
+        default:
+            return std::string(data);
+    }
+}
+
+std::optional<std::string> Decompress(Codec codec, std::string_view data) {
+    switch (codec) {
+        case Codec::None:
+            return std::string(data);
+        case Codec::LZ:
+            return LZDecompress(data);
+        default:
+            return std::nullopt;
+    }
+}
+
+} // namespace RR
@@ -0,0 +1,42 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_COMPRESS_H
+#define RR_COMPRESS_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace RR {
+
+/**
+ * @brief 数据的压缩编码，作为一个字节和数据一起保存、传输
+ * @note 已有的取值写进了 WAL 和快照文件，不能修改，只能新增
+ */
+enum class Codec : uint8_t {
+    // 未压缩
+    None = 0,
+    // 内置的 LZ77 类压缩，格式和 LZ4 的块格式相同，前面多了原始数据的长度
+    LZ = 1
+};
+
+/**
+ * @brief 用 codec 压缩数据
+ *
+ * @details LZ 编码的格式为：原始长度(u32，大端) + LZ4 块，压缩速度优先，适合 JSON 这样重复较多的文本
+ * @return 压缩后的数据，codec 为 None 时原样返回
+ */
+std::string Compress(Codec codec, std::string_view data);
+
+/**
+ * @brief 解压用 codec 压缩的数据
+ * @return 数据损坏或者 codec 未知时返回 std::nullopt
+ */
+std::optional<std::string> Decompress(Codec codec, std::string_view data);
+
+} // namespace RR
+
+#endif // RR_COMPRESS_H
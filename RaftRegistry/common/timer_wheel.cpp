@@ -0,0 +1,169 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include "timer_wheel.h"
+#include <algorithm>
+#include "RaftRegistry/common/config.h"
+#include "RaftRegistry/common/util.h"
+
+namespace RR {
+static ConfigVar<uint64_t>::ptr g_timer_wheel_tick = Config::LookUp<uint64_t>("timer.wheel.tick", 10, "timer wheel tick(ms), the precision of all wheel timers");
+static ConfigVar<uint64_t>::ptr g_timer_wheel_slots = Config::LookUp<uint64_t>("timer.wheel.slots", 512, "number of timer wheel slots");
+
+TimerWheel::TimerWheel(uint64_t tick_ms, size_t slots)
+    : m_tick(std::max<uint64_t>(tick_ms, 1)), m_slots(std::max<size_t>(slots, 1)), m_start(GetCuurentTimeMs()) {
+    go [this] {
+        run();
+    };
+}
+
+TimerWheel::~TimerWheel() {
+    m_stop = true;
+    m_stopped >> nullptr;
+}
+
+TimerWheel& TimerWheel::GetInstance() {
+    // 不析构，进程退出时驱动协程可能已经无法调度
+    static TimerWheel* wheel = new TimerWheel(g_timer_wheel_tick->getValue(), g_timer_wheel_slots->getValue());
+    return *wheel;
+}
+
+WheelTimer TimerWheel::addTimer(uint64_t interval_ms, std::function<void()> callback, int times) {
+    auto timer = std::make_shared<Timer>();
+    timer->wheel = this;
+    timer->interval = interval_ms;
+    timer->times = times;
+    timer->callback = std::move(callback);
+    if (times == 0) {
+        timer->cancelled = true;
+        return WheelTimer(timer);
+    }
+    std::unique_lock<MutexType> lock(m_mutex);
+    schedule(timer, interval_ms);
+    return WheelTimer(timer);
+}
+
+size_t TimerWheel::size() {
+    std::unique_lock<MutexType> lock(m_mutex);
+    return m_size;
+}
+
+void TimerWheel::schedule(const std::shared_ptr<Timer>& timer, uint64_t delay_ms) {
+    // 至少在下一个刻度到期，向上取整
+    uint64_t ticks = std::max<uint64_t>((delay_ms + m_tick - 1) / m_tick, 1);
+    timer->expire = m_current + ticks;
+    timer->slot = timer->expire % m_slots.size();
+    auto& slot = m_slots[timer->slot];
+    timer->pos = slot.insert(slot.end(), timer);
+    timer->scheduled = true;
+    ++m_size;
+}
+
+void TimerWheel::unschedule(Timer& timer) {
+    if (!timer.scheduled) {
+        return;
+    }
+    m_slots[timer.slot].erase(timer.pos);
+    timer.scheduled = false;
+    --m_size;
+}
+
+void TimerWheel::stop(const std::shared_ptr<Timer>& timer) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    timer->cancelled = true;
+    unschedule(*timer);
+}
+
+void TimerWheel::reset(const std::shared_ptr<Timer>& timer, std::optional<uint64_t> interval_ms) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    // 停止的定时器和已经触发完的定时器不再启动
+    if (timer->cancelled || timer->times == 0) {
+        return;
+    }
+    unschedule(*timer);
+    if (interval_ms) {
+        timer->interval = *interval_ms;
+    }
+    schedule(timer, timer->interval);
+}
+
+void TimerWheel::run() {
+    while (!m_stop) {
+        co_sleep(m_tick);
+        advance(GetCuurentTimeMs());
+    }
+    m_stopped << true;
+}
+
+void TimerWheel::advance(uint64_t now) {
+    // 到期的定时器和是否是最后一次触发
+    std::vector<std::pair<std::shared_ptr<Timer>, bool>> expired;
+    {
+        std::unique_lock<MutexType> lock(m_mutex);
+        const uint64_t target = (now - m_start) / m_tick;
+        // 协程调度延迟时逐个刻度补上，不会漏掉定时器
+        while (m_current < target) {
+            ++m_current;
+            auto& slot = m_slots[m_current % m_slots.size()];
+            for (auto iter = slot.begin(); iter != slot.end();) {
+                std::shared_ptr<Timer> timer = *iter++;
+                // 到期时间在后面的轮次
+                if (timer->expire > m_current) {
+                    continue;
+                }
+                unschedule(*timer);
+                if (timer->times > 0) {
+                    --timer->times;
+                }
+                bool last = timer->times == 0;
+                if (!last) {
+                    schedule(timer, timer->interval);
+                }
+                expired.emplace_back(std::move(timer), last);
+            }
+        }
+    }
+
+    for (auto& item : expired) {
+        auto& timer = item.first;
+        // 上一次的回调还没有返回，跳过这一次，和 CycleTimer 一样同一个定时器的回调不会并发执行
+        if (timer->cancelled || timer->running.exchange(true)) {
+            continue;
+        }
+        go [timer, last = item.second] {
+            // 到期之后、回调执行之前被停止
+            if (!timer->cancelled) {
+                timer->callback();
+            }
+            if (last) {
+                timer->cancelled = true;
+            }
+            timer->running = false;
+        };
+    }
+}
+
+bool WheelTimer::isCancel() const {
+    return !m_timer || m_timer->cancelled;
+}
+
+void WheelTimer::stop() const {
+    if (m_timer) {
+        m_timer->wheel->stop(m_timer);
+    }
+}
+
+void WheelTimer::reset() const {
+    if (m_timer) {
+        m_timer->wheel->reset(m_timer, std::nullopt);
+    }
+}
+
+void WheelTimer::reset(uint64_t interval_ms) const {
+    if (m_timer) {
+        m_timer->wheel->reset(m_timer, interval_ms);
+    }
+}
+
+} // namespace RR
@@ -0,0 +1,159 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_TIMER_WHEEL_H
+#define RR_TIMER_WHEEL_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <libgo/libgo.h>
+
+namespace RR {
+
+class WheelTimer;
+
+/**
+ * @brief 哈希时间轮，所有定时器共享一个驱动协程
+ *
+ * @details 时间被划分为 tick_ms 毫秒的刻度，定时器按到期的刻度放入 到期刻度 % slots 号槽位的链表中，
+ *          到期时间超过一圈的定时器在槽位中等待后面的轮次。驱动协程每个刻度醒来一次，只检查当前槽位。
+ *          创建、停止、重置定时器都是 O(1) 的链表操作，不会创建协程；
+ *          只有定时器到期时才在新的协程中执行回调，所以回调可以阻塞，也可以在回调中重置或者停止定时器。
+ *          定时器的精度为一个刻度。
+ */
+class TimerWheel {
+public:
+    using MutexType = co::co_mutex;
+
+    /**
+     * @param tick_ms 一个刻度的毫秒数
+     * @param slots 槽位的数量
+     */
+    TimerWheel(uint64_t tick_ms, size_t slots);
+
+    ~TimerWheel();
+
+    /**
+     * @brief 获取进程内共享的时间轮，刻度和槽位数量由 timer.wheel.tick 和 timer.wheel.slots 配置
+     */
+    static TimerWheel& GetInstance();
+
+    /**
+     * @brief 创建一个定时器，和 CycleTimer 的用法相同
+     *
+     * @param interval_ms 定时器的间隔时间ms
+     * @param callback 回调函数，上一次的回调还没有返回时跳过这一次
+     * @param times 触发的次数，-1 表示一直触发直到停止
+     */
+    WheelTimer addTimer(uint64_t interval_ms, std::function<void()> callback, int times = -1);
+
+    /**
+     * @brief 等待中的定时器数量
+     */
+    size_t size();
+
+private:
+    friend class WheelTimer;
+
+    struct Timer {
+        TimerWheel* wheel;
+        uint64_t interval;
+        int times;
+        std::function<void()> callback;
+        // 到期的刻度
+        uint64_t expire = 0;
+        // 在槽位链表中的位置，scheduled 为 true 时有效
+        std::list<std::shared_ptr<Timer>>::iterator pos;
+        size_t slot = 0;
+        bool scheduled = false;
+        std::atomic_bool cancelled = false;
+        // 回调正在执行
+        std::atomic_bool running = false;
+    };
+
+    /**
+     * @brief 从现在开始 delay_ms 毫秒之后到期，不加锁
+     */
+    void schedule(const std::shared_ptr<Timer>& timer, uint64_t delay_ms);
+
+    /**
+     * @brief 从槽位中移除，不加锁
+     */
+    void unschedule(Timer& timer);
+
+    void stop(const std::shared_ptr<Timer>& timer);
+
+    /**
+     * @brief 从现在开始重新计时，interval_ms 为空时使用原来的间隔
+     */
+    void reset(const std::shared_ptr<Timer>& timer, std::optional<uint64_t> interval_ms);
+
+    /**
+     * @brief 驱动协程，按刻度推进时间轮
+     */
+    void run();
+
+    /**
+     * @brief 推进到 now 对应的刻度，执行这期间到期的定时器
+     */
+    void advance(uint64_t now);
+
+private:
+    const uint64_t m_tick;
+    std::vector<std::list<std::shared_ptr<Timer>>> m_slots;
+    // 时间轮创建的时间，刻度从这里开始计算
+    const uint64_t m_start;
+    // 已经处理完的刻度
+    uint64_t m_current = 0;
+    size_t m_size = 0;
+    std::atomic_bool m_stop = false;
+    co::co_chan<bool> m_stopped{1};
+    MutexType m_mutex;
+};
+
+/**
+ * @brief 时间轮上的一个定时器，复制之后指向同一个定时器
+ */
+class WheelTimer {
+public:
+    WheelTimer() = default;
+
+    /**
+     * @brief 定时器存在并且没有停止
+     */
+    explicit operator bool() const { return !isCancel(); }
+
+    bool isCancel() const;
+
+    /**
+     * @brief 停止定时器，O(1)
+     */
+    void stop() const;
+
+    /**
+     * @brief 从现在开始重新计时，O(1)；已经停止的定时器不会被重新启动
+     */
+    void reset() const;
+
+    /**
+     * @brief 以新的间隔时间从现在开始重新计时，之后的每次触发也使用新的间隔
+     */
+    void reset(uint64_t interval_ms) const;
+
+private:
+    friend class TimerWheel;
+
+    explicit WheelTimer(std::shared_ptr<TimerWheel::Timer> timer) : m_timer(std::move(timer)) {}
+
+    std::shared_ptr<TimerWheel::Timer> m_timer;
+};
+
+} // namespace RR
+
+#endif // RR_TIMER_WHEEL_H
@@ -5,9 +5,13 @@
 #include "util.h"
 
 #include <sys/time.h> // Include the header file for gettimeofday
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
 #include <execinfo.h> // Include the header file for backtrace
 
 #include <sstream> // Include the header file for std::stringstream
+#include <array>
 
 #include <libgo/libgo.h> // Include the header file that defines co::Processor
 #include "spdlog/spdlog.h" // Include the header file for spdlog
@@ -27,6 +31,41 @@ uint64_t GetCuurentTimeUs() {
     return tu.tv_sec * 1000000ul + tu.tv_usec;
 }
 
+uint32_t Crc32(const void* data, size_t len, uint32_t crc) {
+    // 查表法，表在第一次调用时生成
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    auto p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool SyncDir(const std::filesystem::path& dir) {
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd < 0) {
+        SPDLOG_LOGGER_ERROR(GetLoggerInstance(), "open directory {} failed: {}", dir.string(), strerror(errno));
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    if (!ok) {
+        SPDLOG_LOGGER_ERROR(GetLoggerInstance(), "fsync directory {} failed: {}", dir.string(), strerror(errno));
+    }
+    close(fd);
+    return ok;
+}
 
 static std::shared_ptr<spdlog::logger> GetLoggerInstanceUnique() {
     // 创建一个日志记录器
@@ -9,6 +9,7 @@
 #include <cstdint> // Add missing include for uint64_t
 #include <concepts> // Add missing include for std::integral
 #include <byteswap.h> // Add missing include for bswap_16, bswap_32, bswap_64
+#include <filesystem>
 #include <memory>
 #include <spdlog/logger.h> // Add missing include for spdlog::logger
 
@@ -69,6 +70,23 @@ constexpr T EndianCast(T value) {
     
 }
 
+/**
+ * @brief 计算 CRC32 校验和（IEEE 802.3 多项式）
+ * 
+ * @param data 数据指针
+ * @param len 数据长度
+ * @param crc 上一段数据的校验和，用于分段计算
+ * @return uint32_t 
+ */
+uint32_t Crc32(const void* data, size_t len, uint32_t crc = 0);
+
+/**
+ * @brief 对目录 fsync，保证目录中新建、rename 的文件项持久化
+ * 
+ * @return 打开目录或者 fsync 失败时返回 false
+ */
+bool SyncDir(const std::filesystem::path& dir);
+
 /**
  * @brief 获取spdlog的logger实例
  * 
@@ -5,6 +5,7 @@
 #ifndef RR_KVRAFT_COMMAND_H
 #define RR_KVRAFT_COMMAND_H
 
+#include <cstdint>
 #include <string>
 #include <fmt/format.h>
 #include "RaftRegistry/rpc/serializer.h"
@@ -17,6 +18,24 @@ using namespace RR::rpc;
 // 定义一个常量字符串，代表服务端处理命令的函数名，用于 RPC 调用
 inline const std::string COMMAND = "KVServer::handleCommand";
 
+// 多个 raft 组共享一个 rpc 服务器时，每个组的命令方法名带上组号；组号为0时就是 COMMAND
+inline std::string CommandMethod(int64_t group) {
+    return group ? COMMAND + "#" + std::to_string(group) : COMMAND;
+}
+
+// 按 key 的哈希（FNV-1a，和平台无关）把 key 分配到 groups 个 raft 组中的一个，客户端据此路由请求
+inline int64_t ShardOf(const std::string& key, int64_t groups) {
+    if (groups <= 1) {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<int64_t>(hash % static_cast<uint64_t>(groups));
+}
+
 // 下面这些常量主要用于定义和识别不同的键值存储事件和主题
 
 inline const std::string KEYEVENTS_PUT = "put";
@@ -39,7 +39,7 @@ namespace {
     [[maybe_unused]] static KVClientIniter s_initer;
 }
 
-KVClient::KVClient(std::map<int64_t, std::string>& servers) {
+KVClient::KVClient(std::map<int64_t, std::string>& servers, int64_t groups) : m_groups(groups) {
     for (auto peer : servers) {
         // 查找每个服务器的地址，并将结果存储在address中
         Address::ptr address = Address::LookUpAny(peer.second);
@@ -90,10 +90,23 @@ Error KVClient::Delete(const std::string& key) {
 }
 Error KVClient::Clear() {
     CommandRequest request{.op = CLEAR};
-    return Command(request).err;
+    if (m_groups <= 1) {
+        return Command(request).err;
+    }
+    // 每个组只保存自己分片的数据，需要逐个清空
+    for (int64_t group = 0; group < m_groups; ++group) {
+        CommandResponse response = GroupCommand(request, group);
+        if (response.err != OK) {
+            return response.err;
+        }
+    }
+    return OK;
 }
 
 CommandResponse KVClient::Command(CommandRequest& request) {
+    if (m_groups > 1) {
+        return GroupCommand(request, ShardOf(request.key, m_groups));
+    }
     request.clientId = m_clientId;
     request.commandId = m_commandId;
     // 开始一个循环，只要m_stop为false就继续。
@@ -133,6 +146,50 @@ CommandResponse KVClient::Command(CommandRequest& request) {
     return {.err = Error::CLOSED};
 }
 
+CommandResponse KVClient::GroupCommand(CommandRequest& request, int64_t group) {
+    request.clientId = m_clientId;
+    request.commandId = m_commandId;
+    // 每个组独立去重，commandId 在所有组间单调递增，对单个组仍然是递增的
+    if (!m_groupLeaders.count(group)) {
+        m_groupLeaders[group] = m_servers.begin()->first;
+    }
+    while (!m_stop) {
+        int64_t& leaderId = m_groupLeaders[group];
+        RpcClient::ptr& client = m_nodeClients[leaderId];
+        if (!client) {
+            client = std::make_shared<RpcClient>();
+            client->setTimeout(s_rpc_timeout);
+            client->setHeartbeat(false);
+        }
+        if (client->isClosed() && !client->connect(m_servers[leaderId])) {
+            leaderId = nextLeaderId(leaderId);
+            co_sleep(s_connect_delay);
+            continue;
+        }
+
+        CommandResponse response;
+        Result<CommandResponse> result = client->call<CommandResponse>(CommandMethod(group), request);
+        if (result.getCode() == RpcState::RPC_SUCCESS) {
+            response = result.getVal();
+        }
+        if (result.getCode() != RpcState::RPC_SUCCESS || response.err == WRONG_LEADER) {
+            // 连接出错时才关闭，其他组可能还在使用这个连接
+            if (result.getCode() != RpcState::RPC_SUCCESS) {
+                client->close();
+            }
+            if (response.leaderId >= 0 && response.leaderId != leaderId) {
+                leaderId = response.leaderId;
+            } else {
+                leaderId = nextLeaderId(leaderId);
+            }
+            continue;
+        }
+        ++m_commandId;
+        return response;
+    }
+    return {.err = Error::CLOSED};
+}
+
 bool KVClient::connect() {
     if (!isClosed()) {
         return true;
@@ -147,7 +204,7 @@ bool KVClient::connect() {
         if (m_heart.isCancel()) {
             // 启动一个周期为3000毫秒的定时器，每次触发时调用一个lambda函数
             // lambda函数调用KVClient的Get方法，发送一个空的GET请求，用于保持心跳
-            m_heart = CycleTimer(3000, [this] {
+            m_heart = TimerWheel::GetInstance().addTimer(3000, [this] {
                 [[maybe unused]] std::string dummy;
                 Get("", dummy);
             });
@@ -159,10 +216,14 @@ bool KVClient::connect() {
 }
 
 int64_t KVClient::nextLeaderId() {
-    auto iter = m_servers.find(m_leaderId);
-    // 如果迭代器等于m_servers的end迭代器，说明m_leaderId在m_servers中不存在
+    return nextLeaderId(m_leaderId);
+}
+
+int64_t KVClient::nextLeaderId(int64_t id) {
+    auto iter = m_servers.find(id);
+    // 如果迭代器等于m_servers的end迭代器，说明id在m_servers中不存在
     if (iter == m_servers.end()) {
-        SPDLOG_LOGGER_CRITICAL(Logger, "leader id {} not exist", m_leaderId);
+        SPDLOG_LOGGER_CRITICAL(Logger, "leader id {} not exist", id);
         return 0;
     }
     // 根据函数名可知，这里是获取下一个leader的id
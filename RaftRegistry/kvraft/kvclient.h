@@ -26,7 +26,8 @@ public:
     using MutexType = co::co_mutex;
 
     // 根据传入的map中的地址，初始化m_servers
-    KVClient(std::map<int64_t, std::string>& servers);
+    // groups 为服务端 raft 组的数量（见 MultiKVServer），大于1时按 key 分片路由到各个组
+    KVClient(std::map<int64_t, std::string>& servers, int64_t groups = 1);
     ~KVClient();
 
     // 声明键值存储的基本操作接口，包括获取、放置、追加、删除和清除
@@ -85,8 +86,11 @@ private:
     // 真正发送请求的函数，这个是rpc中call的上层；CommandRequest包含请求的元信息和数据，但是对于rpc中的call来说，CommandRequest是rpc的数据部分
     // 只要m_stop不为false，即客户端没有停止，就会一直执行
     CommandResponse Command(CommandRequest& request);
+    // 把请求发送给 group 组的 leader，每个节点一个连接，被所有组共享
+    CommandResponse GroupCommand(CommandRequest& request, int64_t group);
     bool connect();
     int64_t nextLeaderId();
+    int64_t nextLeaderId(int64_t id);
     // 获取一个随机数
     static int64_t GetRandom();
 
@@ -108,7 +112,13 @@ std::atomic_bool m_stop;
 co::co_chan<bool> m_stopChan;
 std::vector<std::string> m_subs;
 MutexType m_pubsubMutex;
-CycleTimerTocken m_heart;
+WheelTimer m_heart;
+// 服务端 raft 组的数量
+int64_t m_groups;
+// 每个组的领导者id，key 为组号
+std::map<int64_t, int64_t> m_groupLeaders;
+// 分片模式下到每个节点的连接，key 为服务器 ID
+std::map<int64_t, RpcClient::ptr> m_nodeClients;
 }
 
 }
@@ -12,6 +12,33 @@ using namespace RR;
 
 static auto Logger = GetLoggerInstance();
 
+// 有界陈旧读：follower 落后 leader 不超过这么多条日志时直接读本地状态，-1 表示关闭
+static ConfigVar<int64_t>::ptr g_read_max_stale_entries = Config::LookUp<int64_t>("kvraft.read.max_stale_entries", -1, "follower serves reads locally if it lags the leader by at most this many entries, -1 disables");
+// 有界陈旧读：follower 在这么长时间内收到过 leader 的消息时直接读本地状态，0 表示关闭
+static ConfigVar<uint64_t>::ptr g_read_max_stale_ms = Config::LookUp<uint64_t>("kvraft.read.max_stale_ms", 0, "follower serves reads locally if its applied state was up to date with the leader's commit within this time(ms), 0 disables");
+
+static int64_t s_read_max_stale_entries;
+static uint64_t s_read_max_stale_ms;
+
+namespace {
+struct KVServerIniter {
+    KVServerIniter() {
+        s_read_max_stale_entries = g_read_max_stale_entries->getValue();
+        g_read_max_stale_entries->addListener([] (const int64_t& old_value, const int64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "kvraft read max stale entries changed from {} to {}", old_value, new_value);
+            s_read_max_stale_entries = new_value;
+        });
+        s_read_max_stale_ms = g_read_max_stale_ms->getValue();
+        g_read_max_stale_ms->addListener([] (const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "kvraft read max stale ms changed from {} to {}", old_value, new_value);
+            s_read_max_stale_ms = new_value;
+        });
+    }
+};
+
+[[maybe_unused]] static KVServerIniter s_initer;
+}
+
 // 定义静态函数GetRandom，用于生成随机数
 static int64_t GetRandom() {
     static std::default_random_engine engine(GetCuurentTimeMs());
@@ -21,7 +48,7 @@ static int64_t GetRandom() {
 
 KVServer::KVServer(std::map<int64_t, std::string>& servers, int64_t id, Persister::ptr persister, int64_t maxRaftState) : m_id(id), m_persister(persister), m_maxRaftState(maxRaftState) {
     Address::ptr addr = Address::LookUpAny(servers[id]);
-    m_raft = std::make_unique<RaftNode>(servers, id, persister, m_applyCh);
+    m_raft = std::make_shared<RaftNode>(servers, id, persister, m_applyCh);
     // 尝试绑定到地址，如果失败则重试
     while(!m_raft->bind(addr)) {
         SPDLOG_LOGGER_WARN(Logger, "kvserver[{}] bind {} fail", id, addr->toString());
@@ -34,6 +61,18 @@ KVServer::KVServer(std::map<int64_t, std::string>& servers, int64_t id, Persiste
     });
 }
 
+KVServer::KVServer(MultiRaft& host, int64_t group, Persister::ptr persister, int64_t maxRaftState) : m_id(host.getId()), m_persister(persister), m_maxRaftState(maxRaftState) {
+    m_raft = host.createGroup(group, persister, m_applyCh);
+    if (!m_raft) {
+        SPDLOG_LOGGER_CRITICAL(Logger, "kvserver[{}] create raft group {} fail", m_id, group);
+        exit(EXIT_FAILURE);
+    }
+    // 每个组的命令方法名带上组号，注册在共享的服务器上
+    host.registerMethod(CommandMethod(group), [this](CommandRequest request) {
+        return handleCommand(std::move(request));
+    });
+}
+
 KVServer::~KVServer() {
     stop();
 }
@@ -43,9 +82,19 @@ void KVServer::start() {
     go [this] { // 启动一个协程运行applier函数，用于应用Raft日志
         applier();
     };
+    // 没有新日志可应用的组不会检查快照条件，拖住共享 WAL 的旧段时由 WAL 通知；回调不能阻塞组提交协程
+    m_persister->setCompactor([this] {
+        go [this] {
+            std::unique_lock<MutexType> lock(m_mutex);
+            if (needSnapshot()) {
+                saveSnapshot(m_lastApplied);
+            }
+        };
+    });
     m_raft->start(); // 启动Raft节点
 }
 void KVServer::stop() {
+    m_persister->setCompactor(nullptr);
     std::unique_lock<MutexType> lock(m_mutex);
     m_raft->stop();
 }
@@ -56,12 +105,22 @@ CommandResponse KVServer::handleCommand(CommandRequest request) {
         SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] processes commandrequest {} with commandresponse {}", m_id, request.toString(), response.toString());
     };
 
+    // 只读请求走 ReadIndex，不需要写入日志
+    if (request.op == GET) {
+        response = read(request.key);
+        return response;
+    }
+
     std::unique_lock<MutexType> lock(m_mutex);
     // 如果请求不是GET类型，并且是重复请求，则直接返回之前的响应结果
     if (request.op != GET && isDuplicateRequest(request.clientId, request.commandId)) {
-        response = m_lastOperation[request.clientId].second;
+        response = (*m_lastOperation)[request.clientId].second;
         return response;
     }
+    // 提议之前注册通知通道，日志可能在 propose 返回之前就已经提交并应用；
+    // 通道带一个缓冲，应用日志时不会阻塞
+    const auto key = std::make_pair(request.clientId, request.commandId);
+    auto chan = m_notifyChans.try_emplace(key, 1).first->second;
     lock.unlock(); // 解锁，因为接下来的操作可能会阻塞，不应持有锁
 
     // 向Raft集群提交命令，等待命令被处理
@@ -69,41 +128,40 @@ CommandResponse KVServer::handleCommand(CommandRequest request) {
     if (!entry) { // 如果命令未被处理（例如当前节点不是领导者），则返回错误信息
         response.err = WRONG_LEADER;
         response.leaderId = m_raft->getLeaderId();
+        lock.lock();
+        m_notifyChans.erase(key);
         return response;
     }
 
-    lock.lock();
-    auto chan = m_notifyChans[entry->index]; // 获取与命令对应的通知通道
-    lock.unlock();
     // 等待命令的处理结果，如果超时，则返回超时错误
     if (!chan.TimedPop(response, std::chrono::milliseconds(RR::Config::LookUp<uint64_t>("raft.rpc.timeout")->getValue()))) {
         response.err = TIMEOUT;
     }
     lock.lock();
 
-    m_notifyChans.erase(entry->index); // 删除通知通道
+    m_notifyChans.erase(key); // 删除通知通道
     // 如果命令处理成功，根据命令类型执行相应的后续操作
     if (response.err == Error::OK) {
         switch (request.op) {
             case PUT:
                 go [key = request.key, this] {
                     // 发布键值设置事件
-                    m_raft->publish(TOPIC_KEYEVENT_PUT, key);
-                    m_raft->publish(TOPIC_KEYSPACE + key, KEYEVENTS_PUT);
+                    m_raft->getServer()->publish(TOPIC_KEYEVENT_PUT, key);
+                    m_raft->getServer()->publish(TOPIC_KEYSPACE + key, KEYEVENTS_PUT);
                 };
                 break;
             case APPEND:
                 go [key = request.key, this] {
                     // 发布键值追加事件
-                    m_raft->publish(TOPIC_KEYEVENT_APPEND, key);
-                    m_raft->publish(TOPIC_KEYSPACE + key, KEYEVENTS_APPEND);
+                    m_raft->getServer()->publish(TOPIC_KEYEVENT_APPEND, key);
+                    m_raft->getServer()->publish(TOPIC_KEYSPACE + key, KEYEVENTS_APPEND);
                 };
                 break;
             case DELETE:
                 go [key = request.key, this] {
                     // 发布键值删除事件
-                    m_raft->publish(TOPIC_KEYEVENT_DELETE, key);
-                    m_raft->publish(TOPIC_KEYSPACE + key, KEYEVENTS_DELETE);
+                    m_raft->getServer()->publish(TOPIC_KEYEVENT_DELETE, key);
+                    m_raft->getServer()->publish(TOPIC_KEYSPACE + key, KEYEVENTS_DELETE);
                 };
                 break;
             default:
@@ -113,6 +171,60 @@ CommandResponse KVServer::handleCommand(CommandRequest request) {
     return response;
 }
 
+CommandResponse KVServer::read(const std::string& key) {
+    CommandResponse response;
+    // 开启有界陈旧读时，follower 落后得不多就直接读本地状态，不需要访问 leader
+    if ((s_read_max_stale_entries >= 0 || s_read_max_stale_ms > 0) && !m_raft->isLeader()) {
+        auto [leaderCommit, contact] = m_raft->getLeaderCommit();
+        std::unique_lock<MutexType> lock(m_mutex);
+        const int64_t applied = m_lastApplied;
+        bool fresh = contact && s_read_max_stale_entries >= 0 && leaderCommit - applied <= s_read_max_stale_entries;
+        // 按时间限制的是本地状态的年龄：leader 的提交索引最后一次被本地应用覆盖到现在的时间，而不是最近联系 leader 的时间；
+        // 查询时不持有 m_mutex，之后读到的状态只会更新
+        if (!fresh && s_read_max_stale_ms > 0) {
+            lock.unlock();
+            uint64_t appliedTime = m_raft->getAppliedTime(applied);
+            fresh = appliedTime && GetCuurentTimeMs() - appliedTime <= s_read_max_stale_ms;
+            lock.lock();
+        }
+        if (fresh) {
+            auto iter = m_data->find(key);
+            if (iter == m_data->end()) {
+                response.err = NO_KEY;
+            } else {
+                response.value = iter->second;
+            }
+            return response;
+        }
+    }
+
+    // 向 leader 确认可以安全读取的索引，follower 通过 rpc 向 leader 请求
+    auto index = m_raft->readIndex();
+    if (!index) {
+        response.err = WRONG_LEADER;
+        response.leaderId = m_raft->getLeaderId();
+        return response;
+    }
+
+    std::unique_lock<MutexType> lock(m_mutex);
+    // 等待状态机应用到该索引，超时返回超时错误
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RR::Config::LookUp<uint64_t>("raft.rpc.timeout")->getValue());
+    while (m_lastApplied < *index) {
+        if (m_appliedCond.wait_until(lock, deadline) == std::cv_status::timeout && m_lastApplied < *index) {
+            response.err = TIMEOUT;
+            return response;
+        }
+    }
+
+    auto iter = m_data->find(key);
+    if (iter == m_data->end()) {
+        response.err = NO_KEY;
+    } else {
+        response.value = iter->second;
+    }
+    return response;
+}
+
 CommandResponse KVServer::Get(const std::string& key) {
     // 构建GET类型的命令请求，并生成随机的命令ID
     CommandRequest request{.op = GET, .key = key, .commandId = GetRandom()};
@@ -144,70 +256,111 @@ void KVServer::applier() {
     // 创建一个ApplyMsg对象，用于接收日志消息
     ApplyMsg msg{};
     while(m_applyCh.pop(msg)) { // 循环从通道中取出日志消息并处理
+        // 状态机应用完成后通知 raft 推进 applied，在释放锁之后进行
+        int64_t applied = 0;
+        co_defer_scope {
+            if (applied) {
+                m_raft->appliedTo(applied);
+            }
+        };
         std::unique_lock<MutexType> lock(m_mutex);
+        // 每处理一条消息都唤醒等待 ReadIndex 的读请求
+        co_defer_scope {
+            m_appliedCond.notify_all();
+        };
         SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] tries to apply message {}", m_id, msg.toString());
         // 根据消息类型处理消息
         if (msg.type == ApplyMsg::SNAPSHOT) { // 如果是快照消息
             auto snap = std::make_shared<Snapshot>(); // 创建一个快照对象
             snap->metadata.index = msg.index;
             snap->metadata.term = msg.term;
-            snap->data = std::move(msg.data);
+            snap->data = msg.data.release();
             m_raft->persistSnapshot(snap); // 持久化快照
             readSnapshot(snap); // 从快照中恢复状态
             m_lastApplied = msg.index; // 更新已应用的最后一个日志索引
             continue;
-        } else if (msg.type = ApplyMsg::ENTRY) { // 如果是日志条目消息
-            // 如果日志条目的数据为空，可能是领导者选举成功后提交的空日志，直接跳过
-            if (msg.data.empty()) {
-                continue;
-            }
-
-            int64_t msgIndex = msg.index;
-            // 如果日志条目的索引小于或等于已应用的最后一条日志的索引，则丢弃该条目
-            if (msgIndex <= m_lastApplied) {
-                SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] discards outdated message {} because a newer snapshot which lastApplied is {} has been restored", m_id, msg.toString(), m_lastApplied);
-                continue;
-            }
-            // 更新最后应用的日志索引
-            m_lastApplied = msgIndex;
-            // 将日志条目的数据转换为命令请求
-            auto request = msg.as<CommandRequest>();
-            // 创建一个响应对象
-            CommandResponse response;
-            // 如果命令不是GET类型，并且是重复请求，则不应用该命令到状态机
-            if (request.op != GET && isDuplicateRequest(request.clientId, request.commandId)) {
-                SPDLOG_LOGGER_DEBUG(Logger,  "Node[{}] doesn't apply duplicated message {} to stateMachine because maxAppliedCommandId is {} for client {}", m_id, request.toString(), m_lastOperation[request.clientId].second.toString(), request.clientId);
-                response = m_lastOperation[request.clientId].second;
-            } else {
-                // 将日志条目应用到状态机，并获取响应结果
-                response = applyLogToStateMachine(request);
-                // 如果命令不是GET类型，则记录该客户端的最后一次操作
-                if (request.op != GET) {
-                    m_lastOperation[request.clientId] = {request.commandId, response};
-                }
-            }
-            // 获取当前节点的状态（任期和是否为领导者）
-            auto [term, isLeader] = m_raft->getState();
-            // 如果当前节点是领导者，并且日志条目的任期与当前任期一致，则通过通知通道发送响应结果
-            if (isLeader && msg.term == term) {
-                m_notifyChans[msgIndex] << response;
-            }
-            // 如果需要创建快照，则保存快照
-            if (needSnapshot()) {
-                saveSnapshot(msg.index);
+        } else if (msg.type == ApplyMsg::ENTRY) { // 如果是单条日志条目消息
+            applyEntry(Entry{.index = msg.index, .term = msg.term, .data = std::move(msg.data)});
+        } else if (msg.type == ApplyMsg::ENTRIES) { // 如果是一段连续的日志，在一次加锁内全部应用
+            for (const Entry& entry : msg.entries) {
+                applyEntry(entry);
             }
         } else {
-            SPDLOG_LOGGER_CRITICAL(Logger, "unexpected applymsg type: {}, index: {}, term: {}, data: {}", static_cast<int>(msg.type), msg.index, msg.term, msg.data);
+            SPDLOG_LOGGER_CRITICAL(Logger, "unexpected applymsg type: {}, index: {}, term: {}, data: {}", static_cast<int>(msg.type), msg.index, msg.term, msg.data.view());
             exit(EXIT_FAILURE);
         }
+        applied = m_lastApplied;
+        // 如果需要创建快照，则保存快照，每批日志只检查一次
+        if (needSnapshot()) {
+            saveSnapshot(m_lastApplied);
+        }
+    }
+}
+
+void KVServer::applyEntry(const Entry& entry) {
+    // 如果日志条目的数据为空，是领导者选举成功后提交的空日志，只推进已应用的索引
+    if (entry.data.empty()) {
+        m_lastApplied = std::max(m_lastApplied, entry.index);
+        return;
+    }
+
+    // 如果日志条目的索引小于或等于已应用的最后一条日志的索引，则丢弃该条目
+    if (entry.index <= m_lastApplied) {
+        SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] discards outdated entry [index: {}, term: {}] because a newer snapshot which lastApplied is {} has been restored", m_id, entry.index, entry.term, m_lastApplied);
+        return;
+    }
+    // 更新最后应用的日志索引
+    m_lastApplied = entry.index;
+    // 将日志条目的数据转换为命令请求
+    CommandRequest request;
+    Serializer s(entry.data.data(), static_cast<int>(entry.data.size()));
+    s >> request;
+    // 创建一个响应对象
+    CommandResponse response;
+    // 如果命令不是GET类型，并且是重复请求，则不应用该命令到状态机
+    if (request.op != GET && isDuplicateRequest(request.clientId, request.commandId)) {
+        SPDLOG_LOGGER_DEBUG(Logger,  "Node[{}] doesn't apply duplicated message {} to stateMachine because maxAppliedCommandId is {} for client {}", m_id, request.toString(), (*m_lastOperation)[request.clientId].second.toString(), request.clientId);
+        response = (*m_lastOperation)[request.clientId].second;
+    } else {
+        // 后台快照还在使用当前的状态时，先复制一份再写
+        detachState();
+        // 将日志条目应用到状态机，并获取响应结果
+        response = applyLogToStateMachine(request);
+        // 如果命令不是GET类型，则记录该客户端的最后一次操作
+        if (request.op != GET) {
+            (*m_lastOperation)[request.clientId] = {request.commandId, response};
+        }
+    }
+    // 如果有等待这条命令的请求，通过通知通道发送响应结果；持有 m_mutex，所以只做不阻塞的 TryPush
+    if (request.op != GET) {
+        auto iter = m_notifyChans.find(std::make_pair(request.clientId, request.commandId));
+        if (iter != m_notifyChans.end()) {
+            iter->second.TryPush(response);
+        }
     }
 }
 
 void KVServer::saveSnapshot(int64_t index) {
-    Serializer s;
-    s << m_data << m_lastOperation; // 将键值对映射和最后操作映射序列化
-    s.reset();
-    m_raft->persistStateAndSnapshot(index, s.toString()); // 通过Raft节点持久化状态和快照
+    // 只复制指针，得到这一时刻的状态；之后的写入会先复制一份新的状态，不影响正在保存的快照
+    m_snapshotting = true;
+    go [data = m_data, operations = m_lastOperation, index, this] {
+        Serializer s;
+        s << *data << *operations; // 将键值对映射和最后操作映射序列化
+        s.reset();
+        m_raft->persistStateAndSnapshot(index, s.toString()); // 通过Raft节点持久化状态和快照
+        std::unique_lock<MutexType> lock(m_mutex);
+        m_snapshotting = false;
+        SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] saved snapshot at index {} in background", m_id, index);
+    };
+}
+
+void KVServer::detachState() {
+    if (m_data.use_count() > 1) {
+        m_data = std::make_shared<KVMap>(*m_data);
+    }
+    if (m_lastOperation.use_count() > 1) {
+        m_lastOperation = std::make_shared<OperationMap>(*m_lastOperation);
+    }
 }
 
 void KVServer::readSnapshot(Snapshot::ptr snapshot) {
@@ -216,27 +369,31 @@ void KVServer::readSnapshot(Snapshot::ptr snapshot) {
     }
     Serializer s(snapshot->data); // 从快照中读取数据
     try {
-        m_data.clear(); // 清空当前的键值对映射
-        m_lastOperation.clear(); // 清空当前的最后操作映射
-        s >> m_data >> m_lastOperation; // 从序列化器中反序列化键值对映射和最后操作映射
+        // 换成新的状态，正在保存的后台快照仍然持有旧的状态
+        auto data = std::make_shared<KVMap>();
+        auto operations = std::make_shared<OperationMap>();
+        s >> *data >> *operations; // 从序列化器中反序列化键值对映射和最后操作映射
+        m_data = std::move(data);
+        m_lastOperation = std::move(operations);
     } catch(...) {
         SPDLOG_LOGGER_CRITICAL(Logger, "KVServer[{}] read snapshot failed", m_id); // 如果反序列化失败，则记录严重错误
     }
 }
 
 bool KVServer::isDuplicateRequest(int64_t client, int64_t command) {
-    auto iter = m_lastOperation.find(client);// 在最后操作映射中查找该客户端的记录
-    if (iter == m_lastOperation.end()) { // 如果没有找到，则不是重复请求
+    auto iter = m_lastOperation->find(client);// 在最后操作映射中查找该客户端的记录
+    if (iter == m_lastOperation->end()) { // 如果没有找到，则不是重复请求
         return false;
     }
     return iter->second.first == command; // 如果找到的记录中的命令ID与当前命令ID相同，则是重复请求
 }
 
 bool KVServer::needSnapshot() {
-    if (m_maxRaftState == -1) { // 如果没有设置快照阈值，则不需要创建快照
+    if (m_maxRaftState == -1 || m_snapshotting) { // 如果没有设置快照阈值，或者已经在后台保存快照，则不需要创建快照
         return false;
     }
-    return m_persister->getRaftStateSize() >= m_maxRaftState; // 如果Raft状态的大小超过了阈值，则需要创建快照
+    // 如果Raft状态的大小超过了阈值，或者写入很少的组拖住了共享 WAL 的旧段，则需要创建快照
+    return m_persister->getRaftStateSize() >= m_maxRaftState || m_persister->pinsWAL();
 }
 
 CommandResponse KVServer::applyLogToStateMachine(const CommandRequest& request) { // 将日志应用到状态
@@ -246,29 +403,29 @@ CommandResponse KVServer::applyLogToStateMachine(const CommandRequest& request)
     // 根据命令的操作类型执行相应的操作
     switch (request.operation) {
         case GET: // 如果是获取操作
-            iter = m_data.find(request.key); // 在键值对映射中查找键
-            if (iter == m_data.end()) { // 如果没有找到键，则返回错误信息
+            iter = m_data->find(request.key); // 在键值对映射中查找键
+            if (iter == m_data->end()) { // 如果没有找到键，则返回错误信息
                 response.err = NO_KEY;
             } else {
                 response.value = iter->second; // 如果找到键，则返回对应的值
             }
             break;
         case PUT: // 如果是设置操作
-            m_data[request.key] = request.value;
+            (*m_data)[request.key] = request.value;
             break;
         case APPEND: // 如果是追加操作
-            m_data[request.key] += request.value;
+            (*m_data)[request.key] += request.value;
             break;
         case DELETE: // 如果是删除操作
-            iter = m_data.find(request.key); // 在键值对映射中查找键
-            if (iter == m_data.end()) {
+            iter = m_data->find(request.key); // 在键值对映射中查找键
+            if (iter == m_data->end()) {
                 response.err = NO_KEY;
             } else {
-                m_data.erase(iter); // 如果找到键，则删除键值对
+                m_data->erase(iter); // 如果找到键，则删除键值对
             }
             break;
         case  CLEAR:
-            m_data.clear(); // 如果是清除操作，则清空键值对映射
+            m_data->clear(); // 如果是清除操作，则清空键值对映射
             break;
         default:
             SPDLOG_LOGGER_CRITICAL(Logger, "unexpected operation {}", static_cast<int>(request.op));
@@ -8,10 +8,12 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <utility>
 #include <libgo/libgo.h>
 #include <cstdint>
 #include "command.h"
 #include "RaftRegistry/raft/raft_node.h"
+#include "RaftRegistry/raft/multi_raft.h"
 
 namespace RR::kvraft {
 using namespace RR::raft;
@@ -21,8 +23,11 @@ public:
     using ptr = std::shared_ptr<KVServer>;
     using MutexType = co::co_mutex;
     using KVMap = std::map<std::string, std::string>;
+    using OperationMap = std::map<int64_t, std::pair<int64_t, CommandResponse>>;
 
     KVServer(std::map<int64_t, std::string>& servers, int64_t id, Persister::ptr persister, int64_t maxRaftState = 1000);
+    // 作为 multi-raft 中的一个组运行，rpc 服务器由 host 绑定和启动
+    KVServer(MultiRaft& host, int64_t group, Persister::ptr persister, int64_t maxRaftState = 1000);
     ~KVServer();
 
     void start(); // 启动KV服务器，包括启动Raft节点和应用日志的协程
@@ -44,13 +49,19 @@ public:
     CommandResponse Clear();
 
     // 获取当前的键值对数据，用于调试或其他目的
-    [[nodiscard]] const KVMap& getData() const { return m_data;}
+    [[nodiscard]] const KVMap& getData() const { return *m_data;}
 
 private:
     // 应用Raft日志到状态机的后台协程
     void applier();
-    // 保存当前状态的快照
+    // 应用一条日志到状态机，调用者持有 m_mutex
+    void applyEntry(const Entry& entry);
+    // 通过 ReadIndex 处理只读请求，不写入日志；follower 也可以处理，开启有界陈旧读时直接读本地状态
+    CommandResponse read(const std::string& key);
+    // 在后台协程中保存当前状态的快照，不阻塞日志应用
     void saveSnapshot(int64_t index);
+    // 写状态机之前调用，后台快照还持有当前状态时先复制一份（写时复制）
+    void detachState();
     // 从快照中恢复状态
     void readSnapshot(Snapshot::ptr snapshot);
 
@@ -66,14 +77,16 @@ private:
     int64_t m_id; // 服务器的ID
     co::co_chan<raft::ApplyMsg> m_applyCh; // 应用Raft日志的通道
 
-    KVMap m_data;// 存储键值对的映射
+    std::shared_ptr<KVMap> m_data = std::make_shared<KVMap>();// 存储键值对的映射，和后台快照共享，写入前通过 detachState 复制
     Persister::ptr m_persister; // 持久化器，用于保存Raft状态和快照
-    std::unique_ptr<RaftNode> m_raft; // Raft节点实例
+    RaftNode::ptr m_raft; // Raft节点实例
 
-    std::map<int64_t, std::pair<int64_t, CommandRequest>> m_lastOperation; // 记录每个客户端的最后一次操作，用于去重
-    std::map<int64_t, co::co_chan<CommandResponse>> m_notifyChans; // 用于通知命令处理结果的通道映射，key为日志索引
+    std::shared_ptr<OperationMap> m_lastOperation = std::make_shared<OperationMap>(); // 记录每个客户端的最后一次操作，用于去重
+    bool m_snapshotting = false; // 是否有正在后台保存的快照
+    std::map<std::pair<int64_t, int64_t>, co::co_chan<CommandResponse>> m_notifyChans; // 用于通知命令处理结果的通道映射，key为(clientId, commandId)，提议之前注册
 
     int64_t m_lastApplied = 0; // 已应用的最后一个日志条目的索引
+    co::co_condition_variable m_appliedCond; // m_lastApplied 推进时通知等待中的读请求
     int64_t m_maxRaftState = -1; // Raft状态达到此大小时，需要创建快照
 }
 
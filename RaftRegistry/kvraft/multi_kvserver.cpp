@@ -0,0 +1,51 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include "multi_kvserver.h"
+#include "RaftRegistry/command/config.h"
+
+namespace RR::kvraft {
+static auto Logger = GetLoggerInstance();
+
+MultiKVServer::MultiKVServer(std::map<int64_t, std::string>& servers, int64_t id, int64_t groups, const std::filesystem::path& dir, int64_t maxRaftState) {
+    Address::ptr addr = Address::LookUpAny(servers[id]);
+    m_host = std::make_shared<MultiRaft>(servers, id);
+    // 尝试绑定到地址，如果失败则重试
+    while (!m_host->bind(addr)) {
+        SPDLOG_LOGGER_WARN(Logger, "multi kvserver[{}] bind {} fail", id, addr->toString());
+        sleep(3);
+    }
+
+    // 所有组的日志写进同一个 WAL，一次 fdatasync 持久化所有组的写入
+    auto wal = std::make_shared<SharedWAL>(dir / "wal");
+    for (int64_t group = 0; group < groups; ++group) {
+        auto persister = std::make_shared<Persister>(dir / ("group-" + std::to_string(group)), wal, group);
+        m_groups[group] = std::make_shared<KVServer>(*m_host, group, persister, maxRaftState);
+    }
+}
+
+MultiKVServer::~MultiKVServer() {
+    stop();
+}
+
+void MultiKVServer::start() {
+    for (auto& group : m_groups) {
+        group.second->start();
+    }
+    m_host->start();
+}
+
+void MultiKVServer::stop() {
+    for (auto& group : m_groups) {
+        group.second->stop();
+    }
+    m_host->stop();
+}
+
+KVServer::ptr MultiKVServer::getGroup(int64_t group) {
+    auto iter = m_groups.find(group);
+    return iter == m_groups.end() ? nullptr : iter->second;
+}
+
+} // namespace RR::kvraft
@@ -0,0 +1,47 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_KVRAFT_MULTI_KVSERVER_H
+#define RR_KVRAFT_MULTI_KVSERVER_H
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include "kvserver.h"
+#include "RaftRegistry/raft/multi_raft.h"
+
+namespace RR::kvraft {
+using namespace RR::raft;
+
+/**
+ * @brief 按 key 分片的 KV 服务器，一个节点上运行 groups 个 raft 组
+ *
+ * @details key 按 ShardOf(key, groups) 分配到各个组，每个组是一个独立的 KVServer，
+ *          有自己的状态机和保存硬状态、快照的目录（dir/group-N）；所有组共享一个 rpc 服务器、到其他节点的连接，
+ *          以及一个 WAL（dir/wal），所有组的写入合并刷盘。
+ *          客户端用相同的 groups 构造 KVClient 即可按分片路由请求。
+ */
+class MultiKVServer {
+public:
+    using ptr = std::shared_ptr<MultiKVServer>;
+
+    MultiKVServer(std::map<int64_t, std::string>& servers, int64_t id, int64_t groups, const std::filesystem::path& dir, int64_t maxRaftState = 1000);
+    ~MultiKVServer();
+
+    void start(); // 启动所有组，然后启动共享的 rpc 服务器
+    void stop();
+
+    // 获取某个组的 KV 服务器，不存在时返回 nullptr
+    KVServer::ptr getGroup(int64_t group);
+
+private:
+    MultiRaft::ptr m_host; // 所有组共享的 rpc 服务器
+    std::map<int64_t, KVServer::ptr> m_groups; // key 为组号
+};
+
+} // namespace RR::kvraft
+
+#endif // RR_KVRAFT_MULTI_KVSERVER_H
@@ -5,7 +5,9 @@
 #ifndef RR_RAFT_ENTRY_H
 #define RR_RAFT_ENTRY_H
 
+#include "RaftRegistry/common/compress.h"
 #include "RaftRegistry/rpc/serializer.h"
+#include "payload.h"
 
 namespace RR::raft {
 
@@ -13,21 +15,39 @@ namespace RR::raft {
 struct Entry {
     int64_t index = 0; // 日志条目的索引，用于日志中的排序
     int64_t term = 0; // 创建日志条目时的任期号，用于Raft的领导人选举和一致性检查
-    std::string data{}; // 要应用于状态机的命令或操作，以序列化数据形式存储
+    Payload data{}; // 要应用于状态机的命令或操作，以序列化数据形式存储，复制日志条目时共享同一份数据
+    Codec codec = Codec::None; // data 的压缩编码，日志在内存、WAL 和网络中都保持压缩，应用到状态机之前才解压
+
+    /**
+     * @brief 解压 data，解压后 codec 为 None，不影响共享同一份数据的其他副本
+     * @return 数据损坏时返回 false
+     */
+    bool decompress() {
+        if (codec == Codec::None) {
+            return true;
+        }
+        auto raw = Decompress(codec, data.view());
+        if (!raw) {
+            return false;
+        }
+        data = Payload(std::move(*raw));
+        codec = Codec::None;
+        return true;
+    }
 
     std::string toString() const {
-        return fmt::format("Term: {}, Index: {}, Data: {}", term, index, data);
+        return fmt::format("Term: {}, Index: {}, Data: {}", term, index, data.view());
     }
 
     // 使用提供的Serializer实例序列化日志条目，用于存储或网络传输
     friend rpc::Serializer& operator << (rpc::Serializer& s, const Entry& e) {
-        s << e.index << e.term << e.data;
+        s << e.index << e.term << e.codec << e.data;
         return s;
     }
 
     // 使用提供的Serializer实例反序列化日志条目，用于从存储或网络读取
     friend rpc::Serializer& operator >> (rpc::Serializer& s, Entry& s) {
-        s >> e.index >> e.term >> e.data;
+        s >> e.index >> e.term >> e.codec >> e.data;
         return s;
     }
 }
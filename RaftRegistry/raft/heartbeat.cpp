@@ -0,0 +1,140 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include "heartbeat.h"
+#include <spdlog/spdlog.h>
+#include "raft_node.h"
+
+namespace RR::raft {
+static auto Logger = GetLoggerInstance();
+
+HeartbeatCoalescer::HeartbeatCoalescer(int64_t id) : m_id(id) {}
+
+HeartbeatCoalescer::~HeartbeatCoalescer() {
+    stop();
+}
+
+void HeartbeatCoalescer::addGroup(RaftNode* node) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    m_groups[node->getGroup()] = node;
+}
+
+void HeartbeatCoalescer::removeGroup(int64_t group) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    auto iter = m_groups.find(group);
+    if (iter == m_groups.end()) {
+        return;
+    }
+    RaftNode* node = iter->second;
+    m_groups.erase(iter);
+    // 心跳周期和回复协程在锁外调用组，等它们结束之后组才可以析构
+    while (m_users.count(node)) {
+        m_usersCond.wait(lock);
+    }
+}
+
+void HeartbeatCoalescer::addNode(int64_t id, RaftPeer::ptr peer) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    m_nodes[id] = std::move(peer);
+}
+
+void HeartbeatCoalescer::start() {
+    m_timer.stop();
+    m_timer = TimerWheel::GetInstance().addTimer(RaftNode::GetStableHeartbeatTimeout(), [weak = weak_from_this()] {
+        if (auto self = weak.lock()) {
+            self->tick();
+        }
+    });
+}
+
+void HeartbeatCoalescer::stop() {
+    m_timer.stop();
+}
+
+void HeartbeatCoalescer::tick() {
+    std::vector<RaftNode*> groups;
+    {
+        std::unique_lock<MutexType> lock(m_mutex);
+        groups.reserve(m_groups.size());
+        for (auto& group : m_groups) {
+            ++m_users[group.second];
+            groups.push_back(group.second);
+        }
+    }
+
+    // key 为目标节点 id
+    std::map<int64_t, std::vector<HeartbeatArgs>> batches;
+    for (RaftNode* node : groups) {
+        node->tickHeartbeat(batches);
+        release(node);
+    }
+    // 以发送时间作为确认时间，和 AppendEntries 的租约计算一致
+    const uint64_t sendTime = GetCuurentTimeMs();
+
+    std::unique_lock<MutexType> lock(m_mutex);
+    for (auto& batch : batches) {
+        auto iter = m_nodes.find(batch.first);
+        if (iter == m_nodes.end()) {
+            SPDLOG_LOGGER_WARN(Logger, "Node[{}] has no connection to Node[{}], drop {} heartbeats", m_id, batch.first, batch.second.size());
+            continue;
+        }
+        HeartbeatsArgs request{.from = m_id, .heartbeats = std::move(batch.second)};
+        // 回复到达时合并器可能已经析构，协程持有它的引用
+        go [peerId = batch.first, peer = iter->second, request = std::move(request), sendTime, self = shared_from_this(), this] {
+            auto reply = peer->heartbeats(request);
+            if (!reply) {
+                return;
+            }
+            if (reply->replies.size() != request.heartbeats.size()) {
+                SPDLOG_LOGGER_WARN(Logger, "Node[{}] receives {} heartbeat replies from Node[{}] for {} heartbeats", m_id, reply->replies.size(), peerId, request.heartbeats.size());
+                return;
+            }
+            for (size_t i = 0; i < request.heartbeats.size(); ++i) {
+                RaftNode* node = acquire(request.heartbeats[i].group);
+                if (node) {
+                    node->handleHeartbeatReply(peerId, request.heartbeats[i], reply->replies[i], sendTime);
+                    release(node);
+                }
+            }
+        };
+    }
+}
+
+HeartbeatsReply HeartbeatCoalescer::handleHeartbeats(HeartbeatsArgs request) {
+    HeartbeatsReply reply;
+    reply.replies.reserve(request.heartbeats.size());
+    for (auto& heartbeat : request.heartbeats) {
+        RaftNode* node = acquire(heartbeat.group);
+        if (node) {
+            reply.replies.push_back(node->handleHeartbeat(heartbeat));
+            release(node);
+        } else {
+            // 组还没有创建或者已经停止，不承认领导地位
+            reply.replies.push_back(HeartbeatReply{.group = heartbeat.group});
+        }
+    }
+    SPDLOG_LOGGER_TRACE(Logger, "Node[{}] handles heartbeats {} from Node[{}]", m_id, request.toString(), request.from);
+    return reply;
+}
+
+RaftNode* HeartbeatCoalescer::acquire(int64_t group) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    auto iter = m_groups.find(group);
+    if (iter == m_groups.end()) {
+        return nullptr;
+    }
+    ++m_users[iter->second];
+    return iter->second;
+}
+
+void HeartbeatCoalescer::release(RaftNode* node) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    auto iter = m_users.find(node);
+    if (--iter->second == 0) {
+        m_users.erase(iter);
+        m_usersCond.notify_all();
+    }
+}
+
+} // namespace RR::raft
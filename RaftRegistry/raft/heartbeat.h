@@ -0,0 +1,100 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_RAFT_HEARTBEAT_H
+#define RR_RAFT_HEARTBEAT_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+#include <libgo/libgo.h>
+#include "RaftRegistry/common/timer_wheel.h"
+#include "raft_peer.h"
+
+namespace RR::raft {
+
+class RaftNode;
+
+/**
+ * @brief 心跳合并器，一个进程一个，所有 raft 组共享
+ *
+ * @details 每个心跳周期依次询问所有的组，日志已经追上的节点只需要精简心跳（任期和提交索引），
+ *          发往同一个节点的所有组的心跳合并成一条 HEARTBEATS 消息，回复再分发给各个组；
+ *          日志没有追上的节点仍然由组自己发送完整的 AppendEntries。
+ *          空闲时每个周期每个目标节点只有一个请求，和组的数量无关。
+ */
+class HeartbeatCoalescer : public std::enable_shared_from_this<HeartbeatCoalescer> {
+public:
+    using ptr = std::shared_ptr<HeartbeatCoalescer>;
+    using MutexType = co::co_mutex;
+
+    /**
+     * @param id 当前节点的 id
+     */
+    explicit HeartbeatCoalescer(int64_t id);
+
+    ~HeartbeatCoalescer();
+
+    /**
+     * @brief 加入一个 raft 组，组号相同时替换
+     */
+    void addGroup(RaftNode* node);
+
+    /**
+     * @brief 移除一个 raft 组，组停止时调用
+     * @details 等到合并器对该组正在进行的调用全部结束才返回，之后不会再访问该组；调用时不能持有该组的锁
+     */
+    void removeGroup(int64_t group);
+
+    /**
+     * @brief 增加一个目标节点，合并的心跳通过 peer 的连接发送
+     */
+    void addNode(int64_t id, RaftPeer::ptr peer);
+
+    /**
+     * @brief 启动心跳定时器，周期为 raft.timer.heartbeat
+     */
+    void start();
+
+    void stop();
+
+    /**
+     * @brief 处理其他节点发来的合并的心跳，依次交给对应的组处理
+     */
+    HeartbeatsReply handleHeartbeats(HeartbeatsArgs request);
+
+private:
+    /**
+     * @brief 一个心跳周期，收集所有组的心跳并按目标节点合并发送
+     */
+    void tick();
+
+    /**
+     * @brief 取出一个组并增加它的引用计数，组不存在时返回 nullptr，用完之后调用 release
+     */
+    RaftNode* acquire(int64_t group);
+
+    /**
+     * @brief 减少组的引用计数，减到 0 时唤醒等待的 removeGroup
+     */
+    void release(RaftNode* node);
+
+private:
+    int64_t m_id;
+    // 所有的 raft 组，key 为组号
+    std::map<int64_t, RaftNode*> m_groups;
+    // 合并器正在使用的组和正在进行的调用数，没有调用时不在表中
+    std::map<RaftNode*, int64_t> m_users;
+    // 有组的调用全部结束
+    co::co_condition_variable m_usersCond;
+    // 所有的目标节点，key 为节点 id
+    std::map<int64_t, RaftPeer::ptr> m_nodes;
+    WheelTimer m_timer;
+    MutexType m_mutex;
+};
+
+} // namespace RR::raft
+
+#endif // RR_RAFT_HEARTBEAT_H
@@ -0,0 +1,103 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include "multi_raft.h"
+#include <spdlog/spdlog.h>
+#include "RaftRegistry/common/config.h"
+
+namespace RR::raft {
+static auto Logger = GetLoggerInstance();
+
+// 检查各个组的 leader 是否在首选节点上的间隔，0 表示不均衡
+static ConfigVar<uint64_t>::ptr g_balance_interval = Config::LookUp<uint64_t>("raft.multi.balance_interval", 10000, "interval(ms) to move group leaders to their preferred nodes, 0 disables");
+
+MultiRaft::MultiRaft(std::map<int64_t, std::string>& servers, int64_t id) : m_id(id) {
+    rpc::RpcServer::setName("Multi-Raft[" + std::to_string(id) + "]");
+    m_coalescer = std::make_shared<HeartbeatCoalescer>(id);
+    registerMethod(HEARTBEATS, [this](HeartbeatsArgs args) {
+        return m_coalescer->handleHeartbeats(std::move(args));
+    });
+    for (auto& server : servers) {
+        m_nodes.push_back(server.first);
+        if (server.first == id) {
+            continue;
+        }
+        Address::ptr address = Address::LookUpAny(server.second);
+        m_addresses[server.first] = address;
+        m_clients[server.first] = RaftPeer::NewClient();
+        // 合并的心跳是节点级别的消息，和组无关
+        m_coalescer->addNode(server.first, std::make_shared<RaftPeer>(server.first, address, 0, m_clients[server.first]));
+    }
+}
+
+MultiRaft::~MultiRaft() {
+    stop();
+}
+
+RaftNode::ptr MultiRaft::createGroup(int64_t group, Persister::ptr persister, co::co_chan<ApplyMsg> applyChan) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    if (m_groups.count(group)) {
+        SPDLOG_LOGGER_ERROR(Logger, "raft group {} already exists on node {}", group, m_id);
+        return nullptr;
+    }
+    std::map<int64_t, RaftPeer::ptr> peers;
+    for (auto& address : m_addresses) {
+        peers[address.first] = std::make_shared<RaftPeer>(address.first, address.second, group, m_clients[address.first]);
+    }
+    auto node = std::make_shared<RaftNode>(this, group, peers, m_id, persister, applyChan, m_coalescer);
+    m_groups[group] = node;
+    SPDLOG_LOGGER_INFO(Logger, "node {} creates raft group {}", m_id, group);
+    return node;
+}
+
+RaftNode::ptr MultiRaft::getGroup(int64_t group) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    auto iter = m_groups.find(group);
+    return iter == m_groups.end() ? nullptr : iter->second;
+}
+
+void MultiRaft::start() {
+    m_coalescer->start();
+    uint64_t interval = g_balance_interval->getValue();
+    if (interval && m_nodes.size() > 1) {
+        // 定时器的回调在新的协程中执行，可能在 stop 之后才运行，不能直接持有 this
+        m_balanceTimer = TimerWheel::GetInstance().addTimer(interval, [weak = weak_from_this()] {
+            if (auto self = weak.lock()) {
+                self->balance();
+            }
+        });
+    }
+    rpc::RpcServer::start();
+}
+
+void MultiRaft::stop() {
+    m_balanceTimer.stop();
+    m_coalescer->stop();
+    rpc::RpcServer::stop();
+}
+
+void MultiRaft::balance() {
+    std::unique_lock<MutexType> lock(m_mutex);
+    if (m_transferring != -1) {
+        return;
+    }
+    for (auto& group : m_groups) {
+        int64_t preferred = m_nodes[static_cast<size_t>(group.first) % m_nodes.size()];
+        if (preferred == m_id || !group.second->isLeader() || group.second->isLearner(preferred)) {
+            continue;
+        }
+        // 转移会阻塞到目标节点追上日志，放到协程里执行
+        m_transferring = group.first;
+        // 转移可能持续到 stop 之后，协程持有自己，结束之前不会析构
+        go [node = group.second, preferred, self = shared_from_this(), this] {
+            bool ok = node->transferLeadership(preferred);
+            SPDLOG_LOGGER_INFO(Logger, "node {} transfers leadership of raft group {} to preferred node {}, success: {}", m_id, node->getGroup(), preferred, ok);
+            std::unique_lock<MutexType> lock(m_mutex);
+            m_transferring = -1;
+        };
+        return;
+    }
+}
+
+} // namespace RR::raft
@@ -0,0 +1,91 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_RAFT_MULTI_RAFT_H
+#define RR_RAFT_MULTI_RAFT_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <libgo/libgo.h>
+#include "RaftRegistry/rpc/rpc_server.h"
+#include "raft_node.h"
+#include "heartbeat.h"
+
+namespace RR::raft {
+
+/**
+ * @brief 在一个进程里运行多个独立的 raft 组（multi-raft）
+ *
+ * @details 所有组共享一个 rpc 服务器，每个组的方法以 GroupMethod(name, group) 注册在上面；
+ *          到同一个远端节点的 rpc 连接也被所有组共享。每个组有自己的日志和状态机，不同组的写入互不阻塞；
+ *          调用者可以让所有组的 Persister 共享一个 SharedWAL，所有组的写入合并成一次 fdatasync。
+ *          空闲的组的心跳由 HeartbeatCoalescer 合并，每个心跳周期每个远端节点只有一条消息。
+ *          选举定时器仍然是每个组一个，各组独立选举，定时器都在进程共享的时间轮上，不额外占用线程。
+ *          为了让写入压力分散到所有节点，组 g 的首选 leader 为按 id 排序后的第 g % 节点数 个节点，
+ *          每隔 raft.multi.balance_interval 毫秒，当前 leader 把领导权转移给首选的节点。
+ * @note 均衡定时器只持有弱引用，转移领导权的协程持有强引用，需要通过 std::make_shared 创建
+ */
+class MultiRaft : public rpc::RpcServer, public std::enable_shared_from_this<MultiRaft> {
+public:
+    using ptr = std::shared_ptr<MultiRaft>;
+    using MutexType = co::co_mutex;
+
+    /**
+     * @param servers 所有节点的地址，key 为节点 id，每个节点运行相同的一组 raft 组
+     * @param id 当前节点的 id
+     */
+    MultiRaft(std::map<int64_t, std::string>& servers, int64_t id);
+
+    ~MultiRaft();
+
+    /**
+     * @brief 创建一个 raft 组，方法注册在当前服务器上，组由调用者启动
+     * @return 组号已经存在时返回 nullptr
+     */
+    RaftNode::ptr createGroup(int64_t group, Persister::ptr persister, co::co_chan<ApplyMsg> applyChan);
+
+    /**
+     * @brief 获取一个 raft 组，不存在时返回 nullptr
+     */
+    RaftNode::ptr getGroup(int64_t group);
+
+    /**
+     * @brief 启动心跳合并器、leader 均衡定时器和 rpc 服务器，各个组需要在这之前由调用者启动
+     */
+    void start() override;
+
+    void stop() override;
+
+    int64_t getId() const { return m_id; }
+
+private:
+    /**
+     * @brief 把自己领导的一个不是首选 leader 的组转移给首选节点，每次最多转移一个，避免同时发生大量选举
+     */
+    void balance();
+
+private:
+    int64_t m_id;
+    // 按 id 排序的所有节点，用来计算每个组的首选 leader
+    std::vector<int64_t> m_nodes;
+    // 远端节点的地址
+    std::map<int64_t, Address::ptr> m_addresses;
+    // 到每个远端节点的 rpc 客户端，所有组共享
+    std::map<int64_t, rpc::RpcClient::ptr> m_clients;
+    // 所有组共享的心跳合并器
+    HeartbeatCoalescer::ptr m_coalescer;
+    // 所有的 raft 组，key 为组号
+    std::map<int64_t, RaftNode::ptr> m_groups;
+    // 正在转移领导权的组，-1 表示没有
+    int64_t m_transferring = -1;
+    WheelTimer m_balanceTimer;
+    MutexType m_mutex;
+};
+
+} // namespace RR::raft
+
+#endif // RR_RAFT_MULTI_RAFT_H
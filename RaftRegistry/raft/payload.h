@@ -0,0 +1,87 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_RAFT_PAYLOAD_H
+#define RR_RAFT_PAYLOAD_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include "RaftRegistry/rpc/serializer.h"
+
+namespace RR::raft {
+
+/**
+ * @brief 日志条目携带的数据，引用计数的不可变缓冲区
+ *
+ * @details 同一份数据被内存中的日志、AppendEntries 请求、ApplyMsg 共享，复制 Entry 只增加引用计数，
+ *          不再复制数据本身。数据一旦构造就不会被修改，所以可以在多个协程间安全地共享。
+ *          序列化格式和 std::string 相同，不影响 WAL 和网络协议。
+ */
+class Payload {
+public:
+    Payload() = default;
+
+    // 接管字符串，之后只能通过共享的方式读取
+    Payload(std::string data) {
+        if (!data.empty()) {
+            m_data = std::make_shared<std::string>(std::move(data));
+        }
+    }
+
+    Payload(const char* data) : Payload(std::string(data)) {}
+
+    size_t size() const { return m_data ? m_data->size() : 0; }
+
+    bool empty() const { return size() == 0; }
+
+    const char* data() const { return m_data ? m_data->data() : ""; }
+
+    std::string_view view() const { return {data(), size()}; }
+
+    const std::string& str() const {
+        static const std::string empty;
+        return m_data ? *m_data : empty;
+    }
+
+    /**
+     * @brief 取出数据，没有其他引用时直接移走，否则复制一份
+     */
+    std::string release() {
+        std::string result;
+        if (m_data && m_data.use_count() == 1) {
+            result = std::move(*m_data);
+        } else if (m_data) {
+            result = *m_data;
+        }
+        m_data.reset();
+        return result;
+    }
+
+    // 释放对缓冲区的引用，最后一个引用释放时才真正回收内存
+    void clear() { m_data.reset(); }
+
+    bool operator==(const Payload& other) const { return view() == other.view(); }
+
+    // 直接从共享的缓冲区写入序列化器，和 std::string 的格式一致
+    friend rpc::Serializer& operator << (rpc::Serializer& s, const Payload& p) {
+        s.getByteArray()->writeStringVint(p.str());
+        return s;
+    }
+
+    friend rpc::Serializer& operator >> (rpc::Serializer& s, Payload& p) {
+        std::string data;
+        s >> data;
+        p = Payload(std::move(data));
+        return s;
+    }
+
+private:
+    // 只有 release 在没有其他引用时会修改，其他时候都是只读的
+    std::shared_ptr<std::string> m_data;
+};
+
+} // namespace RR::raft
+
+#endif // RR_RAFT_PAYLOAD_H
@@ -3,12 +3,109 @@
 // Author: Zizhou
 
 #include "persister.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <spdlog/spdlog.h>
+#include "RaftRegistry/common/config.h"
+#include "RaftRegistry/common/util.h"
 
 namespace RR::raft {
 static auto Logger = GetLoggerInstance();
 
-Persister::Persister(const std::filesystem::path& persist_path = ".") : m_path(persist_path), m_snapshotter(persist_path / "snapshot") {
+namespace {
+// 最初的单文件格式中的日志，没有压缩编码
+struct LegacyEntry {
+    int64_t index = 0;
+    int64_t term = 0;
+    std::string data;
+
+    friend rpc::Serializer& operator >> (rpc::Serializer& s, LegacyEntry& e) {
+        s >> e.index >> e.term >> e.data;
+        return s;
+    }
+};
+
+/**
+ * @brief 先写临时文件并 fdatasync，再 rename 覆盖 path，最后对目录刷盘，崩溃时文件要么是旧的要么是新的
+ */
+bool ReplaceFile(const std::filesystem::path& path, const std::string& data) {
+    std::filesystem::path tmp = path;
+    tmp += ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "open {} failed: {}", tmp.string(), strerror(errno));
+        return false;
+    }
+    if (write(fd, data.c_str(), data.size()) != static_cast<ssize_t>(data.size())) {
+        SPDLOG_LOGGER_ERROR(Logger, "write {} failed: {}", tmp.string(), strerror(errno));
+        close(fd);
+        return false;
+    }
+    if (fdatasync(fd) < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "fdatasync {} failed: {}", tmp.string(), strerror(errno));
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    if (rename(tmp.c_str(), path.c_str()) < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "rename {} failed: {}", tmp.string(), strerror(errno));
+        return false;
+    }
+    // 对目录刷盘，保证 rename 持久化
+    return SyncDir(path.parent_path());
+}
+
+/**
+ * @brief 读取旧格式目录中最新的一个能解析的快照，旧格式的快照文件为 meta + data，没有压缩编码
+ */
+std::optional<Snapshot> LoadLegacySnapshot(const std::filesystem::path& dir) {
+    if (!std::filesystem::is_directory(dir)) {
+        return std::nullopt;
+    }
+    std::vector<std::filesystem::path> paths;
+    for (auto& iter : std::filesystem::directory_iterator(dir)) {
+        if (iter.status().type() == std::filesystem::file_type::regular && iter.path().extension() == ".snap") {
+            paths.push_back(iter.path());
+        }
+    }
+    // 文件名为 任期-索引，降序排列后最新的快照在前面
+    std::sort(paths.begin(), paths.end(), std::greater<>());
+    for (auto& path : paths) {
+        std::ifstream in(path, std::ios::binary);
+        std::string str(std::istreambuf_iterator<char>(in), {});
+        if (str.empty()) {
+            continue;
+        }
+        rpc::Serializer s(str);
+        Snapshot snapshot;
+        try {
+            s >> snapshot.metadata >> snapshot.data;
+        } catch (...) {
+            SPDLOG_LOGGER_WARN(Logger, "skip broken legacy snapshot {}", path.string());
+            continue;
+        }
+        snapshot.codec = Codec::None;
+        return snapshot;
+    }
+    return std::nullopt;
+}
+
+bool NonEmptyDir(const std::filesystem::path& dir) {
+    std::error_code ec;
+    return std::filesystem::is_directory(dir, ec) && !std::filesystem::is_empty(dir, ec);
+}
+}
+
+Persister::Persister(const std::filesystem::path& persist_path) : Persister(persist_path, std::make_shared<SharedWAL>(persist_path / "wal"), 0, true) {}
+
+Persister::Persister(const std::filesystem::path& persist_path, SharedWAL::ptr wal, int64_t group) : Persister(persist_path, std::move(wal), group, false) {}
+
+Persister::Persister(const std::filesystem::path& persist_path, SharedWAL::ptr wal, int64_t group, bool ownWAL)
+    : m_path(persist_path), m_snapshotter(persist_path / "snapshot"), m_wal(std::move(wal)), m_group(group), m_ownWAL(ownWAL) {
     // 检查持久化路径的有效性，如果无效则记录警告日志
     if (m_path.empty()) {
         SPDLOG_LOGGER_WARN(Logger, "persist path is empty");
@@ -20,9 +117,23 @@ Persister::Persister(const std::filesystem::path& persist_path = ".") : m_path(p
     } else {
         SPDLOG_LOGGER_INFO(Logger, "persist path: {}", getFullPathName());
     }
+    checkFormat();
+}
+
+Persister::~Persister() {
+    m_wal->setCompactor(m_group, nullptr);
+    // 落盘回调持有 this，等自己提交的请求全部处理完；共享的 WAL 由最后一个持有者析构
+    int64_t submitted = m_submitted.load(std::memory_order_acquire);
+    if (submitted) {
+        m_wal->wait(submitted);
+    }
 }
 
 std::optional<HardState> Persister::loadHardState() {
+    std::unique_lock<MutexType> lock(m_mutex);
+    if (m_hardState) {
+        return m_hardState;
+    }
     std::ifstream in(m_path / m_name, std::ios_base::in); // 以只读方式打开文件
     if (!in.is_open()) {
         return std::nullopt;
@@ -38,77 +149,241 @@ std::optional<HardState> Persister::loadHardState() {
         return std::nullopt;
     }
 
+    m_hardState = hs;
     return hs;
 }
 
 std::optional<std::vector<Entry>> Persister::loadEntries() {
     std::unique_lock<MutexType> lock(m_mutex);
-    std::ifstream in(m_path / m_name, std::ios_base::in);
-    if (!in.is_open()) {
-        return std::nullopt; // 文件打开失败，返回空值
+    // 快照之前的日志已经被压缩，从快照之后开始回放
+    Snapshot::ptr snapshot = m_snapshotter.loadSnap();
+    lock.unlock();
+    auto entries = snapshot ? m_wal->readAll(m_group, snapshot->metadata.index, snapshot->metadata.term) : m_wal->readAll(m_group, 0, 0);
+    // 启动时从 WAL 读回来的日志都已经落盘
+    if (entries && !entries->empty()) {
+        m_durableIndex.store(entries->back().index, std::memory_order_release);
     }
+    return entries;
+}
 
-    std::string str(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
-    rpc::Serializer s(str);
-    std::vector<Entry> entries;
-    try {
-        HardState hs{};
-        s >> hs >> entries; // 反序列化硬状态和日志条目
-    } catch (...) {
-        return std::nullopt;
+std::vector<Entry> Persister::loadEntries(int64_t low, int64_t high, int64_t maxBytes) {
+    return m_wal->read(m_group, low, high, maxBytes);
+}
+
+Snapshot::ptr Persister::loadSnapshot() {
+    std::unique_lock<MutexType> lock(m_mutex);
+    Snapshot::ptr snapshot = m_snapshotter.loadSnap();
+    lock.unlock();
+    // 加载快照是为了交给状态机，在这里解压，不持锁
+    if (snapshot && !snapshot->decompress()) {
+        SPDLOG_LOGGER_ERROR(Logger, "decompress snapshot [index: {}, term: {}] failed", snapshot->metadata.index, snapshot->metadata.term);
+        return nullptr;
     }
+    return snapshot;
+}
 
-    retur n entries;
+std::optional<SnapshotMeta> Persister::latestSnapshot() {
+    std::unique_lock<MutexType> lock(m_mutex);
+    return m_snapshotter.latest();
 }
 
-Snapshot::ptr Persister::loadSnapshot() {
+int64_t Persister::snapshotSize(const SnapshotMeta& meta) {
     std::unique_lock<MutexType> lock(m_mutex);
-    return m_snapshotter.loadSnap();
+    return m_snapshotter.size(meta);
 }
 
-int64_t Persister::getRaftStateSize() {
+std::optional<std::string> Persister::readSnapshotChunk(const SnapshotMeta& meta, int64_t offset, int64_t size) {
     std::unique_lock<MutexType> lock(m_mutex);
-    std::ifstream in(m_path / m_name, std::ios_base::in);
+    return m_snapshotter.readChunk(meta, offset, size);
+}
 
-    if (!in.is_open()) {
-        return -1; // 文件打开失败，返回错误码
+int64_t Persister::receiveSnapshotChunk(const SnapshotMeta& meta, int64_t offset, const std::string& data) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    return m_snapshotter.receive(meta, offset, data);
+}
+
+bool Persister::installSnapshot(const SnapshotMeta& meta) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    if (!m_snapshotter.install(meta)) {
+        return false;
+    }
+    lock.unlock();
+    // 快照已经落盘，快照之前的日志段可以删除了
+    m_wal->release(m_group, meta.index);
+    return true;
+}
+
+int64_t Persister::getRaftStateSize() {
+    return m_wal->pendingSize(m_group);
+}
+
+bool Persister::pinsWAL() {
+    return m_wal->pinned(m_group);
+}
+
+void Persister::setCompactor(SharedWAL::Compactor compactor) {
+    m_wal->setCompactor(m_group, std::move(compactor));
+}
+
+int64_t Persister::submit(const HardState& hs, std::vector<Entry> entries, Snapshot::ptr snapshot) {
+    const int64_t last = entries.empty() ? 0 : entries.back().index;
+    int64_t seq = m_wal->submit(m_group, std::move(entries), [this, hs, snapshot = std::move(snapshot), last](bool latest) {
+        return onDurable(hs, snapshot, last, latest);
+    });
+    // 可能有多个协程同时提交，只让序号前进
+    int64_t submitted = m_submitted.load(std::memory_order_acquire);
+    while (submitted < seq && !m_submitted.compare_exchange_weak(submitted, seq, std::memory_order_acq_rel)) {
     }
+    return seq;
+}
 
-    in.seekg(0, in.end);
-    auto length = in.tellg();
-    return length;
+bool Persister::wait(int64_t seq) {
+    return m_wal->wait(seq);
 }
 
-bool Persister::persist(const HardState& hs, const std::vector<Entry>& entries, const Snapshot::ptr snapshot) {
+bool Persister::onDurable(const HardState& hs, const Snapshot::ptr& snapshot, int64_t last, bool latest) {
     std::unique_lock<MutexType> lock(m_mutex);
+    if (last) {
+        m_durableIndex.store(last, std::memory_order_release);
+    }
 
-    // 打开文件，如果有此文件则打开后清空内容，如果没有则创建
-    int fd = open((m_path / m_name).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
-    if (fd < 0) {
+    // 硬状态只需要保存这一批中最新的；只有任期和投票变化时才写文件，平时一批请求只有 WAL 的一次 fdatasync
+    if (latest && !saveHardState(hs)) {
         return false;
     }
 
-    // 将硬状态和日志条目序列化
+    if (!snapshot) {
+        return true;
+    }
+    if (!m_snapshotter.saveSnap(snapshot)) {
+        return false;
+    }
+    lock.unlock();
+    // 快照已经落盘，快照之前的日志段可以删除了
+    m_wal->release(m_group, snapshot->metadata.index);
+    return true;
+}
+
+bool Persister::saveHardState(const HardState& hs) {
+    // commit 不需要立即持久化，重启后可以从 leader 重新得知；保存的 commit 只会比实际的小，不影响正确性
+    if (m_hardState && m_hardState->term == hs.term && m_hardState->vote == hs.vote) {
+        return true;
+    }
+
+    // 将硬状态序列化
     rpc::Serializer s;
-    s << hs << entries;
+    s << hs;
     s.reset();
+    if (!ReplaceFile(m_path / m_name, s.toString())) {
+        return false;
+    }
+
+    m_hardState = hs;
+    return true;
+}
+
+void Persister::checkFormat() {
+    const std::filesystem::path versionPath = m_path / m_versionName;
+    std::error_code ec;
+    // 共享 WAL 时自己目录里的 WAL 不会被读取，里面的日志会被悄悄丢掉
+    if (!m_ownWAL && NonEmptyDir(m_path / "wal")) {
+        SPDLOG_LOGGER_CRITICAL(Logger, "persist path {} of group {} has its own wal, but the group uses a shared wal, refuse to start", m_path.string(), m_group);
+        exit(EXIT_FAILURE);
+    }
+    if (std::filesystem::exists(versionPath)) {
+        std::ifstream in(versionPath);
+        uint32_t version = 0;
+        if (!(in >> version) || version != FORMAT_VERSION) {
+            SPDLOG_LOGGER_CRITICAL(Logger, "persist path {} has format version {}, but only version {} is supported", m_path.string(), version, FORMAT_VERSION);
+            exit(EXIT_FAILURE);
+        }
+        // 迁移已经完成，清理删除之前崩溃时留下的旧格式文件
+        std::filesystem::remove(m_path / m_legacyName, ec);
+        std::filesystem::remove_all(m_path / m_legacySnapDir, ec);
+        return;
+    }
+
+    if (std::filesystem::exists(m_path / m_legacyName)) {
+        if (!migrateLegacy()) {
+            SPDLOG_LOGGER_CRITICAL(Logger, "migrate legacy raft state in {} failed", m_path.string());
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    // 没有版本文件的 WAL、硬状态或者快照无法确定格式，按当前格式解析可能读出错误的数据，拒绝启动
+    if (std::filesystem::exists(m_path / m_name) || NonEmptyDir(m_path / "wal") || NonEmptyDir(m_path / "snapshot")) {
+        SPDLOG_LOGGER_CRITICAL(Logger, "persist path {} has raft state without a format version, refuse to start", m_path.string());
+        exit(EXIT_FAILURE);
+    }
+    if (!saveVersion()) {
+        SPDLOG_LOGGER_CRITICAL(Logger, "save format version in {} failed", m_path.string());
+        exit(EXIT_FAILURE);
+    }
+}
 
-    // 将序列化数据写入文件
-    std::string data = s.toString();
-    if (write(fd, data.c_str(), data.size()) < 0) {
+bool Persister::migrateLegacy() {
+    SPDLOG_LOGGER_WARN(Logger, "migrate legacy raft state in {} to format version {}", m_path.string(), FORMAT_VERSION);
+    const std::filesystem::path snapDir = m_path / "snapshot";
+    const std::filesystem::path legacySnapDir = m_path / m_legacySnapDir;
+    std::error_code ec;
+    // 旧的快照目录先整体改名，迁移中途崩溃时旧格式的文件都还在，下次从头重新迁移
+    if (!std::filesystem::exists(legacySnapDir) && std::filesystem::exists(snapDir)) {
+        std::filesystem::rename(snapDir, legacySnapDir, ec);
+        if (ec || !SyncDir(m_path)) {
+            SPDLOG_LOGGER_ERROR(Logger, "rename {} failed: {}", snapDir.string(), ec.message());
+            return false;
+        }
+    }
+    // 删除上一次迁移写了一半的快照和硬状态；WAL 可能和其他组共享，不删除，重新写入的日志会覆盖上一次写入的日志
+    std::filesystem::remove_all(snapDir, ec);
+    std::filesystem::remove(m_path / m_name, ec);
+
+    // 旧格式：硬状态和全部日志序列化在同一个文件里，第一条日志是快照最后一条日志的占位
+    std::ifstream in(m_path / m_legacyName, std::ios::binary);
+    std::string str(std::istreambuf_iterator<char>(in), {});
+    rpc::Serializer s(str);
+    HardState hs{};
+    std::vector<LegacyEntry> legacy;
+    try {
+        s >> hs >> legacy;
+    } catch (...) {
+        SPDLOG_LOGGER_ERROR(Logger, "parse legacy raft state {} failed", (m_path / m_legacyName).string());
         return false;
     }
 
-    // 持久化：将数据写入磁盘
-    fsync(fd);
-    close(fd);
-    
-    if (snapshot) {
-        return m_snapshotter.saveSnap(snapshot);
+    std::optional<Snapshot> snapshot = LoadLegacySnapshot(legacySnapDir);
+    const int64_t lastSnapshotIndex = snapshot ? snapshot->metadata.index : 0;
+    std::vector<Entry> entries;
+    entries.reserve(legacy.size());
+    for (LegacyEntry& e : legacy) {
+        // WAL 中只保存快照之后的日志
+        if (e.index <= lastSnapshotIndex) {
+            continue;
+        }
+        entries.push_back(Entry{.index = e.index, .term = e.term, .data = Payload(std::move(e.data)), .codec = Codec::None});
+    }
+
+    if (snapshot && !m_snapshotter.saveSnap(*snapshot)) {
+        return false;
     }
+    if (!m_wal->save(m_group, entries) || !saveHardState(hs)) {
+        return false;
+    }
+    // 版本文件写入之后迁移才算完成，之后再删除旧格式的文件
+    if (!saveVersion()) {
+        return false;
+    }
+    std::filesystem::remove(m_path / m_legacyName, ec);
+    std::filesystem::remove_all(legacySnapDir, ec);
+    SPDLOG_LOGGER_INFO(Logger, "migrated {} entries and {} from legacy raft state in {}", entries.size(),
+                       snapshot ? fmt::format("snapshot [index: {}, term: {}]", snapshot->metadata.index, snapshot->metadata.term) : "no snapshot",
+                       m_path.string());
     return true;
 }
 
-
+bool Persister::saveVersion() {
+    return ReplaceFile(m_path / m_versionName, std::to_string(FORMAT_VERSION));
+}
 
 } // namespace RR::raft
\ No newline at end of file
@@ -5,6 +5,7 @@
 #ifndef RR_RAFT_PERSISTER_H
 #define RR_RAFT_PERSISTER_H
 
+#include <atomic>
 #include <cstdint>
 #include <optional>
 #include <memory>
@@ -14,6 +15,7 @@
 #include "RaftRegistry/raft/snapshot.h"
 #include "RaftRegistry/rpc/serializer.h"
 #include "RaftRegistry/raft/entry.h"
+#include "RaftRegistry/raft/shared_wal.h"
 
 namespace RR::raft {
 // raft节点状态的持久化数据
@@ -34,50 +36,141 @@ struct HardState {
         serializer << state.term << state.vote << state.commit;
         return serializer;
     }
+
+    bool operator==(const HardState& other) const = default;
 };
 
 /**
  * @brief 持久化存储
+ *
+ * @details 持久化目录中的 version 文件记录磁盘格式的版本，WAL 记录、Entry 和 Snapshot 的序列化格式（包括压缩编码）
+ *          以及硬状态文件的格式变化时都要增加 FORMAT_VERSION。启动时：
+ *          - 版本和 FORMAT_VERSION 相同时直接使用；版本不同时拒绝启动
+ *          - 没有版本文件但有最初的单文件格式（raft_state）时，迁移到当前格式后写入版本文件
+ *          - 没有版本文件但有其他持久化文件时无法确定格式，拒绝启动
+ *          - 和其他组共享 WAL 时，自己的目录里还有 WAL 说明是按独占 WAL 写入的，拒绝启动
  */
 class Persister {
 public:
     using ptr = std::shared_ptr<Persister>;
     using MutexType = co::co_mutex;
 
+    // 当前的磁盘格式版本
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    /**
+     * @brief 只有一个组时使用，WAL 放在 persist_path/wal，由这个 Persister 独占
+     */
     explicit Persister(const std::filesystem::path& persist_path = ".");
-    
-    ~Persister() = default;
 
     /**
-     * @brief 获取持久化的 raft 状态
+     * @brief 多个组共享一个 WAL 时使用，persist_path 只保存该组的硬状态和快照
+     * @param wal 所有组共享的 WAL
+     * @param group 组号，用来区分共享 WAL 中各个组的记录
+     */
+    Persister(const std::filesystem::path& persist_path, SharedWAL::ptr wal, int64_t group);
+
+    /**
+     * @brief 等待自己提交的请求全部落盘，落盘回调持有 this
+     */
+    ~Persister();
+
+    /**
+     * @brief 获取持久化的 raft 状态，只读取硬状态文件
      */
     std::optional<HardState> loadHardState();
 
     /**
      * @brief 获取持久化的 log
+     * @details 从快照之后开始回放 WAL，返回的第一个元素为快照的最后一条日志
      */
     std::optional<std::vector<Entry>> loadEntries();
 
     /**
-     * @brief 获取快照
+     * @brief 从 WAL 中读取 [low, high) 的已持久化日志，用于读取已经从内存中淘汰的日志
+     * @param maxBytes 日志数据的总字节数上限，至少返回一条日志
+     */
+    std::vector<Entry> loadEntries(int64_t low, int64_t high, int64_t maxBytes = INT64_MAX);
+
+    /**
+     * @brief 获取快照，返回的快照数据已经解压
      */
     Snapshot::ptr loadSnapshot();
 
     /**
-     * @brief 获取 raft state 的长度
+     * @brief 获取最新快照的元数据，不读取快照内容
+     */
+    std::optional<SnapshotMeta> latestSnapshot();
+
+    /**
+     * @brief 获取快照文件的大小，文件不存在时返回 -1
+     */
+    int64_t snapshotSize(const SnapshotMeta& meta);
+
+    /**
+     * @brief 读取快照文件的一块数据，用于分块发送快照
+     */
+    std::optional<std::string> readSnapshotChunk(const SnapshotMeta& meta, int64_t offset, int64_t size);
+
+    /**
+     * @brief 把收到的一块快照数据写入临时文件
+     * @return 下一块数据期望的 offset
+     */
+    int64_t receiveSnapshotChunk(const SnapshotMeta& meta, int64_t offset, const std::string& data);
+
+    /**
+     * @brief 接收完成的快照临时文件替换为正式的快照文件，并删除快照之前的 WAL 段
+     */
+    bool installSnapshot(const SnapshotMeta& meta);
+
+    /**
+     * @brief 获取 raft state 的长度，即上一次快照之后该组写入 WAL 的字节数
      */
     int64_t getRaftStateSize();
 
     /**
-     * @brief 持久化当前raft节点的数据
+     * @brief 该组的日志是否拖住了共享 WAL 中的旧段，拖住时即使没有达到快照的阈值也应该做快照
+     */
+    bool pinsWAL();
+
+    /**
+     * @brief 设置该组拖住旧段时的回调，见 SharedWAL::setCompactor；析构时自动取消
+     */
+    void setCompactor(SharedWAL::Compactor compactor);
+
+    /**
+     * @brief 持久化当前raft节点的数据，阻塞到数据落盘
      * 
      * @param hs 节点状态
-     * @param entries 日志条目集合
-     * @param snapshot 全量序列化数据
+     * @param entries 新追加（尚未持久化）的日志条目，追加到 WAL 中；如果和已持久化的日志重叠，重叠部分被覆盖
+     * @param snapshot 全量序列化数据，保存快照后会删除快照之前的 WAL 段
      * @return true 
      * @return false 
      */
-    bool persist(const HardState& hs, const std::vector<Entry>& entries, const Snapshot::ptr snapshot = nullptr);
+    bool persist(const HardState& hs, const std::vector<Entry>& entries, const Snapshot::ptr snapshot = nullptr) {
+        return wait(submit(hs, entries, snapshot));
+    }
+
+    /**
+     * @brief 提交一个持久化请求，不等待落盘
+     * 
+     * @details 组提交：SharedWAL 的后台协程把一段时间内（或达到字节上限前）所有组提交的请求合并，
+     *          写入 WAL 后只做一次 fdatasync，然后保存硬状态和快照。请求按提交的顺序写入
+     * @return 请求的序号，用于 wait
+     */
+    int64_t submit(const HardState& hs, std::vector<Entry> entries, Snapshot::ptr snapshot = nullptr);
+
+    /**
+     * @brief 等待序号为 seq 的持久化请求落盘
+     * @return 落盘成功返回 true，持久化出错或者已经关闭返回 false
+     */
+    bool wait(int64_t seq);
+
+    /**
+     * @brief 已经写入 WAL 并且刷盘的最后一条日志的索引，不加锁
+     * @note 日志被覆盖时可能暂时大于实际落盘的位置，但被覆盖的日志一定还没有提交，调用者还要用已应用的索引限制
+     */
+    int64_t durableIndex() const { return m_durableIndex.load(std::memory_order_acquire); }
 
     /**
      * @brief 获取快照路径
@@ -87,10 +180,68 @@ public:
         return canonical(m_path);
     }
 private:
+    Persister(const std::filesystem::path& persist_path, SharedWAL::ptr wal, int64_t group, bool ownWAL);
+
+    /**
+     * @brief 请求的日志落盘之后由组提交协程调用，更新落盘的索引，保存硬状态和快照
+     * @param last 请求中最后一条日志的索引，没有日志时为 0
+     * @param latest 是否为该组在这一批里的最后一个请求，只有最后一个请求需要保存硬状态
+     */
+    bool onDurable(const HardState& hs, const Snapshot::ptr& snapshot, int64_t last, bool latest);
+
+    /**
+     * @brief 原子地更新硬状态文件
+     * 
+     * @details 先写入临时文件并 fdatasync，再 rename 覆盖硬状态文件，崩溃时文件要么是旧的要么是新的。
+     *          只有任期或者投票变化时才写文件，只有 commit 变化时直接返回，不产生任何 I/O；
+     *          保存的 commit 可能落后于实际的提交索引，重启后从 leader 重新得知
+     */
+    bool saveHardState(const HardState& hs);
+
+    /**
+     * @brief 检查持久化目录的格式版本，构造时调用；旧格式的数据迁移到当前格式，无法识别的格式直接退出
+     */
+    void checkFormat();
+
+    /**
+     * @brief 把最初的单文件格式迁移到当前格式
+     *
+     * @details 旧的快照目录先改名为 snapshot.v0，再把 raft_state 中的硬状态和日志、旧快照写成当前格式，
+     *          写入版本文件之后才删除旧文件。中途崩溃时版本文件不存在，下次启动删除写了一半的快照和硬状态重新迁移，
+     *          重新写入的日志通过截断记录覆盖上一次写入的日志
+     */
+    bool migrateLegacy();
+
+    /**
+     * @brief 原子地写入版本文件
+     */
+    bool saveVersion();
+
+private:
+    // 保护硬状态和快照
     MutexType m_mutex;
+    // 已经落盘的最后一条日志的索引
+    std::atomic<int64_t> m_durableIndex{0};
+    // 最后一个提交的请求的序号
+    std::atomic<int64_t> m_submitted{0};
     const std::filesystem::path m_path;
     Snapshotter m_snapshotter;
-    const std::string m_name = "raft_state";
+    // 日志写入的 WAL，多个组时和其他组共享
+    SharedWAL::ptr m_wal;
+    // WAL 中该组的组号
+    const int64_t m_group;
+    // WAL 是否由自己独占，独占时放在 m_path/wal
+    const bool m_ownWAL;
+    // 最近一次持久化的硬状态
+    std::optional<HardState> m_hardState;
+    // 硬状态单独保存在一个很小的文件里，和日志分开
+    const std::string m_name = "hard_state";
+    // 磁盘格式的版本文件
+    const std::string m_versionName = "version";
+    // 最初的单文件格式，硬状态和全部日志保存在一起
+    const std::string m_legacyName = "raft_state";
+    // 迁移时旧格式快照目录改名后的名字
+    const std::string m_legacySnapDir = "snapshot.v0";
 }
 }
 
@@ -0,0 +1,178 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_RAFT_PROGRESS_H
+#define RR_RAFT_PROGRESS_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fmt/format.h>
+
+namespace RR::raft {
+
+/**
+ * @brief 在途的 AppendEntries 请求的滑动窗口
+ *
+ * @details 环形缓冲区，按发送顺序保存每个在途请求的最后一条日志的索引和日志的字节数。
+ *          收到回复后释放不大于已匹配索引的请求，在途请求的数量或者字节数达到上限之后 leader 暂停向该节点发送日志。
+ */
+class Inflights {
+public:
+    /**
+     * @param size 在途请求数量的上限
+     * @param maxBytes 在途日志字节数的上限，0 表示不限制
+     */
+    explicit Inflights(size_t size = 1, int64_t maxBytes = 0) : m_buffer(size ? size : 1), m_maxBytes(maxBytes) {}
+
+    /**
+     * @brief 记录一个在途请求
+     * @param index 请求中最后一条日志的索引
+     * @param bytes 请求中日志的字节数
+     */
+    void add(int64_t index, int64_t bytes = 0) {
+        if (m_count == m_buffer.size()) {
+            return;
+        }
+        m_buffer[(m_start + m_count) % m_buffer.size()] = {index, bytes};
+        ++m_count;
+        m_bytes += bytes;
+    }
+
+    /**
+     * @brief 释放最后一条日志的索引不大于 index 的在途请求
+     */
+    void freeTo(int64_t index) {
+        while (m_count && m_buffer[m_start].first <= index) {
+            m_bytes -= m_buffer[m_start].second;
+            m_start = (m_start + 1) % m_buffer.size();
+            --m_count;
+        }
+    }
+
+    void reset() {
+        m_start = 0;
+        m_count = 0;
+        m_bytes = 0;
+    }
+
+    bool full() const { return m_count == m_buffer.size() || (m_maxBytes > 0 && m_bytes >= m_maxBytes); }
+
+    size_t count() const { return m_count; }
+
+    int64_t bytes() const { return m_bytes; }
+
+private:
+    // 在途请求的最后一条日志的索引和日志的字节数
+    std::vector<std::pair<int64_t, int64_t>> m_buffer;
+    // 第一个在途请求在缓冲区中的位置
+    size_t m_start = 0;
+    // 在途请求的数量
+    size_t m_count = 0;
+    // 在途日志的字节数
+    int64_t m_bytes = 0;
+    const int64_t m_maxBytes;
+};
+
+/**
+ * @brief leader 眼中的 follower 的复制状态
+ */
+enum class ProgressState {
+    // 不知道 follower 的日志从哪里开始匹配，同时只发送一个请求来探测
+    Probe,
+    // 日志已经匹配，乐观地推进 nextIndex，同时有多个请求在途
+    Replicate,
+    // 正在发送快照，发送完成之前不发送日志
+    Snapshot
+};
+
+inline const char* ToString(ProgressState state) {
+    switch (state) {
+        case ProgressState::Probe:
+            return "Probe";
+        case ProgressState::Replicate:
+            return "Replicate";
+        case ProgressState::Snapshot:
+            return "Snapshot";
+    }
+    return "Unknown";
+}
+
+/**
+ * @brief leader 对单个 follower 的复制进度
+ */
+struct Progress {
+    ProgressState state = ProgressState::Probe;
+    // Probe 状态下是否已经有一个在途的请求
+    bool probeSent = false;
+    // Snapshot 状态下正在发送的快照的索引
+    int64_t pendingSnapshot = 0;
+    Inflights inflights;
+
+    explicit Progress(size_t maxInflight = 1, int64_t maxInflightBytes = 0) : inflights(maxInflight, maxInflightBytes) {}
+
+    void becomeProbe() {
+        state = ProgressState::Probe;
+        probeSent = false;
+        pendingSnapshot = 0;
+        inflights.reset();
+    }
+
+    void becomeReplicate() {
+        state = ProgressState::Replicate;
+        probeSent = false;
+        pendingSnapshot = 0;
+        inflights.reset();
+    }
+
+    void becomeSnapshot(int64_t index) {
+        state = ProgressState::Snapshot;
+        probeSent = false;
+        pendingSnapshot = index;
+        inflights.reset();
+    }
+
+    /**
+     * @brief 是否暂停向 follower 发送日志
+     */
+    bool isPaused() const {
+        switch (state) {
+            case ProgressState::Probe:
+                return probeSent;
+            case ProgressState::Replicate:
+                return inflights.full();
+            case ProgressState::Snapshot:
+                return true;
+        }
+        return false;
+    }
+
+    std::string toString() const {
+        return fmt::format("{{state: {}, inflight: {}, inflightBytes: {}}}", ToString(state), inflights.count(), inflights.bytes());
+    }
+};
+
+/**
+ * @brief leader 上单个 follower 的复制状态和落后程度，用于监控
+ */
+struct ProgressStatus {
+    ProgressState state = ProgressState::Probe;
+    int64_t matchIndex = 0;
+    int64_t nextIndex = 0;
+    // leader 的最后一条日志和 matchIndex 之间相差的日志条数
+    int64_t lag = 0;
+    size_t inflight = 0;
+    int64_t inflightBytes = 0;
+    // 最近一次承认领导地位的请求的发送时间(ms)
+    uint64_t lastAck = 0;
+    std::string toString() const {
+        return fmt::format("{{state: {}, match: {}, next: {}, lag: {}, inflight: {}, inflightBytes: {}, lastAck: {}}}",
+                           ToString(state), matchIndex, nextIndex, lag, inflight, inflightBytes, lastAck);
+    }
+};
+
+} // namespace RR::raft
+
+#endif // RR_RAFT_PROGRESS_H
@@ -3,12 +3,33 @@
 // Author: Zizhou
 
 #include "raft_log.h"
+#include <algorithm>
 #include <spdlog/spdlog.h>
+#include "RaftRegistry/common/config.h"
 
 namespace RR::raft {
 static auto Logger = GetLoggerInstance();
 
-RaftLog::RaftLog(Persister::ptr persister, int64_t maxNextEntriesSize) {
+// 内存中日志数据的上限，超过后淘汰已经持久化并应用的旧日志的数据
+static ConfigVar<uint64_t>::ptr g_log_cache_bytes = Config::LookUp<uint64_t>("raft.log.cache_bytes", 256 * 1024 * 1024, "max bytes of entry data kept in memory by raft log");
+
+static uint64_t s_log_cache_bytes;
+
+namespace {
+struct RaftLogIniter {
+    RaftLogIniter() {
+        s_log_cache_bytes = g_log_cache_bytes->getValue();
+        g_log_cache_bytes->addListener([](const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft log cache bytes changed from {} to {}", old_value, new_value);
+            s_log_cache_bytes = new_value;
+        });
+    }
+};
+
+[[maybe_unused]] static RaftLogIniter s_initer;
+}
+
+RaftLog::RaftLog(Persister::ptr persister, int64_t maxNextEntriesSize) : m_persister(persister) {
     if (!persister) {
         SPDLOG_LOGGER_CRITICAL(Logger, "persister must not be nullptr");
         return;
@@ -19,8 +40,13 @@ RaftLog::RaftLog(Persister::ptr persister, int64_t maxNextEntriesSize) {
 
     // 检查是否成功加载条目
     if (opt.has_value()) {
-        m_entries = std::move(*opt);
-        m_committed = persister->loadHardState()->commit;
+        m_entries.assign(std::make_move_iterator(opt->begin()), std::make_move_iterator(opt->end()));
+        for (const Entry& entry : m_entries) {
+            m_bytes += static_cast<int64_t>(entry.data.size());
+        }
+        // 硬状态里的 commit 只在任期或投票变化时保存，可能落后，至少是快照的索引
+        auto hs = persister->loadHardState();
+        m_committed = std::max(hs ? hs->commit : 0, firstIndex() - 1);
         // 将m_applied成员变量设置为第一个索引减1
         // 表示还没有任何日志条目被应用到状态机，因为此时不是从snapshot中恢复的，而是从持久化对象中加载的
         m_applied = firstIndex() - 1;
@@ -30,6 +56,11 @@ RaftLog::RaftLog(Persister::ptr persister, int64_t maxNextEntriesSize) {
         m_committed = 0;
         m_applied = 0;
     }
+    // 加载出来的日志都已经持久化过了
+    m_unstable = lastIndex() + 1;
+    m_applying = m_applied;
+    m_evicted = firstIndex();
+    rebuildTermStarts();
 
     // 将m_maxNextEntriesSize成员变量设置为传入的最大条目大小参数
     m_maxNextEntriesSize = maxNextEntriesSize;
@@ -91,18 +122,33 @@ int64_t RaftLog::append(const std::vector<Entry>& entries) {
         m_entries.insert(m_entries.end(), entries.begin(), entries.end());
     } else if (after <=  m_entries.front().index) { // 传入的entries的第一个条目的索引小于等于当前日志的第一个条目的索引，那么直接替换整个日志
         SPDLOG_LOGGER_INFO(Logger, "replace the entries from index {}", after);
-        m_entries = entries;
+        m_entries.assign(entries.begin(), entries.end());
+        m_bytes = 0;
+        m_evicted = firstIndex();
+        m_termStarts.clear();
     } else { // 有重叠的日志，那就用最新的日志覆盖重叠的老日志
         SPDLOG_LOGGER_INFO(Logger, "truncate the entries before index {}", after);
         auto offset = after - m_entries.front().index;
-        m_entries.insert(m_entries.begin() + offset, entries.begin(), entries.end());
-        
+        for (auto iter = m_entries.begin() + offset; iter != m_entries.end(); ++iter) {
+            m_bytes -= static_cast<int64_t>(iter->data.size());
+        }
+        m_entries.erase(m_entries.begin() + offset, m_entries.end());
+        m_entries.insert(m_entries.end(), entries.begin(), entries.end());
+        truncateTermStarts(after);
+    }
+    for (const Entry& entry : entries) {
+        m_bytes += static_cast<int64_t>(entry.data.size());
+        appendTermStart(entry);
     }
+    // 被覆盖的日志需要重新持久化
+    m_unstable = std::min(m_unstable, after);
     return lastIndex();
 }
 
 void RaftLog::append(const Entry& entry) {
     m_entries.push_back(entry);
+    m_bytes += static_cast<int64_t>(entry.data.size());
+    appendTermStart(entry);
 }
 
 int64_t RaftLog::findConflict(const std::vector<Entry>& entries) {
@@ -128,20 +174,54 @@ int64_t RaftLog::findConflict(int64_t prevLogIndex, int64_t prevLogTerm) {
         return last + 1;
     }
     // 如果prevLogIndex小于等于最后一个索引，证明有同一个index的日志，但是term不同
+    // prevLogIndex 所在的整个任期都和 leader 冲突，直接返回该任期的第一条日志，快照中的日志一定不冲突
+    return std::max(termFirstIndex(prevLogIndex), firstIndex());
+}
 
-    int64_t first = firstIndex();
-    // 获取prevLogIndex对应的任期，存储在conflictTerm中
-    auto conflictTerm = term(prevLogIndex);
-    int64_t index = prevLogIndex - 1; // 用于保存冲突的index
-    // 从prevLogIndex开始向前遍历，直到找到第一个任期不等于conflictTerm的日志
-    while (index >= first && (term((index) == conflictTerm))) {
-        --index;
+int64_t RaftLog::lastIndexOfTerm(int64_t term) {
+    auto iter = std::lower_bound(m_termStarts.begin(), m_termStarts.end(), term, [](const TermStart& start, int64_t t) {
+        return start.first < t;
+    });
+    if (iter == m_termStarts.end() || iter->first != term) {
+        return 0;
     }
-    return index;
+    // 下一个任期的第一条日志之前就是该任期的最后一条日志
+    auto next = std::next(iter);
+    return next == m_termStarts.end() ? lastIndex() : next->second - 1;
+}
+
+void RaftLog::rebuildTermStarts() {
+    m_termStarts.clear();
+    for (const Entry& entry : m_entries) {
+        appendTermStart(entry);
+    }
+}
+
+void RaftLog::truncateTermStarts(int64_t index) {
+    while (!m_termStarts.empty() && m_termStarts.back().second >= index) {
+        m_termStarts.pop_back();
+    }
+}
+
+void RaftLog::appendTermStart(const Entry& entry) {
+    if (m_termStarts.empty() || m_termStarts.back().first != entry.term) {
+        m_termStarts.emplace_back(entry.term, entry.index);
+    }
+}
+
+int64_t RaftLog::termFirstIndex(int64_t index) {
+    // 第一个起始索引大于 index 的任期的前一个任期就是 index 所在的任期
+    auto iter = std::upper_bound(m_termStarts.begin(), m_termStarts.end(), index, [](int64_t i, const TermStart& start) {
+        return i < start.second;
+    });
+    if (iter == m_termStarts.begin()) {
+        return lastSnapshotIndex();
+    }
+    return std::prev(iter)->second;
 }
 
 std::vector<Entry> RaftLog::nextEntries() {
-    int64_t offset = std::max(m_applied + 1, firstIndex());
+    int64_t offset = std::max(std::max(m_applied, m_applying) + 1, firstIndex());
     if (m_committed + 1 > offset) {
         return slice(offset, m_committed +1, m_maxNextEntriesSize);
     }
@@ -149,11 +229,22 @@ std::vector<Entry> RaftLog::nextEntries() {
 }
 
 bool RaftLog::hasNextEntries() {
-    int64_t offset = std::max(m_applied +1, firstIndex());
+    int64_t offset = std::max(std::max(m_applied, m_applying) + 1, firstIndex());
     return m_committed +1 >offset;
 }
 
-void RaftLog::clearEntries(int64_t lastSnapshotIndex =0, int64_t lastSnapshotTerm = 0);
+void RaftLog::clearEntries(int64_t lastSnapshotIndex, int64_t lastSnapshotTerm) {
+    m_entries.clear();
+    // 第一个元素保存快照的最后一条日志
+    m_entries.push_back(Entry{.index = lastSnapshotIndex, .term = lastSnapshotTerm});
+    m_committed = lastSnapshotIndex;
+    m_applied = lastSnapshotIndex;
+    m_applying = lastSnapshotIndex;
+    m_unstable = lastSnapshotIndex + 1;
+    m_evicted = lastSnapshotIndex + 1;
+    m_bytes = 0;
+    rebuildTermStarts();
+}
 
 int64_t RaftLog::firstIndex() {
     // +1是因为，日志条目的数组的第一个位置存储的是最近一次快照中最后一条日志条目的索引
@@ -201,6 +292,15 @@ void RaftLog::appliedTo(int64_t index) {
         return ;
     }
     m_applied = index;
+    maybeEvict();
+}
+
+void RaftLog::applyingTo(int64_t index) {
+    if (m_committed < index) {
+        SPDLOG_LOGGER_CRITICAL(Logger, "applying({}) is out of range [applied({}), committed({})]", index, m_applied, m_committed);
+        return ;
+    }
+    m_applying = std::max(m_applying, index);
 }
 
 int64_t RaftLog::term(int64_t index) {
@@ -223,8 +323,33 @@ std::vector<Entry> RaftLog::entries(int64_t index) {
     return slice(index, lastIndex() + 1, m_maxNextEntriesSize);
 }
 
+std::vector<Entry> RaftLog::entries(int64_t index, int64_t maxBytes) {
+    if (index > lastIndex()) {
+        return {};
+    }
+    // 字节数限制交给 slice，已经淘汰的日志也只从 WAL 读取需要发送的部分
+    return slice(index, lastIndex() + 1, m_maxNextEntriesSize, maxBytes);
+}
+
 std::vector<Entry> RaftLog::allEntries() {
-    return m_entries;
+    std::vector<Entry> all{m_entries.front()};
+    if (lastIndex() >= firstIndex()) {
+        auto entries = slice(firstIndex(), lastIndex() + 1, NO_LIMIT);
+        all.insert(all.end(), std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+    }
+    return all;
+}
+
+std::vector<Entry> RaftLog::unstableEntries() {
+    if (m_unstable > lastIndex()) {
+        return {};
+    }
+    return slice(m_unstable, lastIndex() + 1, NO_LIMIT);
+}
+
+void RaftLog::stableTo(int64_t index) {
+    m_unstable = std::max(m_unstable, index + 1);
+    maybeEvict();
 }
 
 bool RaftLog::isUpToDate(int64_t index, int64_t term) {
@@ -248,17 +373,68 @@ bool RaftLog::maybeCommit(int64_t maxIndex, int64_t term) {
     return false;
 }
 
-std::vector<Entry> RaftLog::slice(int64_t low, int64_t high, int64_t maxSize) {
+std::vector<Entry> RaftLog::slice(int64_t low, int64_t high, int64_t maxSize, int64_t maxBytes) {
     mustCheckOutOfBounds(low,high - 1);
     if (maxSize != NO_LIMIT) {
         high = std::min(high, low+maxSize);
     }
 
+    std::vector<Entry> entries;
+    int64_t bytes = 0;
+    // 数据已经被淘汰的部分从 WAL 中读取，读取时就按字节数限制，不把整段淘汰的日志读进内存
+    if (low < m_evicted) {
+        int64_t end = std::min(high, m_evicted);
+        entries = m_persister->loadEntries(low, end, maxBytes);
+        const auto count = static_cast<int64_t>(entries.size());
+        if (count == 0 || entries.front().index != low || entries.back().index != low + count - 1 || (count != end - low && maxBytes == NO_LIMIT)) {
+            SPDLOG_LOGGER_CRITICAL(Logger, "load evicted entries [{}, {}) from wal failed, got {} entries", low, end, entries.size());
+            exit(EXIT_FAILURE);
+        }
+        // 达到字节数上限，不再读取内存中的日志
+        if (count != end - low) {
+            return entries;
+        }
+        for (const Entry& entry : entries) {
+            bytes += static_cast<int64_t>(entry.data.size());
+        }
+        low = end;
+    }
+
     // 计算实际下标
-    low -= lastSnapshotIndex();
-    high -= lastSnapshotIndex();
+    const int64_t offset = lastSnapshotIndex();
+    int64_t last = maxBytes == NO_LIMIT ? high : low;
+    for (; last < high; ++last) {
+        const auto size = static_cast<int64_t>(m_entries[last - offset].data.size());
+        // 至少返回一条日志，单条日志超过 maxBytes 时也会返回，否则复制会卡住
+        if ((last > low || !entries.empty()) && bytes + size > maxBytes) {
+            break;
+        }
+        bytes += size;
+    }
+    entries.insert(entries.end(), m_entries.begin() + (low - offset), m_entries.begin() + (last - offset));
+    return entries;
+}
 
-    return std::vector<Entry>{m_entries.begin() + low, m_entries.begin() + high};
+void RaftLog::maybeEvict() {
+    if (m_bytes <= static_cast<int64_t>(s_log_cache_bytes)) {
+        return;
+    }
+    // 只淘汰已经落盘并且已经应用的日志，这些日志一定能从 WAL 中读回来，并且通常不会再被访问；
+    // m_unstable 只说明日志已经提交给了持久化器，还不一定写进了 WAL
+    const int64_t limit = std::min({m_unstable - 1, m_applied, m_persister->durableIndex()});
+    const int64_t offset = lastSnapshotIndex();
+    int64_t index = m_evicted;
+    while (index <= limit && m_bytes > static_cast<int64_t>(s_log_cache_bytes)) {
+        Payload& data = m_entries[index - offset].data;
+        m_bytes -= static_cast<int64_t>(data.size());
+        // 只释放日志对缓冲区的引用，正在发送或应用的副本不受影响
+        data.clear();
+        ++index;
+    }
+    if (index != m_evicted) {
+        SPDLOG_LOGGER_DEBUG(Logger, "evict entries [{}, {}) from memory, {} bytes left", m_evicted, index, m_bytes);
+        m_evicted = index;
+    }
 }
 
 /**
@@ -312,8 +488,22 @@ bool RaftLog::compact(int64_t compactIndex) {
     }
 
     auto index = compactIndex - offset + 1;
+    // deque 从头部删除，不需要移动后面的日志
+    for (auto iter = m_entries.begin(); iter != m_entries.begin() + index; ++iter) {
+        m_bytes -= static_cast<int64_t>(iter->data.size());
+    }
     m_entries.erase(m_entries.begin(),m_entries.begin() + index);
-    m_entries[0].data = "";
+    m_bytes -= static_cast<int64_t>(m_entries[0].data.size());
+    m_entries[0].data.clear();
+    // 压缩掉的任期不再需要，快照的最后一条日志作为第一个任期的起点
+    auto iter = std::upper_bound(m_termStarts.begin(), m_termStarts.end(), compactIndex, [](int64_t i, const TermStart& start) {
+        return i < start.second;
+    });
+    m_termStarts.erase(m_termStarts.begin(), iter);
+    m_termStarts.insert(m_termStarts.begin(), TermStart{m_entries[0].term, compactIndex});
+    m_evicted = std::max(m_evicted, firstIndex());
+    // 被压缩的日志已经在快照里了，不需要再持久化
+    m_unstable = std::max(m_unstable, firstIndex());
     return true;
 }
 
@@ -6,6 +6,8 @@
 #define RR_RAFT_RAFT_LOG_H
 
 #include <vector>
+#include <deque>
+#include <utility>
 #include <cstdint>
 #include <memory>
 #include "entry.h"
@@ -15,6 +17,10 @@ namespace RR::raft {
 /**
  * @brief RaftLog 类封装了与 Raft 日志相关的所有操作，包括日志的追加、查找、截断等。
  *        它管理着一个日志条目的序列，同时负责维护关于这些日志条目的元数据，如commit index和apply index。
+ *
+ * @details 日志保存在按索引寻址的 deque 中，压缩时从头部删除不需要移动后面的日志。
+ *          内存中日志数据的总量超过 raft.log.cache_bytes 时，已经持久化并且已经应用的旧日志的数据会被淘汰，
+ *          只保留索引和任期，需要时再从 WAL 中读取。
  */
 class RaftLog {
 public:
@@ -59,9 +65,15 @@ public:
 
     /**
      * @brief 找出冲突任期的第一条日志索引
+     * @details 通过任期起始索引直接定位，不需要逐条向前比较任期；prevLogIndex 超出日志范围时返回 lastIndex() + 1
      */
     int64_t findConflict(int64_t prevLogIndex, int64_t prevLogTerm);
 
+    /**
+     * @brief 获取日志中任期为 term 的最后一条日志的索引，日志中没有该任期时返回0
+     */
+    int64_t lastIndexOfTerm(int64_t term);
+
     /**
      * @brief 获取(apply,commit]间的所有日志，这个函数用于输出给使用者apply日志
      */
@@ -113,6 +125,11 @@ public:
      */
     void appliedTo(int64_t index);
 
+    /**
+     * @brief 标记 index 及之前的日志已经交给状态机，nextEntries 从 index 之后开始取，applied 由状态机应用完成后再推进
+     */
+    void applyingTo(int64_t index);
+
     /**
      * @brief 获取指定索引日志的term
      */
@@ -123,11 +140,27 @@ public:
      */
     std::vector<Entry> entries(int64_t index);
 
+    /**
+     * @brief 获取[index，lastIndex()]的日志，条数限制在 m_maxNextEntriesSize，数据的总字节数限制在 maxBytes
+     * @details 至少返回一条日志，单条日志超过 maxBytes 时也会被发送，否则复制会卡住
+     */
+    std::vector<Entry> entries(int64_t index, int64_t maxBytes);
+
     /**
      * @brief 获取所有日志条目
      */
     std::vector<Entry> allEntries();
 
+    /**
+     * @brief 获取还没有持久化的日志，即[unstable, lastIndex()]
+     */
+    std::vector<Entry> unstableEntries();
+
+    /**
+     * @brief 标记 index 及之前的日志已经持久化
+     */
+    void stableTo(int64_t index);
+
     /**
      * @brief 判断给定日志的索引和任期是不是比自己新
      * @details Raft 通过比较两份日志中最后一条日志条目的索引值和任期号定义谁的日志比较新。
@@ -148,9 +181,10 @@ public:
     bool maybeCommit(int64_t maxIndex, int64_t term);
 
     /**
-     * @brief 获取[low，high)的所有日志，但是总量限制在maxSize
+     * @brief 获取[low，high)的所有日志，但是总量限制在maxSize，数据的总字节数限制在 maxBytes
+     * @details 至少返回一条日志；已经淘汰的日志从 WAL 中读取时也按 maxBytes 限制
      */
-    std::vector<Entry> slice(int64_t low, int64_t high, int64_t maxSize);
+    std::vector<Entry> slice(int64_t low, int64_t high, int64_t maxSize, int64_t maxBytes = NO_LIMIT);
 
     /**
      * @brief 检查 index 是否正确，
@@ -158,6 +192,11 @@ public:
      */
     void mustCheckOutOfBounds(int64_t low, int64_t high);
 
+    /**
+     * @brief 内存中的日志数据超过上限时，从前往后淘汰已经落盘并且已经应用的日志的数据
+     */
+    void maybeEvict();
+
     /**
      * @brief 创建快照并压缩 index 之前的日志
      */
@@ -175,6 +214,8 @@ public:
     [[nodiscard]] int64_t committed() const { return m_committed};
 
     [[nodiscard]] int64_t applied() const { return m_applied};
+
+    [[nodiscard]] int64_t applying() const { return m_applying; }
     [[nodiscard]] std::string toString() const {
         std::string str = fmt::format("committed: {}, applied: {}, offset: {}, length: {}", m_committed, m_applied, m_entries.front().index, m_entries.size());
         return str;
@@ -182,8 +223,32 @@ public:
 
     
 private:
-    // 日志条目集合
-    std::vector<Entry> m_entries;
+    // (任期, 该任期在日志中的第一条日志的索引)
+    using TermStart = std::pair<int64_t, int64_t>;
+
+    /**
+     * @brief 根据 m_entries 重新建立任期起始索引
+     */
+    void rebuildTermStarts();
+
+    /**
+     * @brief 删除起始索引不小于 index 的任期，日志被截断时调用
+     */
+    void truncateTermStarts(int64_t index);
+
+    /**
+     * @brief 在日志末尾追加 entry 之后更新任期起始索引
+     */
+    void appendTermStart(const Entry& entry);
+
+    /**
+     * @brief 获取 index 所在任期在日志中的第一条日志的索引
+     */
+    int64_t termFirstIndex(int64_t index);
+
+private:
+    // 日志条目集合，第一个元素保存快照的最后一条日志
+    std::deque<Entry> m_entries;
     // 已经被提交的最高的日志条目的索引（初始值为0，单调递增）
     int64_t m_committed;
     // 已经被应用到状态机的最高的日志条目的索引（初始值为0，单调递增）
@@ -192,10 +257,23 @@ private:
     // 经被apply的最大索引。apply索引是节点状态(非集群状态)，这取决于每个节点的apply速度。
     // 提交意味着确认日志条目已经安全地保存，而应用意味着将这些条目的操作反映到状态机上。
     int64_t m_applied;
+    // 已经交给状态机的最高的日志条目的索引，不小于 m_applied，两者之间的日志正在被状态机应用
+    int64_t m_applying;
     // raftLog有一个成员函数nextEntries(),用于获取 (applied,committed] 的所有日志，很容易看出来
     // 这个函数是apply日志时调用的，maxNextEntriesSize就是用来限制获取日志大小总量的，避免一次调用
     // 产生过大粒度的apply操作。
     int64_t m_maxNextEntriesSize;
+    // 第一条还没有提交给持久化器的日志的索引，append 覆盖日志时会回退，提交持久化请求之后前进到 lastIndex() + 1
+    int64_t m_unstable;
+    // 第一条数据还在内存中的日志的索引，[firstIndex(), m_evicted) 的日志数据已经被淘汰，只保留索引和任期
+    int64_t m_evicted;
+    // 内存中日志数据的总字节数
+    int64_t m_bytes = 0;
+    // 用于读取被淘汰的日志
+    Persister::ptr m_persister;
+    // 按索引（也就是按任期）升序排列的任期起始索引，第一个元素为快照的最后一条日志所在的任期，
+    // 大小和任期数相关，和日志条数无关
+    std::vector<TermStart> m_termStarts;
 
 }
 }
@@ -3,8 +3,12 @@
 // Author: Zizhou
 
 #include "raft_node.h"
+#include <algorithm>
+#include <chrono>
 #include <random>
+#include <tuple>
 #include <utility>
+#include "RaftRegistry/common/compress.h"
 #include "RaftRegistry/common/config.h"
 
 namespace RR::raft {
@@ -13,12 +17,49 @@ static auto Logger = GetLoggerInstance();
 static ConfigVar<uint64_t>::ptr g_timer_election_base = Config::LookUp<size_t>("raft.timer.election.base", 1500, "raft election timeout(ms) base");
 static ConfigVar<uint64_t>::ptr g_timer_election_top = Config::LookUp<size_t>("raft.timer.election.top", 3000, "raft election timeout(ms) top");
 static ConfigVar<uint64_t>::ptr g_timer_heartbeat = Config::LookUp<size_t>("raft.timer.heartbeat", 500, "raft heartbeat timeout(ms)");
+static ConfigVar<uint32_t>::ptr g_max_inflight = Config::LookUp<uint32_t>("raft.replication.max_inflight", 16, "max in-flight AppendEntries per follower, 1 disables pipelining");
+static ConfigVar<uint64_t>::ptr g_max_msg_bytes = Config::LookUp<uint64_t>("raft.replication.max_msg_bytes", 1024 * 1024, "max bytes of entries in one AppendEntries, at least one entry is always sent");
+static ConfigVar<uint64_t>::ptr g_max_inflight_bytes = Config::LookUp<uint64_t>("raft.replication.max_inflight_bytes", 16 * 1024 * 1024, "max bytes of in-flight entries per follower, 0 means unlimited");
+static ConfigVar<uint32_t>::ptr g_propose_batch_size = Config::LookUp<uint32_t>("raft.propose.batch_size", 256, "max proposals appended and persisted as one batch");
+static ConfigVar<uint64_t>::ptr g_propose_linger = Config::LookUp<uint64_t>("raft.propose.linger", 0, "time(ms) to wait for more proposals before flushing a batch that is not full");
+static ConfigVar<uint64_t>::ptr g_snapshot_chunk_size = Config::LookUp<uint64_t>("raft.snapshot.chunk_size", 1024 * 1024, "raft InstallSnapshot chunk size(byte)");
+static ConfigVar<uint64_t>::ptr g_snapshot_rate_limit = Config::LookUp<uint64_t>("raft.snapshot.rate_limit", 0, "max bytes per second sent to one follower when installing a snapshot, 0 means unlimited");
+static ConfigVar<bool>::ptr g_read_lease = Config::LookUp<bool>("raft.read.lease", false, "serve reads locally on the leader while its lease is valid");
+static ConfigVar<bool>::ptr g_pre_vote = Config::LookUp<bool>("raft.election.pre_vote", true, "run a pre-vote round before increasing the term to start an election");
+static ConfigVar<std::set<int64_t>>::ptr g_learners = Config::LookUp<std::set<int64_t>>("raft.learners", {}, "ids of non-voting learner nodes, they receive the log but do not count toward quorum");
+static ConfigVar<bool>::ptr g_heartbeat_coalesce = Config::LookUp<bool>("raft.heartbeat.coalesce", true, "send one compact heartbeat message per node per tick to followers that are caught up");
+static ConfigVar<bool>::ptr g_compression = Config::LookUp<bool>("raft.compression.enable", true, "compress entry data at propose time and snapshot data when it is saved");
+static ConfigVar<uint64_t>::ptr g_compression_min_size = Config::LookUp<uint64_t>("raft.compression.min_size", 64, "data smaller than this(byte) is stored uncompressed");
+static ConfigVar<uint64_t>::ptr g_read_clock_drift = Config::LookUp<uint64_t>("raft.read.clock_drift", 100, "max clock drift(ms) subtracted from the leader lease");
     
 // 选举超时时间，从base-top的区间中随机选择
 static uint64_t s_timer_election_base;
 static uint64_t s_timer_election_top;
 // 心跳超时时间，心跳超时时间必须小于选举超时时间
 static uint64_t s_timer_heartbeat;
+// 每个 follower 同时在途的 AppendEntries 请求数量上限
+static uint32_t s_max_inflight;
+// 单个 AppendEntries 请求和每个 follower 在途的日志字节数上限
+static uint64_t s_max_msg_bytes;
+static uint64_t s_max_inflight_bytes;
+// 一批提议的数量上限，以及攒批时最多等待的时间
+static uint32_t s_propose_batch_size;
+static uint64_t s_propose_linger;
+// 快照分块发送时每块的大小，以及向单个节点发送快照的速度上限
+static uint64_t s_snapshot_chunk_size;
+static uint64_t s_snapshot_rate_limit;
+// 是否开启租约读，租约的长度为选举超时时间的 base 减去时钟漂移
+static bool s_read_lease;
+static uint64_t s_read_clock_drift;
+// 是否在选举前先进行预投票，避免被分区的节点回来后用更大的任期打断正常的 leader
+static bool s_pre_vote;
+// 是否对已经追上日志的节点发送合并的精简心跳
+static bool s_heartbeat_coalesce;
+// 是否压缩日志和快照的数据，以及压缩的最小数据大小
+static bool s_compression;
+static uint64_t s_compression_min_size;
+// follower 最多记录的提交索引和时间的数量
+static constexpr size_t MAX_COMMIT_TIMES = 1024;
 
 struct RaftNodeIniter {
     RaftNodeIniter() {
@@ -39,39 +80,191 @@ struct RaftNodeIniter {
             SPDLOG_LOGGER_INFO(Logger, "raft heartbeat timeout changed from {} to {}", old_value, new_value);
             s_timer_heartbeat = g_timer_heartbeat;
         })
+
+        s_max_inflight = g_max_inflight->getValue();
+        g_max_inflight->addListener([] (const uint32_t& old_value, const uint32_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft replication max inflight changed from {} to {}", old_value, new_value);
+            s_max_inflight = new_value;
+        });
+
+        s_max_msg_bytes = g_max_msg_bytes->getValue();
+        g_max_msg_bytes->addListener([] (const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft replication max msg bytes changed from {} to {}", old_value, new_value);
+            s_max_msg_bytes = new_value;
+        });
+
+        s_max_inflight_bytes = g_max_inflight_bytes->getValue();
+        g_max_inflight_bytes->addListener([] (const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft replication max inflight bytes changed from {} to {}", old_value, new_value);
+            s_max_inflight_bytes = new_value;
+        });
+
+        s_propose_batch_size = g_propose_batch_size->getValue();
+        g_propose_batch_size->addListener([] (const uint32_t& old_value, const uint32_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft propose batch size changed from {} to {}", old_value, new_value);
+            s_propose_batch_size = new_value;
+        });
+
+        s_propose_linger = g_propose_linger->getValue();
+        g_propose_linger->addListener([] (const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft propose linger changed from {} to {}", old_value, new_value);
+            s_propose_linger = new_value;
+        });
+
+        s_snapshot_chunk_size = g_snapshot_chunk_size->getValue();
+        g_snapshot_chunk_size->addListener([] (const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft snapshot chunk size changed from {} to {}", old_value, new_value);
+            s_snapshot_chunk_size = new_value;
+        });
+
+        s_snapshot_rate_limit = g_snapshot_rate_limit->getValue();
+        g_snapshot_rate_limit->addListener([] (const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft snapshot rate limit changed from {} to {}", old_value, new_value);
+            s_snapshot_rate_limit = new_value;
+        });
+
+        s_read_lease = g_read_lease->getValue();
+        g_read_lease->addListener([] (const bool& old_value, const bool& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft read lease changed from {} to {}", old_value, new_value);
+            s_read_lease = new_value;
+        });
+
+        s_read_clock_drift = g_read_clock_drift->getValue();
+        g_read_clock_drift->addListener([] (const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft read clock drift changed from {} to {}", old_value, new_value);
+            s_read_clock_drift = new_value;
+        });
+
+        s_pre_vote = g_pre_vote->getValue();
+        g_pre_vote->addListener([] (const bool& old_value, const bool& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft election pre vote changed from {} to {}", old_value, new_value);
+            s_pre_vote = new_value;
+        });
+
+        s_heartbeat_coalesce = g_heartbeat_coalesce->getValue();
+        g_heartbeat_coalesce->addListener([] (const bool& old_value, const bool& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft heartbeat coalesce changed from {} to {}", old_value, new_value);
+            s_heartbeat_coalesce = new_value;
+        });
+
+        s_compression = g_compression->getValue();
+        g_compression->addListener([] (const bool& old_value, const bool& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft compression changed from {} to {}", old_value, new_value);
+            s_compression = new_value;
+        });
+
+        s_compression_min_size = g_compression_min_size->getValue();
+        g_compression_min_size->addListener([] (const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft compression min size changed from {} to {}", old_value, new_value);
+            s_compression_min_size = new_value;
+        });
     }
 };
 
 // 初始化配置
 [[maybe unused]] static RaftNodeIniter s_initer();
 
-RaftNode::RaftNode(std::map<int64_t, std::string>& servers, int64_t id, Persister::ptr persister, co::co_chan<ApplyMsg> applyChan) : m_id(id), m_persister(persister), m_applyChan(applyChan),m_logs(persister, 1000) {
+/**
+ * @brief 按配置压缩数据，数据太小或者压缩后没有变小时不压缩
+ * @param out 压缩后的数据，只有返回值不是 Codec::None 时有效
+ * @return 使用的压缩编码
+ */
+static Codec MaybeCompress(std::string_view data, std::string& out) {
+    if (!s_compression || data.size() < s_compression_min_size) {
+        return Codec::None;
+    }
+    out = Compress(Codec::LZ, data);
+    if (out.size() >= data.size()) {
+        out.clear();
+        return Codec::None;
+    }
+    return Codec::LZ;
+}
+
+RaftNode::RaftNode(std::map<int64_t, std::string>& servers, int64_t id, Persister::ptr persister, co::co_chan<ApplyMsg> applyChan) : m_id(id), m_host(this), m_persister(persister), m_applyChan(applyChan),m_logs(persister, 1000) {
     // 设置服务器名称
     rpc::RpcServer::setName("Raft-Node[" + std::to_string(id) + "]");
 
+    // 单组部署时自己就是宿主，心跳合并器只有这一个组
+    m_coalescer = std::make_shared<HeartbeatCoalescer>(id);
+    m_coalescer->addGroup(this);
+    rpc::RpcServer::registerMethod(HEARTBEATS, [this](HeartbeatsArgs args) {
+        return m_coalescer->handleHeartbeats(std::move(args));
+    });
+
+    registerMethods();
+
+    // 成员关系是静态配置，所有节点的 raft.learners 应该一致
+    const std::set<int64_t> learners = g_learners->getValue();
+    m_learner = learners.count(id) > 0;
+    for (auto peer : servers) {
+        if (peer.first == id) { // 跳过自己
+            continue;
+        }
+        Address::ptr address = Address::LookUpAny(peer.second); // 这里进行的是DNS解析，即主机名到IP地址的转换
+        // 添加节点
+        if (learners.count(peer.first)) {
+            addLearner(peer.first, address);
+        } else {
+            addPeer(peer.first, address);
+        }
+    }
+}
+
+RaftNode::RaftNode(rpc::RpcServer* host, int64_t group, const std::map<int64_t, RaftPeer::ptr>& peers, int64_t id, Persister::ptr persister, co::co_chan<ApplyMsg> applyChan, HeartbeatCoalescer::ptr coalescer)
+    : m_id(id), m_group(group), m_host(host), m_persister(persister), m_applyChan(applyChan), m_logs(persister, 1000) {
+    m_coalescer = std::move(coalescer);
+    m_coalescer->addGroup(this);
+    registerMethods();
+
+    const std::set<int64_t> learners = g_learners->getValue();
+    m_learner = learners.count(id) > 0;
+    for (auto& peer : peers) {
+        if (peer.first == id) {
+            continue;
+        }
+        addPeer(peer.first, peer.second);
+        if (learners.count(peer.first)) {
+            m_learners.insert(peer.first);
+        }
+    }
+}
+
+void RaftNode::registerMethods() {
     // 注册服务（注册方法）RequestVote
-    registerMethod(REQUEST_VOTE, [this](RequestVoteArgs args) {
+    m_host->registerMethod(GroupMethod(REQUEST_VOTE, m_group), [this](RequestVoteArgs args) {
         return handleRequestVote(std::move(args));
     });
 
+    // 注册服务（注册方法）PreVote
+    m_host->registerMethod(GroupMethod(PRE_VOTE, m_group), [this](RequestVoteArgs args) {
+        return handlePreVote(std::move(args));
+    });
+
     // 注册服务（注册方法）AppendEntries
-    registerMethod(APPEND_ENTRIES, [this](AppendEntriesArgs args) {
+    m_host->registerMethod(GroupMethod(APPEND_ENTRIES, m_group), [this](AppendEntriesArgs args) {
         return handleAppendEntries(std::move(args));
     });
 
     // 注册服务（注册方法）InstallSnapshot
-    registerMethod(INSTALL_SNAPSHOT, [this](InstallSnapshotArgs args) {
+    m_host->registerMethod(GroupMethod(INSTALL_SNAPSHOT, m_group), [this](InstallSnapshotArgs args) {
         return handleInstallSnapshot(std::move(args));
     });
 
-    for (auto peer : servers) {
-        if (peer.first == id) { // 跳过自己
-            continue;
-        }
-        Address::ptr address = Address::LookUpAny(peer.second); // 这里进行的是DNS解析，即主机名到IP地址的转换
-        // 添加节点
-        addPeer(peer.first, address);
-    }
+    // 注册服务（注册方法）ReadIndex
+    m_host->registerMethod(GroupMethod(READ_INDEX, m_group), [this](ReadIndexArgs args) {
+        return handleReadIndex(std::move(args));
+    });
+
+    // 注册服务（注册方法）TimeoutNow
+    m_host->registerMethod(GroupMethod(TIMEOUT_NOW, m_group), [this](TimeoutNowArgs args) {
+        return handleTimeoutNow(std::move(args));
+    });
+
+    // 注册管理服务 TransferLeadership
+    m_host->registerMethod(GroupMethod(TRANSFER_LEADERSHIP, m_group), [this](TransferLeadershipArgs args) {
+        return handleTransferLeadership(std::move(args));
+    });
 }
 
 RaftNode::~RaftNode() {
@@ -85,6 +278,7 @@ void RaftNode::start() {
         // 如果有持久化数据，加载数据
         m_currentTerm = hs->term;
         m_votedFor = hs->vote;
+        publishState();
         SPDLOG_LOGGER_INFO(Logger, "initialze from state persisted before a crash, term {}, vote {}, commit {} ", m_currentTerm, m_votedFor, hs->commit);
         
     } else {
@@ -98,26 +292,48 @@ void RaftNode::start() {
     go[this] {
         applier();
     }
+    // 提议的攒批协程，把并发的提议合并成一次追加和一次落盘
+    go [this] {
+        proposer();
+    };
+    // 每个节点一个复制协程，有新日志时立即发送，不用等心跳
+    for (auto& chan : m_replicateChans) {
+        go [peerId = chan.first, this] {
+            replicator(peerId);
+        };
+    }
 
-    // 启动 RPC 服务器
-    rpc::RpcServer::start();
+    // 启动心跳合并器和 RPC 服务器，多个组共享的由宿主启动
+    if (m_host == this) {
+        m_coalescer->start();
+        rpc::RpcServer::start();
+    }
 }
 
 void RaftNode::stop() {
+    // 停止后不再参与心跳；合并器正在进行的调用需要 m_mutex，必须在加锁之前移除
+    m_coalescer->removeGroup(m_group);
     std::unique_lock<Mutextype> loack(m_mutex);
-    if (isStop()) { // 如果已经stop，直接返回
+    if (m_host == this) {
+        m_coalescer->stop();
+    }
+    if (m_host->isStop()) { // 如果已经stop，直接返回
         return ;
     }
 
     // 关闭应用通道，这可能会导致等待在这个通道上的线程被唤醒
     m_applyChan.close();
-    // 停止心跳定时器，这将阻止节点发送心跳消息
-    m_heartbeatTimer.stop();
+    // 关闭提议通道，攒批协程退出
+    m_proposeChan.close();
+    // 关闭复制通道，复制协程退出
+    for (auto& chan : m_replicateChans) {
+        chan.second.close();
+    }
     // 停止选举定时器，这将阻止节点启动新的选举
     m_electionTimer.stop();
 }
 
-void RaftNode::startElection() {
+void RaftNode::startElection(bool leadershipTransfer) {
     // 创建一个投票请求
     RequestVoteArgs request{};
     // 设置请求的参数
@@ -125,21 +341,30 @@ void RaftNode::startElection() {
     request.candidateId = m_id;
     request.lastLogIndex = m_logs.lastIndex();
     request.lastLogTerm = m_logs.lastTerm();
+    request.leadershipTransfer = leadershipTransfer;
 
     SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] starts election with RequestVoteArgs {}",m_id , request.toString());
     
     // 投票给自己
     m_votedFor = m_id;
-    // 持久化当前状态
-    persist();
+    // 提交持久化请求，不持锁等待落盘；每个投票协程在发出请求之前等待任期和投票落盘
+    const int64_t ticket = persistAsync();
 
     // 创建一个共享指针，用于统计获得的投票数，初始值为1（自己的一票）
     std::shared_ptr<int64_t> grantedVotes = std::make_shared<int64_t>(1);
     
     // 遍历所有的节点
     for (auto& peer : m_peers) {
+        // learner 不投票
+        if (m_learners.count(peer.first)) {
+            continue;
+        }
         // 使用协程发起异步投票，不阻塞选举定时器，才能在选举超时后发起新的选举
-        go [grantedVotes, request, peer, this] {
+        go [grantedVotes, request, peer, ticket, this] {
+            if (!m_persister->wait(ticket)) {
+                SPDLOG_LOGGER_ERROR(Logger, "Node [{}] persist failed at term {}, stop requesting votes", m_id, request.term);
+                return;
+            }
             // 向peer发送投票请求，并获取回复
             auto reply = peer.second->requestVote(request);
             if (!reply) {
@@ -153,8 +378,8 @@ void RaftNode::startElection() {
             if (m_currentTerm == request.term && m_state == RaftState::Candidate) { // 如果未改变
                 if (reply->voteGranted) { // 如果对等节点同意投票
                     ++(*grantedVotes); // 投票数加1
-                    // 如果获得的投票数超过了所有节点数的一半，成为领导者
-                    if (*grantedVotes > static_cast<int64_t>(m_peers.size() + 1) / 2) {
+                    // 如果获得的投票数超过了有投票权的节点数的一半，成为领导者
+                    if (*grantedVotes >= quorum()) {
                         SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] receives majority votes in term {}", m_id, m_currentTerm);
                         becomeLeader();
                     }
@@ -170,38 +395,106 @@ void RaftNode::startElection() {
 }
 
 
+void RaftNode::startPreVote() {
+    // 以下一个任期发起预投票，自己的任期保持不变
+    RequestVoteArgs request{};
+    request.term = m_currentTerm + 1;
+    request.candidateId = m_id;
+    request.lastLogIndex = m_logs.lastIndex();
+    request.lastLogTerm = m_logs.lastTerm();
+
+    SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] starts pre vote with RequestVoteArgs {}", m_id, request.toString());
+
+    std::shared_ptr<int64_t> grantedVotes = std::make_shared<int64_t>(1);
+    for (auto& peer : m_peers) {
+        if (m_learners.count(peer.first)) {
+            continue;
+        }
+        go [grantedVotes, request, peer, this] {
+            auto reply = peer.second->preVote(request);
+            if (!reply) {
+                return;
+            }
+
+            std::unique_lock<Mutextype> lock(m_mutex);
+            SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] receives pre vote RequestVoteReply {} from Node[{}] after sending RequestVoteArgs {} in term {}", m_id, reply->toString(), peer.first, request.toString(), m_currentTerm);
+            // 预投票期间状态和任期都没有变化才处理
+            if (m_currentTerm + 1 != request.term || m_state != RaftState::PreCandidate) {
+                return;
+            }
+            if (reply->voteGranted) {
+                ++(*grantedVotes);
+                // 多数节点会投票给自己，这时才增加任期发起真正的选举
+                if (*grantedVotes >= quorum()) {
+                    SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] receives majority pre votes for term {}", m_id, request.term);
+                    becomeCandidate();
+                    startElection();
+                }
+            } else if (reply->term > m_currentTerm) {
+                SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] finds a newer term {} from Node[{}] during pre vote in term {}", m_id, reply->term, peer.first, m_currentTerm);
+                becomeFollower(reply->term, reply->leaderId);
+                rescheduleElection();
+            }
+        };
+    }
+}
+
 void RaftNode::applier() {
     // 循环，直到节点停止
-    while (!isStop()) {
+    while (!m_host->isStop()) {
         // 创建一个独占锁，保证在同一时间只有一个线程可以执行以下的代码
         std::unique_lock<MutexType> lock(m_mutex);
         // 如果没有需要 apply 的日志则等待
         while (!m_logs.hasNextEntries()) {
-            m_applyChan.wait(lock);
+            m_applyCond.wait(lock);
         }
 
-        // 获取已提交的最后一条日志的索引
-        auto lastCommit = m_logs.committed();
-        // 获取下一批需要 apply 的日志条目
+        // 获取下一批需要 apply 的日志条目，标记为已经交给状态机，下一轮从它们之后开始取
         auto entries = m_logs.nextEntries();
-        // 创建一个向量，用于存储需要 apply 的消息
-        std::vector<ApplyMsg> msg;
-        // 遍历日志条目，将它们转换为消息，并添加到向量中
-        for (auto& entry : entries) {
-            msg.emplace_back(entry);
+        if (entries.empty()) {
+            continue;
         }
-
+        m_logs.applyingTo(entries.back().index);
+        SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] applies entries {} - {} in term {}", m_id, entries.front().index, entries.back().index, m_currentTerm);
         lock.unlock();
 
-        // 遍历消息，将它们发送到 apply 频道
-        for (auto& m : msg) {
-            m_applyChan << m;
+        // 日志一直以压缩的形式保存和复制，交给状态机之前才解压，解压不持锁
+        for (Entry& entry : entries) {
+            if (!entry.decompress()) {
+                SPDLOG_LOGGER_CRITICAL(Logger, "Node [{}] decompress entry [index: {}, term: {}] failed", m_id, entry.index, entry.term);
+                exit(EXIT_FAILURE);
+            }
         }
 
-        lock.lock();
-        SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] applies entries {} - {} in term {}", m_id, m_logs.applied(), lastCommit, m_currentTerm);
-        // 更新已 apply 的日志的索引，防止与 installSnapshot 并发导致 lastApplied 回退
-        m_logs.appliedTo(std::max(m_logs.applied(), lastCommit));
+        // 整批日志作为一条消息发给状态机，不等待应用完成
+        m_applyChan << ApplyMsg(std::move(entries));
+    }
+}
+
+void RaftNode::appliedTo(int64_t index) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    // 应用期间可能安装了更新的快照，applied 不能回退
+    if (index <= m_logs.applied() || index > m_logs.committed()) {
+        return;
+    }
+    m_logs.appliedTo(index);
+}
+
+void RaftNode::replicator(int64_t peerId) {
+    co::co_chan<bool> chan = m_replicateChans[peerId];
+    bool signal;
+    while (chan.pop(signal)) {
+        // 通道容量为 1，复制协程被唤醒之前的多次通知会被合并成一次
+        go [peerId, this] {
+            replicateOneRound(peerId);
+        };
+    }
+}
+
+void RaftNode::triggerReplication() {
+    for (auto& chan : m_replicateChans) {
+        // 已经有未处理的通知时直接丢弃，不阻塞提议者
+        chan.second.TryPush(true);
     }
 }
 
@@ -213,6 +506,76 @@ void RaftNode::broadcastHeartbeat() {
     }
 }
 
+void RaftNode::tickHeartbeat(std::map<int64_t, std::vector<HeartbeatArgs>>& out) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    if (m_state != RaftState::Leader) {
+        return;
+    }
+    for (auto& peer : m_peers) {
+        const int64_t id = peer.first;
+        const Progress& progress = m_progress.at(id);
+        // 日志已经追上并且没有在途请求时，空的 AppendEntries 只起到确认领导地位和传递提交索引的作用
+        if (s_heartbeat_coalesce && progress.state == ProgressState::Replicate && !progress.inflights.count()
+            && m_matchIndex[id] == m_logs.lastIndex()) {
+            // 提交索引不超过对方已经匹配的索引，对方不用检查日志就可以直接提交
+            out[id].push_back(HeartbeatArgs{.group = m_group, .term = m_currentTerm, .leaderId = m_id,
+                                            .commit = std::min(m_matchIndex[id], m_logs.committed())});
+            continue;
+        }
+        go [id, this] {
+            replicateOneRound(id);
+        };
+    }
+}
+
+HeartbeatReply RaftNode::handleHeartbeat(const HeartbeatArgs& request) {
+    // 进入新的任期时，任期落盘之后才能回复，在释放锁之后等待
+    int64_t ticket = 0;
+    co_defer_scope {
+        mustWaitPersisted(ticket);
+    };
+    std::unique_lock<Mutextype> lock(m_mutex);
+    HeartbeatReply reply{.group = m_group};
+    // 拒绝任期小于自己的 leader 的心跳
+    if (request.term < m_currentTerm) {
+        reply.term = m_currentTerm;
+        return reply;
+    }
+    if (request.term > m_currentTerm || (request.term == m_currentTerm && (m_state == RaftState::Candidate || m_state == RaftState::PreCandidate))) {
+        ticket = becomeFollower(request.term, request.leaderId);
+    }
+    if (m_leaderId < 0) {
+        m_leaderId = request.leaderId;
+        publishState();
+    }
+    rescheduleElection();
+    m_lastLeaderContact = GetCuurentTimeMs();
+    updateLeaderCommit(request.commit);
+
+    // leader 只对日志已经匹配的节点发送精简心跳，提交索引之前的日志和 leader 一致
+    int64_t commit = std::min(request.commit, m_logs.lastIndex());
+    if (commit > m_logs.committed()) {
+        m_logs.commitTo(commit);
+        m_applyCond.notify_one();
+    }
+    reply.term = m_currentTerm;
+    reply.success = true;
+    return reply;
+}
+
+void RaftNode::handleHeartbeatReply(int64_t peerId, const HeartbeatArgs& request, const HeartbeatReply& reply, uint64_t sendTime) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    if (reply.term > m_currentTerm) {
+        becomeFollower(reply.term);
+        return;
+    }
+    if (m_state != RaftState::Leader || m_currentTerm != request.term || !reply.success) {
+        return;
+    }
+    // 对方承认了自己的领导地位，和 AppendEntries 的回复一样计入租约
+    m_ackTime[peerId] = std::max(m_ackTime[peerId], sendTime);
+}
+
 void RaftNode::replicateOneRound(int64_t peerId) {
     // 发送 rpc的时候一定不能持锁，否则很可能产生死锁。
     std::unique_lock<Mutextype> lock(m_mutex);
@@ -222,42 +585,101 @@ void RaftNode::replicateOneRound(int64_t peerId) {
         return;
     }
 
+    // Probe 状态下已经有在途的请求，或者 Replicate 状态下在途请求的窗口已满，暂停发送
+    Progress& progress = m_progress.at(peerId);
+    if (progress.isPaused()) {
+        return;
+    }
+
     // 获取要发送给peer节点的日志条目的索引
     int64_t prevIndex = m_nextIndex[peerId] - 1;
     // 如果对方节点的日志落后太多，直接发送快照进行同步
     if (prevIndex < m_logs.lastSnapshotIndex()) { // 对方日志落后于leader最新的快照就是落后太多
-        // 创建 InstallSnapshot 请求
-        InstallSnapshotArgs request{};
-        // 加载快照
-        Snapshot::ptr snapshot = m_persister->loadSnapshot();
+        // 只取快照的元数据，快照内容按块从文件中读取，内存占用和快照大小无关
+        auto meta = m_persister->latestSnapshot();
+        int64_t size = meta ? m_persister->snapshotSize(*meta) : -1;
         // 如果快照为空，打印错误信息并返回
-        if (!snapshot || snapshot->empty()) {
+        if (!meta || meta->index == 0 || size < 0) {
             SPDLOG_LOGGER_ERROR(Logger, "need non-empty snapshot");
             return;
         }
 
-        SPDLOG_LOGGER_TRACE(Logger, "Node[{}] [firstIndex: {}, commit: {}] send snapshot[index: {}, term: {}] to Node[{}]",
-                            m_id, m_logs.firstIndex(), m_logs.committed(), snapshot->metadata.index, snapshot->metadata.term, peer);
-        
-        // 设置请求参数
-        request.snapshot = std::move(*snapshot);
-        request.term = m_currentTerm;
-        request.leaderId = m_id;
+        SPDLOG_LOGGER_TRACE(Logger, "Node[{}] [firstIndex: {}, commit: {}] send snapshot[index: {}, term: {}, size: {}] to Node[{}]",
+                            m_id, m_logs.firstIndex(), m_logs.committed(), meta->index, meta->term, size, peerId);
+
+        // 同一个快照从上次发送到的位置继续，断线重连之后不用从头开始
+        auto& send = m_snapshotSends[peerId];
+        if (send.first != meta->index) {
+            send = {meta->index, 0};
+        }
+        int64_t offset = send.second;
+        const int64_t term = m_currentTerm;
+        // 快照发送期间不再发送其他请求
+        progress.becomeSnapshot(meta->index);
 
         // 解锁，发送 RPC 请求
         lock.unlock();
 
-        // 发送 InstallSnapshot 请求，并获取响应
-        auto reply = m_peers[peerId]->installSnapshot(request);
+        std::optional<InstallSnapshotReply> reply;
+        InstallSnapshotArgs request{};
+        const uint64_t start = GetCuurentTimeMs();
+        int64_t sent = 0;
+        while (true) {
+            request.term = term;
+            request.leaderId = m_id;
+            request.metadata = *meta;
+            request.offset = offset;
+            auto data = m_persister->readSnapshotChunk(*meta, offset, s_snapshot_chunk_size);
+            if (!data) {
+                SPDLOG_LOGGER_ERROR(Logger, "read snapshot [index: {}, term: {}] at offset {} failed", meta->index, meta->term, offset);
+                reply = std::nullopt;
+                break;
+            }
+            request.data = std::move(*data);
+            request.done = offset + static_cast<int64_t>(request.data.size()) >= size;
+
+            // 限速，平均发送速度不超过 raft.snapshot.rate_limit
+            sent += static_cast<int64_t>(request.data.size());
+            if (s_snapshot_rate_limit) {
+                uint64_t expect = static_cast<uint64_t>(sent) * 1000 / s_snapshot_rate_limit;
+                uint64_t elapsed = GetCuurentTimeMs() - start;
+                if (expect > elapsed) {
+                    co_sleep(expect - elapsed);
+                }
+            }
+
+            // 发送 InstallSnapshot 请求，并获取响应
+            reply = m_peers[peerId]->installSnapshot(request);
+            if (!reply || reply->term != term || reply->done) {
+                break;
+            }
+            // 从 follower 期望的位置继续，follower 的临时文件不完整时从头开始
+            offset = reply->nextOffset <= size ? reply->nextOffset : 0;
+
+            lock.lock();
+            bool changed = m_currentTerm != term || m_state != RaftState::Leader;
+            if (!changed && m_snapshotSends[peerId].first == meta->index) {
+                m_snapshotSends[peerId].second = offset;
+            }
+            lock.unlock();
+            if (changed) {
+                break;
+            }
+        }
+
+        lock.lock();
+        // 无论成功与否都回到 Probe 状态，成功时从快照之后开始探测，失败时重新判断是否需要发送快照
+        if (m_currentTerm == term && m_state == RaftState::Leader) {
+            progress.becomeProbe();
+        }
         if (!reply) {
             return;
         }
-        lock.lock();
 
         SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] receives InstallSnapshotReply {} from Node[{}] after sending InstallSnapshotArgs {} in term {}", m_id, reply->toString(), peerId, request.toString(), m_currentTerm);
         
         // 检测自己的状态是否改变
-        if (m_currentTerm != request.term || m_state != RaftState::Leader) {
+        if (m_currentTerm != term || m_state != RaftState::Leader) {
             // 如果当前节点的任期或状态已经改变，直接返回
             return;
         }
@@ -267,17 +689,27 @@ void RaftNode::replicateOneRound(int64_t peerId) {
             becomeFollower(reply->term, reply->leaderId);
             return;
         }
+        if (!reply->done) {
+            return;
+        }
+        m_snapshotSends.erase(peerId);
 
         // 更新 matchIndex 和 nextIndex
-        if (request.snapshot.metadata.index >m_matchIndex[peerId]) { // 对于<=的情况，后面leader发送日志让follower复制的时候会更新
-            m_matchIndex[peerId] = request.snapshot.metadata.index;
+        if (meta->index > m_matchIndex[peerId]) { // 对于<=的情况，后面leader发送日志让follower复制的时候会更新
+            m_matchIndex[peerId] = meta->index;
         }
-        if (request.snapshot.metadata.index > m_nextIndex[peerId]) {
-            m_nextIndex[peerId] = request.snapshot.metadata.index + 1;
+        if (meta->index >= m_nextIndex[peerId]) {
+            m_nextIndex[peerId] = meta->index + 1;
         }
     } else {
         // 如果对方节点的日志没有落后太多，发送 AppendEntries 请求进行日志复制
-        auto entries = m_logs.entries(m_nextIndex[peer]);
+        // 单个请求的日志字节数受 raft.replication.max_msg_bytes 限制
+        auto entries = m_logs.entries(m_nextIndex[peerId], static_cast<int64_t>(s_max_msg_bytes));
+        // 已经有在途的日志时不再发送空的心跳，在途的请求本身就起到心跳的作用，
+        // 而且以乐观的 nextIndex 发送的心跳可能先于日志到达而被拒绝
+        if (progress.state == ProgressState::Replicate && entries.empty() && progress.inflights.count()) {
+            return;
+        }
         // 创建 AppendEntries 请求
         AppendEntriesArgs request{};
         request.term = m_currentTerm;
@@ -285,83 +717,207 @@ void RaftNode::replicateOneRound(int64_t peerId) {
         request.prevLogIndex = prevIndex;
         request.prevLogTerm = m_logs.term(prevIndex);
         request.leaderCommit = m_logs.committed();
-        request.entries = entries;
+        request.entries = std::move(entries);
+
+        if (progress.state == ProgressState::Replicate) {
+            if (!request.entries.empty()) {
+                // 乐观地推进 nextIndex，不等回复就可以继续发送后面的日志
+                m_nextIndex[peerId] = request.entries.back().index + 1;
+                int64_t bytes = 0;
+                for (const Entry& entry : request.entries) {
+                    bytes += static_cast<int64_t>(entry.data.size());
+                }
+                progress.inflights.add(request.entries.back().index, bytes);
+            }
+        } else {
+            progress.probeSent = true;
+        }
 
+        // 以发送时间作为确认时间，follower 至少在这之后的一个选举超时时间内不会投票给别人
+        uint64_t sendTime = GetCuurentTimeMs();
         lock.unlock();
 
         // 发送 AppendEntries 请求，并获取响应
         auto reply = m_peers[peerId]->appendEntries(request);
-        if (!reply) {
-            return;
-        }
 
         lock.lock();
 
-        SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] receives AppendEntriesReply {} from Node[{}] after sending AppendEntriesArgs {} in term {}", m_id, reply->toString(), peerId, request.toString(), m_currentTerm);
-        
-        // 如果当前节点不再是领导者，直接返回
-        if (m_state != RaftState::Leader) {
+        // 如果当前节点不再是领导者，或者已经进入新的任期，直接返回
+        if (m_state != RaftState::Leader || m_currentTerm != request.term) {
+            return;
+        }
+
+        if (!reply) {
+            // 请求丢失，无法确定在途请求的结果，回到 Probe 状态重新探测；正在发送快照时由快照的结果决定
+            if (progress.state != ProgressState::Snapshot) {
+                becomeProbe(peerId);
+            }
             return;
         }
 
+        SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] receives AppendEntriesReply {} from Node[{}] after sending AppendEntriesArgs {} in term {}", m_id, reply->toString(), peerId, request.toString(), m_currentTerm);
+
         if (reply->term > m_currentTerm) {
             becomeFollower(reply->term, reply->leaderId);
             return;
         }
 
         // 如果收到的任期小于当前节点的任期，忽略这个过期的响应
-        if (reply->ter < m_currentTerm) {
+        if (reply->term < m_currentTerm) {
             return ;
         }
+
+        // 任期相同的回复，无论日志是否匹配，都说明对方承认了自己的领导地位
+        m_ackTime[peerId] = std::max(m_ackTime[peerId], sendTime);
         
-        // 如果日志追加失败，根据 nextIndex 更新 m_nextIndex 和 m_matchIndex
+        // 如果日志追加失败，回到 Probe 状态，根据 nextIndex 更新 m_nextIndex 和 m_matchIndex
         if(!reply->success) {
+            if (request.prevLogIndex < m_matchIndex[peerId]) {
+                // 过期的拒绝，对应的日志已经被确认复制了
+                if (progress.state == ProgressState::Probe) {
+                    progress.probeSent = false;
+                }
+                return;
+            }
+            // 快照发送期间的拒绝是发送快照之前的请求，快照发送完成后会重新探测
+            if (progress.state == ProgressState::Snapshot) {
+                return;
+            }
+            becomeProbe(peerId);
             if (reply->nextIndex) {
-                m_nextIndex[peerId] = reply->nextIndex;
-                m_matchIndex[peerId] = std::min(m_matchIndex[peerId], reply->nextIndex - 1);
+                int64_t next = reply->nextIndex;
+                // 自己也有冲突的任期时，从自己该任期的最后一条日志之后开始匹配，否则跳过对方的整个冲突任期
+                if (reply->conflictTerm > 0) {
+                    int64_t last = m_logs.lastIndexOfTerm(reply->conflictTerm);
+                    if (last > 0) {
+                        next = std::min(last + 1, request.prevLogIndex);
+                    }
+                }
+                m_nextIndex[peerId] = next;
+                m_matchIndex[peerId] = std::min(m_matchIndex[peerId], next - 1);
             }
             return;
         }
 
-        // 如果日志追加成功，更新 m_nextIndex 和 m_matchIndex
-        if (reply-> nextIndex > m_nextIndex[peerId]) {
-            m_nextIndex[peerId] = reply->nextIndex;
+        // 如果日志追加成功，更新 m_matchIndex，释放已经确认的在途请求
+        if (reply->nextIndex - 1 > m_matchIndex[peerId]) {
             m_matchIndex[peerId] = reply->nextIndex - 1;
         }
+        progress.inflights.freeTo(m_matchIndex[peerId]);
+        if (peerId == m_leadTransferee) {
+            m_transferCond.notify_all();
+        }
+        if (progress.state == ProgressState::Probe) {
+            // 探测成功，日志已经匹配，进入 Replicate 状态
+            progress.becomeReplicate();
+            m_nextIndex[peerId] = m_matchIndex[peerId] + 1;
+        } else if (reply->nextIndex > m_nextIndex[peerId]) {
+            m_nextIndex[peerId] = reply->nextIndex;
+        }
 
-        // 最后一条已经复制到 peer 节点的日志条目的索引
-        int64_t lastIndex = m_matchIndex[peerId];
+        maybeCommit();
 
-        // 计算副本数目大于节点数量的一半才提交一个当前任期内的日志
-        int64_t vote = 1;
-        for (auto match : m_matchIndex) {
-            // 如果有节点的最新复制的日志条目索引大于等于 lastIndex，证明这个节点也复制了lastIndex，所以复制lastIndex的副本数加1
-            if (match.second >= lastIndex) {
-                ++vote;
-            }
-            // 如果满足条件，提交日志
-            if (vote > static_cast<int64_t>(m_peers.size() + 1) / 2) {
-                // 只有领导人当前任期里的日志条目可以被提交
-                if (m_logs.maybeCommit(lastIndex, m_currentTerm)) {
-                    m_applyCond.notify_one();
-                }
-            }
+        // 还有没发送的日志并且窗口没满，继续发送，不必等到下一次心跳
+        if (m_nextIndex[peerId] <= m_logs.lastIndex() && !progress.isPaused()) {
+            go [peerId, this] {
+                replicateOneRound(peerId);
+            };
+        }
+    }
+}
+
+void RaftNode::maybeCommit() {
+    // 有投票权的节点已经复制的索引，leader 自己的副本以落盘的索引为准，learner 的副本不计入
+    std::vector<int64_t> matches{m_durableIndex};
+    for (auto& match : m_matchIndex) {
+        if (!m_learners.count(match.first)) {
+            matches.push_back(match.second);
+        }
+    }
+    // 第 quorum 大的索引已经复制到了多数节点上
+    const size_t quorum = static_cast<size_t>(this->quorum());
+    std::nth_element(matches.begin(), matches.begin() + (quorum - 1), matches.end(), std::greater<>());
+    // 只有领导人当前任期里的日志条目可以被提交
+    if (m_logs.maybeCommit(matches[quorum - 1], m_currentTerm)) {
+        m_applyCond.notify_one();
+        // 当前任期的日志提交后，等待中的 ReadIndex 请求可以继续
+        m_readCond.notify_all();
+    }
+}
+
+int64_t RaftNode::quorum() const {
+    const int64_t voters = static_cast<int64_t>(m_peers.size() - m_learners.size()) + 1;
+    return voters / 2 + 1;
+}
+
+bool RaftNode::leaseValid() {
+    // 单节点集群不会有别的 leader
+    if (quorum() == 1) {
+        return true;
+    }
+    // 自己算一票，取第 quorum - 1 新的确认时间作为租约的起点，learner 的确认不计入
+    std::vector<uint64_t> acks;
+    for (auto& ack : m_ackTime) {
+        if (!m_learners.count(ack.first)) {
+            acks.push_back(ack.second);
         }
     }
+    const size_t quorum = static_cast<size_t>(this->quorum());
+    std::nth_element(acks.begin(), acks.begin() + (quorum - 2), acks.end(), std::greater<>());
+    uint64_t start = acks[quorum - 2];
+    if (start == 0 || s_timer_election_base <= s_read_clock_drift) {
+        return false;
+    }
+    return GetCuurentTimeMs() < start + s_timer_election_base - s_read_clock_drift;
+}
+
+void RaftNode::mustWaitPersisted(int64_t ticket) {
+    if (!m_persister->wait(ticket)) {
+        // 任期、投票或者日志没有落盘，回复之后可能投出第二票或者确认不存在的日志，只能停止节点
+        SPDLOG_LOGGER_CRITICAL(Logger, "Node [{}] persist request {} failed, stop the node before replying", m_id, ticket);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void RaftNode::becomeProbe(int64_t peerId) {
+    m_progress.at(peerId).becomeProbe();
+    m_nextIndex[peerId] = m_matchIndex[peerId] + 1;
 }
 
 RequestVoteReply RaftNode::handleRequestVote(RequestVoteArgs request) {
+    // 投票结果落盘之后才能回复；在释放锁之后等待，并发的持久化请求可以合并刷盘
+    int64_t ticket = 0;
+    co_defer_scope {
+        mustWaitPersisted(ticket);
+    };
     std::unique_lock<Mutextype> lock(m_mutex);
 
     RequestVoteReply reply();
     
     co_defer_scope {
-        persist();
+        ticket = persistAsync();
         // 投票后节点的状态
         SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] before processing RequestVoteArgs {} and reply RequestVoteReply {}, state is {}", m_id, request.toString() reply().toString(), toString());
         
     };
 
+    // 开启租约读时，最近收到过 leader 消息的节点在一个选举超时时间内不投票，保证旧 leader 的租约期间不会选出新的 leader
+    if (s_read_lease && !request.leadershipTransfer && m_leaderId != -1 && request.candidateId != m_leaderId
+        && (m_state == RaftState::Leader || GetCuurentTimeMs() < m_lastLeaderContact + s_timer_election_base)) {
+        reply.term = m_currentTerm;
+        reply.leaderId = m_leaderId;
+        reply.voteGranted = false;
+        return reply;
+    }
+
+    // learner 不投票
+    if (m_learner) {
+        reply.term = m_currentTerm;
+        reply.leaderId = m_leaderId;
+        reply.voteGranted = false;
+        return reply;
+    }
+
     // 拒绝给任期小于自己的候选人投票
     if (request.term < m_currentTerm || (request.term == m_currentTerm && m_votedFor != -1 && m_votedFor != request.candidateId)) {
         reply().term = m_currentTerm;
@@ -401,10 +957,43 @@ RequestVoteReply RaftNode::handleRequestVote(RequestVoteArgs request) {
     return reply;
 }
 
+RequestVoteReply RaftNode::handlePreVote(RequestVoteArgs request) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    RequestVoteReply reply{};
+    reply.term = m_currentTerm;
+    reply.leaderId = m_leaderId;
+    reply.voteGranted = false;
+    co_defer_scope {
+        SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] before processing pre vote RequestVoteArgs {} and reply RequestVoteReply {}, state is {}", m_id, request.toString(), reply.toString(), toString());
+    };
+
+    // learner 不投票
+    if (m_learner) {
+        return reply;
+    }
+
+    // 预投票的任期为候选人的下一个任期，不比自己大说明对方的日志或任期已经落后
+    if (request.term <= m_currentTerm) {
+        return reply;
+    }
+    // 自己是 leader，或者在一个选举超时时间内收到过 leader 的消息，说明 leader 还活着，不需要选举
+    if (m_state == RaftState::Leader || (m_leaderId != -1 && GetCuurentTimeMs() < m_lastLeaderContact + s_timer_election_base)) {
+        return reply;
+    }
+    // 和正式投票一样要求对方的日志不比自己旧
+    reply.voteGranted = m_logs.isUpToDate(request.lastLogIndex, request.lastLogTerm);
+    return reply;
+}
+
 /**
  * @brief 处理远端 raft 节点的日志追加请求
  */
 AppendEntriesReply RaftNode::handleAppendEntries(AppendEntriesArgs request) {
+    // 日志落盘之后才能回复；在释放锁之后等待，并发的追加请求可以合并成一次 fdatasync
+    int64_t ticket = 0;
+    co_defer_scope {
+        mustWaitPersisted(ticket);
+    };
     std::unique_lock<Mutextype> lock(m_mutex);
     AppendEntriesReply reply{};
     co_defer_scope {
@@ -417,7 +1006,7 @@ AppendEntriesReply RaftNode::handleAppendEntries(AppendEntriesArgs request) {
             m_logs.commitTo(std::min(request.leaderCommit, ,m_logs.lastIndex()));
             m_applyCond.notify_one();
         }
-        persist();
+        ticket = persistAsync();
         SPDLOG_LOGGER_TRACE(Logger, "Node[{}] before processing AppendEntriesArgs {} and reply AppendEntriesResponse {}, state is {}", m_id, request.toString(), reply.toString(), toString());
     };
     // 拒绝任期小于自己的 leader 的日志复制请求
@@ -430,16 +1019,19 @@ AppendEntriesReply RaftNode::handleAppendEntries(AppendEntriesArgs request) {
 
     // 对方任期大于自己或者自己为同一任期内败选的候选人则转变为 follower
     // 已经是该任期内的follower就不用变
-    if (request.term > m_currentTerm || (request.term == m_currentTerm && m_state == RaftState::Candidate)) {
+    if (request.term > m_currentTerm || (request.term == m_currentTerm && (m_state == RaftState::Candidate || m_state == RaftState::PreCandidate))) {
         becomeFollower(request.term, request.leaderId);
     }
 
     if (m_leaderId < 0) {
         m_leaderId = request.leaderId;
+        publishState();
     }
 
     // 自己为同一任期内的follower，更新选举定时器就行
     rescheduleElection();
+    m_lastLeaderContact = GetCuurentTimeMs();
+    updateLeaderCommit(request.leaderCommit);
     
     // 拒绝错误的日志追加请求
     // 如果对方的prevLogIndex小于快照的最后一个索引，说明对方的日志已经过时了
@@ -461,6 +1053,10 @@ AppendEntriesReply RaftNode::handleAppendEntries(AppendEntriesArgs request) {
         reply.leaderId = m_leaderId;
         reply.success = false;
         reply.nextIndex = conflict;
+        // 带上冲突的任期，leader 可以一次跳过整个任期，而不是逐条回退
+        if (request.prevLogIndex <= m_logs.lastIndex()) {
+            reply.conflictTerm = m_logs.term(request.prevLogIndex);
+        }
         return reply;
     }
 
@@ -475,6 +1071,11 @@ AppendEntriesReply RaftNode::handleAppendEntries(AppendEntriesArgs request) {
  * @brief 处理远端 raft 节点的快照安装请求
  */
 InstallSnapshotReply RaftNode::handleInstallSnapshot(InstallSnapshotArgs request) {
+    // 状态落盘之后才能回复，在释放锁之后等待
+    int64_t ticket = 0;
+    co_defer_scope {
+        mustWaitPersisted(ticket);
+    };
     std::unique_lock<Mutextype> lock(m_mutex);
     InstallSnapshotReply reply{};
     // 在当前协程结束时，执行以下的代码块，打印一些调试信息
@@ -493,19 +1094,21 @@ InstallSnapshotReply RaftNode::handleInstallSnapshot(InstallSnapshotArgs request
 
     // 如果请求的任期小于当前节点的任期，直接返回回复
     if (request.term > m_currentTerm) {
-        becomeFollower(request.term, request.leaderId);
+        ticket = becomeFollower(request.term, request.leaderId);
     }
 
     rescheduleElection();
+    m_lastLeaderContact = GetCuurentTimeMs();
     // 更新回复的领导者ID为当前节点的领导者ID
     reply.leaderId = m_leaderId;
 
-    const int64_t snapIndex = request.snapshot.metadata.index;
-    const int64_t snapTerm = request.snapshot.metadata.term;
+    const int64_t snapIndex = request.metadata.index;
+    const int64_t snapTerm = request.metadata.term;
 
     // 如果快照的索引小于或等于已提交的日志的索引，忽略这个快照
     if (snapIndex <= m_logs.committed()) {
         SPDLOG_LOGGER_DEBUG(Logger,"Node[{}] ignored snapshot [index: {}, term: {}]", m_id, snapIndex, snapTerm);
+        reply.done = true;
         return reply;
     }
 
@@ -514,7 +1117,35 @@ InstallSnapshotReply RaftNode::handleInstallSnapshot(InstallSnapshotArgs request
     if (m_logs.matchLog(snapIndex, snapTerm)) {
         SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] fast-forwarded to snapshot [index: {}, term: {}]", m_id, snapIndex, snapTerm);
         m_logs.commitTo(snapIndex);
-        m_applyChan.notify_one();
+        m_applyCond.notify_one();
+        reply.done = true;
+        return reply;
+    }
+
+    // 这一块数据写入临时文件，写盘期间不持锁
+    lock.unlock();
+    reply.nextOffset = m_persister->receiveSnapshotChunk(request.metadata, request.offset, request.data);
+    Snapshot::ptr snapshot;
+    if (request.done && reply.nextOffset == request.offset + static_cast<int64_t>(request.data.size())) {
+        // 最后一块写完之后，临时文件替换为正式的快照文件，再读出来交给状态机
+        if (m_persister->installSnapshot(request.metadata)) {
+            snapshot = m_persister->loadSnapshot();
+        }
+        if (!snapshot || snapshot->metadata.index != snapIndex) {
+            SPDLOG_LOGGER_ERROR(Logger, "Node[{}] install snapshot [index: {}, term: {}] failed", m_id, snapIndex, snapTerm);
+            snapshot = nullptr;
+            reply.nextOffset = 0;
+        }
+    }
+    lock.lock();
+    reply.term = m_currentTerm;
+    reply.leaderId = m_leaderId;
+    // 写盘期间可能进入了新的任期或者已经提交到了快照之后
+    if (!snapshot || m_currentTerm != request.term) {
+        return reply;
+    }
+    reply.done = true;
+    if (snapIndex <= m_logs.committed()) {
         return reply;
     }
     
@@ -524,67 +1155,407 @@ InstallSnapshotReply RaftNode::handleInstallSnapshot(InstallSnapshotArgs request
     // 如果快照的索引大于日志的最后一个索引，清除所有的日志条目
     // 如果快照中保存的最后一条日志的索引大于当前节点的日志的最后一个索引，这意味着当前节点的日志严重落后，甚至可能丢失了一些日志条目。
     // 在这种情况下，最简单和最有效的方式是清除当前节点的所有日志条目，然后使用快照来更新节点的状态。
-    if (request.snapshot.metadata.index > m_logs.lastIndex()) {
-        m_logs.clearEntries(request.snapshot.metadata.index, request.snapshot.metadata.term);
+    if (snapIndex > m_logs.lastIndex()) {
+        m_logs.clearEntries(snapIndex, snapTerm);
     } else { // 否则，压缩日志到快照的索引
-        m_logs.compact(request.snapshot.metadata.index);
+        m_logs.compact(snapIndex);
     }
     // （上面这段判断逻辑的行为是：如果节点中的日志落后于快照，那么就清空日志，然后使用快照中的数据来更新节点的状态；如果节点中的日志不落后（持平或领先）快照，那么就删除快照之前的日志，然后使用快照中的数据来更新节点的状态。）
     // 创建一个新的协程，将快照发送到应用通道
-    go [snap = request.snapshot, this] {
-        m_applychan << ApplyMsg{snap};
+    go [snapshot, this] {
+        m_applyChan << ApplyMsg{*snapshot};
     };
-    
-    persist(std::make_shared<Snapshot>(std::move(request.snapshot)));
+
+    // 快照文件已经就位，只需要持久化状态
+    ticket = persistAsync();
+    return reply;
+}
+
+ReadIndexReply RaftNode::handleReadIndex(ReadIndexArgs request) {
+    ReadIndexReply reply{};
+    co_defer_scope {
+        SPDLOG_LOGGER_TRACE(Logger, "Node[{}] processes ReadIndexArgs {} and reply ReadIndexReply {}", m_id, request.toString(), reply.toString());
+    };
+    // 只在 leader 上处理，不再转发，避免请求在节点之间来回转发
+    auto index = leaderReadIndex();
+    reply.leaderId = getLeaderId();
+    if (index) {
+        reply.success = true;
+        reply.index = *index;
+    }
+    return reply;
+}
+
+std::optional<int64_t> RaftNode::readIndex() {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    if (m_state == Leader) {
+        lock.unlock();
+        return leaderReadIndex();
+    }
+    auto iter = m_peers.find(m_leaderId);
+    if (iter == m_peers.end()) {
+        return std::nullopt;
+    }
+    auto peer = iter->second;
+    lock.unlock();
+
+    // follower 向 leader 请求索引，之后由调用者等待本地状态机应用到该索引
+    auto reply = peer->readIndex(ReadIndexArgs{.nodeId = m_id});
+    if (!reply || !reply->success) {
+        return std::nullopt;
+    }
+    return reply->index;
+}
+
+bool RaftNode::transferLeadership(int64_t targetId) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    if (m_state != Leader) {
+        return false;
+    }
+    if (targetId == m_id) {
+        return true;
+    }
+    auto iter = m_peers.find(targetId);
+    // learner 不能当选，不能接收领导权
+    if (iter == m_peers.end() || m_learners.count(targetId) || m_leadTransferee != -1) {
+        SPDLOG_LOGGER_WARN(Logger, "Node[{}] can not transfer leadership to Node[{}], transferee is Node[{}]", m_id, targetId, m_leadTransferee);
+        return false;
+    }
+    auto peer = iter->second;
+    const int64_t term = m_currentTerm;
+    // 转移失败时恢复接受提议
+    auto abort = [&] {
+        if (m_state == Leader && m_currentTerm == term) {
+            m_leadTransferee = -1;
+        }
+    };
+    SPDLOG_LOGGER_INFO(Logger, "Node[{}] starts to transfer leadership to Node[{}] in term {}", m_id, targetId, term);
+
+    // 停止接受新的提议，日志不再增长，在一个选举超时时间内让目标节点追上日志
+    m_leadTransferee = targetId;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(s_timer_election_base);
+    while (m_state == Leader && m_currentTerm == term && m_matchIndex[targetId] < m_logs.lastIndex()) {
+        go [targetId, this] {
+            replicateOneRound(targetId);
+        };
+        if (m_transferCond.wait_until(lock, deadline) == std::cv_status::timeout) {
+            break;
+        }
+    }
+    if (m_state != Leader || m_currentTerm != term || m_matchIndex[targetId] < m_logs.lastIndex()) {
+        SPDLOG_LOGGER_WARN(Logger, "Node[{}] aborts transferring leadership to Node[{}], matchIndex: {}, lastIndex: {}", m_id, targetId, m_matchIndex[targetId], m_logs.lastIndex());
+        abort();
+        return false;
+    }
+
+    TimeoutNowArgs request{.term = term, .leaderId = m_id};
+    // 目标节点收到 TimeoutNow 之后会无视租约发起选举，即使回复丢失也可能当选；
+    // 在它的一次选举超时之内都不能使用租约，期间的读请求走 ReadIndex
+    m_leaseBlockedUntil = GetCuurentTimeMs() + s_timer_election_top + s_read_clock_drift;
+    lock.unlock();
+    auto reply = peer->timeoutNow(request);
+    lock.lock();
+    if (!reply || !reply->success) {
+        abort();
+        return false;
+    }
+
+    // 目标节点当选后自己会收到更大的任期而退位；一个选举超时时间后仍然是该任期的 leader，说明目标节点没有当选
+    go [term, this] {
+        co_sleep(s_timer_election_base);
+        std::unique_lock<Mutextype> lock(m_mutex);
+        if (m_state == Leader && m_currentTerm == term && m_leadTransferee != -1) {
+            SPDLOG_LOGGER_WARN(Logger, "Node[{}] is still leader after transferring leadership to Node[{}] in term {}", m_id, m_leadTransferee, term);
+            m_leadTransferee = -1;
+        }
+    };
+    return true;
+}
+
+TimeoutNowReply RaftNode::handleTimeoutNow(TimeoutNowArgs request) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    TimeoutNowReply reply{};
+    reply.term = m_currentTerm;
+    co_defer_scope {
+        SPDLOG_LOGGER_DEBUG(Logger, "Node[{}] processes TimeoutNowArgs {} and reply TimeoutNowReply {}, state is {}", m_id, request.toString(), reply.toString(), toString());
+    };
+
+    // 只响应当前任期的 leader，learner 不发起选举
+    if (request.term != m_currentTerm || m_state == Leader || m_learner) {
+        return reply;
+    }
+    // leader 已经确认自己的日志是最新的，跳过预投票直接发起选举
+    becomeCandidate();
+    startElection(true);
+    reply.success = true;
+    return reply;
+}
+
+TransferLeadershipReply RaftNode::handleTransferLeadership(TransferLeadershipArgs request) {
+    TransferLeadershipReply reply{};
+    co_defer_scope {
+        SPDLOG_LOGGER_INFO(Logger, "Node[{}] processes TransferLeadershipArgs {} and reply TransferLeadershipReply {}", m_id, request.toString(), reply.toString());
+    };
+    reply.success = transferLeadership(request.targetId);
+    reply.leaderId = getLeaderId();
     return reply;
 }
 
+std::pair<int64_t, uint64_t> RaftNode::getLeaderCommit() {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    return {m_leaderCommit, m_lastLeaderContact};
+}
+
+uint64_t RaftNode::getAppliedTime(int64_t applied) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    // 下一条记录的提交索引也被覆盖时，前面的记录不会再被用到，applied 只会前进
+    while (m_commitTimes.size() > 1 && m_commitTimes[1].first <= applied) {
+        m_commitTimes.pop_front();
+    }
+    if (m_commitTimes.empty() || m_commitTimes.front().first > applied) {
+        return 0;
+    }
+    return m_commitTimes.front().second;
+}
+
+void RaftNode::updateLeaderCommit(int64_t commit) {
+    const uint64_t now = GetCuurentTimeMs();
+    m_leaderCommit = std::max(m_leaderCommit, commit);
+    // 提交索引没有前进时只刷新时间：此刻 leader 提交的日志仍然都不超过这个索引
+    if (!m_commitTimes.empty() && m_commitTimes.back().first == m_leaderCommit) {
+        m_commitTimes.back().second = now;
+        return;
+    }
+    m_commitTimes.emplace_back(m_leaderCommit, now);
+    // 本地应用太慢时丢掉最旧的记录，只会让状态显得更旧，不会放过过期的读
+    if (m_commitTimes.size() > MAX_COMMIT_TIMES) {
+        m_commitTimes.pop_front();
+    }
+}
+
+std::optional<int64_t> RaftNode::leaderReadIndex() {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    // leader 在自己的任期内提交过日志之后，才能确定自己的提交索引是最新的
+    while (m_state == Leader && m_logs.term(m_logs.committed()) != m_currentTerm) {
+        m_readCond.wait(lock);
+    }
+    if (m_state != Leader) {
+        return std::nullopt;
+    }
+
+    // 租约有效期内多数节点不会选出新的 leader，直接读本地的提交索引，不需要网络往返
+    // 转移领导权时目标节点会无视租约发起选举，租约不再可靠；发出 TimeoutNow 之后的一个选举超时时间内同样不可靠
+    if (s_read_lease && m_leadTransferee == -1 && GetCuurentTimeMs() >= m_leaseBlockedUntil && leaseValid()) {
+        return m_logs.committed();
+    }
+
+    // 加入还没有开始确认的一轮，没有的话新建一轮
+    if (!m_pendingRead) {
+        m_pendingRead = std::make_shared<ReadBatch>();
+        m_pendingRead->term = m_currentTerm;
+        go [batch = m_pendingRead, this] {
+            confirmLeadership(batch);
+        };
+    }
+    auto batch = m_pendingRead;
+    // 读请求到达时的提交索引都要被包含在内
+    batch->index = std::max(batch->index, m_logs.committed());
+
+    while (!batch->done) {
+        m_readCond.wait(lock);
+    }
+    if (!batch->ok) {
+        return std::nullopt;
+    }
+    return batch->index;
+}
+
+void RaftNode::confirmLeadership(std::shared_ptr<ReadBatch> batch) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    // 这一轮开始确认，之后到达的读请求加入下一轮
+    if (m_pendingRead == batch) {
+        m_pendingRead = nullptr;
+    }
+    if (m_state != Leader || m_currentTerm != batch->term) {
+        batch->done = true;
+        m_readCond.notify_all();
+        return;
+    }
+
+    // 向每个节点发送一次精简心跳：只要任期相同对方就会承认，和日志是否匹配无关；
+    // 带日志位置的 AppendEntries 遇到快照比 leader 记录的匹配位置更新的 follower 会被当作无效请求，确认不了领导地位
+    std::vector<std::tuple<int64_t, RaftPeer::ptr, HeartbeatArgs>> requests;
+    for (auto& peer : m_peers) {
+        // learner 的确认不能证明领导地位
+        if (m_learners.count(peer.first)) {
+            continue;
+        }
+        // 提交索引不超过对方已经匹配的索引，和 tickHeartbeat 一样，对方不用检查日志就可以直接提交
+        requests.emplace_back(peer.first, peer.second, HeartbeatArgs{.group = m_group, .term = m_currentTerm, .leaderId = m_id,
+                                                        .commit = std::min(m_matchIndex[peer.first], m_logs.committed())});
+    }
+    const int64_t quorum = this->quorum();
+    lock.unlock();
+
+    // 自己算一票，收到多数节点承认当前任期的回复后就可以确认领导地位
+    int64_t acks = 1;
+    co::co_chan<bool> results(requests.size());
+    for (auto& [id, peer, args] : requests) {
+        go [id = id, peer = peer, args = args, results, this] {
+            const uint64_t sendTime = GetCuurentTimeMs();
+            auto reply = peer->heartbeats(HeartbeatsArgs{.from = m_id, .heartbeats = {args}});
+            if (!reply || reply->replies.size() != 1) {
+                results << false;
+                return;
+            }
+            // 更大的任期让自己下台，确认也计入租约
+            handleHeartbeatReply(id, args, reply->replies.front(), sendTime);
+            results << (reply->replies.front().success && reply->replies.front().term == args.term);
+        };
+    }
+    for (size_t i = 0; i < requests.size() && acks < quorum; ++i) {
+        bool ack = false;
+        results >> ack;
+        if (ack) {
+            ++acks;
+        }
+    }
+
+    lock.lock();
+    batch->ok = acks >= quorum && m_state == Leader && m_currentTerm == batch->term;
+    batch->done = true;
+    SPDLOG_LOGGER_TRACE(Logger, "Node[{}] confirms leadership for read index {} with {} acks, ok: {}", m_id, batch->index, acks, batch->ok);
+    m_readCond.notify_all();
+}
+
 void RaftNode::addPeer(int64_t id, Address::ptr address) {
     // 创建一个新的 RaftPeer 对象，使用给定的 id 和 address
-    RaftPeer::ptr peer = std::make_shared<RaftPeer>(id, address);
+    addPeer(id, std::make_shared<RaftPeer>(id, address));
+}
+
+void RaftNode::addPeer(int64_t id, RaftPeer::ptr peer) {
+    // 单组部署时合并的心跳也通过这个节点的连接发送，multi-raft 的目标节点由宿主添加
+    if (m_host == this) {
+        m_coalescer->addNode(id, peer);
+    }
     m_peers[id] = peer;
+    m_replicateChans.emplace(id, co::co_chan<bool>(1));
     m_nextIndex[id] = 0;
     m_matchIndex[id] = 0;
-    SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] add peer [{}], address is {}", m_id, id, address->toString());
+    m_progress.insert_or_assign(id, Progress(s_max_inflight, static_cast<int64_t>(s_max_inflight_bytes)));
+    SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] group [{}] add peer [{}], address is {}", m_id, m_group, id, peer->getAddress()->toString());
+}
+
+void RaftNode::addLearner(int64_t id, Address::ptr address) {
+    addPeer(id, address);
+    m_learners.insert(id);
+    SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] add learner [{}], address is {}", m_id, id, address->toString());
+}
+
+bool RaftNode::promoteLearner(int64_t id) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    if (id == m_id) {
+        if (!m_learner) {
+            return false;
+        }
+        m_learner = false;
+        SPDLOG_LOGGER_INFO(Logger, "Node [{}] is promoted from learner to voter", m_id);
+        return true;
+    }
+    if (!m_learners.count(id)) {
+        return false;
+    }
+    // 日志还落后的 learner 成为投票节点后会拖慢提交，leader 上等它追上之后再提升
+    if (m_state == Leader && m_matchIndex[id] < m_logs.committed()) {
+        SPDLOG_LOGGER_INFO(Logger, "Node [{}] can not promote learner [{}] yet, matchIndex: {}, committed: {}", m_id, id, m_matchIndex[id], m_logs.committed());
+        return false;
+    }
+    m_learners.erase(id);
+    SPDLOG_LOGGER_INFO(Logger, "Node [{}] promotes learner [{}] to voter", m_id, id);
+    return true;
+}
+
+bool RaftNode::isLearner(int64_t id) {
+    std::unique_lock<Mutextype> lock(m_mutex);
+    return id == m_id ? m_learner : m_learners.count(id) > 0;
 }
 
 bool RaftNode::isLeader() {
+    return static_cast<RaftState>(m_stateWord.load(std::memory_order_acquire) & 0x3) == RaftState::Leader;
+}
+
+std::map<int64_t, ProgressStatus> RaftNode::getProgress() {
     std::unique_lock<Mutextype> lock(m_mutex);
-    return m_state == RaftState::Leader;
+    std::map<int64_t, ProgressStatus> status;
+    if (m_state != RaftState::Leader) {
+        return status;
+    }
+    const int64_t last = m_logs.lastIndex();
+    for (auto& [id, progress] : m_progress) {
+        status[id] = ProgressStatus{.state = progress.state,
+                                    .matchIndex = m_matchIndex[id],
+                                    .nextIndex = m_nextIndex[id],
+                                    .lag = last - m_matchIndex[id],
+                                    .inflight = progress.inflights.count(),
+                                    .inflightBytes = progress.inflights.bytes(),
+                                    .lastAck = m_ackTime[id]};
+    }
+    return status;
 }
 
 std::pair<int64_t, bool> RaftNode::getState() {
-    std::unique_lock<Mutextype> lock(m_mutex);
-    return {m_currentTerm, m_state == RaftState::Leader};
+    // 任期和状态在同一个原子变量里，读到的一定是同一时刻的值
+    uint64_t word = m_stateWord.load(std::memory_order_acquire);
+    return {static_cast<int64_t>(word >> 2), static_cast<RaftState>(word & 0x3) == RaftState::Leader};
+}
+
+void RaftNode::publishState() {
+    m_stateWord.store(static_cast<uint64_t>(m_currentTerm) << 2 | static_cast<uint64_t>(m_state), std::memory_order_release);
+    m_leaderHint.store(m_leaderId, std::memory_order_release);
 }
 
 std::string RaftNode::toString() {
     // 用于将节点状态映射为字符串
-    std::map<RaftState, std::string> mp{{Follower, "Follower"}, {Candidate, "Candidate"}, {Leader, "Leader"}};
+    std::map<RaftState, std::string> mp{{Follower, "Follower"}, {PreCandidate, "PreCandidate"}, {Candidate, "Candidate"}, {Leader, "Leader"}};
     std::string str = fmt.format("Id: {}, State: {}, LeaderId: {}, CurrentTerm: {}, VotedFor: {}, CommitIndex: {}, LastApplied: {}", m_id, mp[m_state], m_leaderId, m_currentTerm, m_votedFor, m_logs.committed(), m_logs.applied());
+    if (s_read_lease && m_state == Leader) {
+        str += fmt::format(", LeaseValid: {}", leaseValid());
+    }
     return "{" + str + "}";
 }
 
-void RaftNode::becomeFollower(int64_t term, int64_t leaderId) {
-    // 如果当前节点是领导者，则先停止心跳定时器
-    if (m_heartbeatTimer && m_state == Leader) {
-        m_heartbeatTimer.stop();
-    }
-
+int64_t RaftNode::becomeFollower(int64_t term, int64_t leaderId) {
+    // 不再是 leader 之后心跳合并器不会再为这个组发送心跳
     m_state = Follower;
     m_currentTerm = term;
     m_votedFor = -1;
     m_leaderId = leaderId;
-    // 持久化当前节点的状态
-    persist();
+    publishState();
+    // 不再是 leader，唤醒等待中的 ReadIndex 请求让它们失败返回
+    m_readCond.notify_all();
+    // 领导权转移结束
+    m_leadTransferee = -1;
+    m_transferCond.notify_all();
+    // 提交持久化请求，不持锁等待落盘；回复 rpc 之前调用者在释放锁之后等待落盘
+    int64_t ticket = persistAsync();
     SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] become follower at term {}, state is {}", m_id, m_currentTerm, toString());
+    return ticket;
 }
+void RaftNode::becomePreCandidate() {
+    // 预投票不改变任期和投票，也就不需要持久化
+    m_state = PreCandidate;
+    m_leaderId = -1;
+    publishState();
+    SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] become pre candidate at term {}, state is {}", m_id, m_currentTerm, toString());
+}
+
 void RaftNode::becomeCandidate() {
     m_state = Candidate;
     ++m_currentTerm;
     m_votedFor = m_id;
     m_leaderId = -1;
-    persist();
+    publishState();
+    // 任期和投票由紧接着的 startElection 提交持久化，并在发出投票请求之前等待落盘
     SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] become candidate at term {}, state is{}", m_id, m_currentTerm, toString());
 }
 
@@ -595,6 +1566,7 @@ void RaftNode::becomeLeader() {
     }
     m_state = Leader;
     m_leaderId = m_id;
+    publishState();
     // 成为领导者后，领导者并不知道其它节点的日志情况，因此与其它节点需要同步那么日志，领导者并不知道集群其他节点状态，
     // 因此他选择了不断尝试。nextIndex、matchIndex 分别用来保存其他节点的下一个待同步日志index、已匹配的日志index。
     // nextIndex初始化值为lastIndex+1，即领导者最后一个日志序号+1，因此其实这个日志序号是不存在的，显然领导者也不
@@ -603,21 +1575,49 @@ void RaftNode::becomeLeader() {
     for (auto& peer : m_peers) {
         m_nextIndex[peer.first] = m_logs.lastIndex() + 1;
         m_matchIndex[peer.first] = 0;
+        // 新任期还没有收到任何确认，租约无效
+        m_ackTime[peer.first] = 0;
+        // 先逐个探测 follower 的日志，匹配之后再流水线式地复制
+        m_progress.insert_or_assign(peer.first, Progress(s_max_inflight, static_cast<int64_t>(s_max_inflight_bytes)));
     }
 
-    persist();
+    // 追加一条当前任期的空日志，提交它的同时提交之前任期的日志，ReadIndex 也依赖它确认最新的提交索引
+    Propose("");
+    // 不持锁等待落盘，落盘之后 leader 自己才算作这些日志的一个副本；之后的日志由提议的攒批协程在落盘后推进
+    m_durableIndex = 0;
+    go [ticket = persistAsync(), term = m_currentTerm, index = m_logs.lastIndex(), this] {
+        // 心跳已经宣告了领导地位，空日志也会发给 follower，落盘失败时不能继续当 leader，停止节点
+        mustWaitPersisted(ticket);
+        std::unique_lock<Mutextype> lock(m_mutex);
+        if (m_state == Leader && m_currentTerm == term && index > m_durableIndex) {
+            m_durableIndex = index;
+            maybeCommit();
+        }
+    };
+    // 立即宣告领导地位，之后由心跳合并器周期性地发送心跳
+    broadcastHeartbeat();
     SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] become leader at term {}, state is {}", m_id, m_currentTerm, toString());
 }
 
 void RaftNode::rescheduleElection() {
-    // 停止当前的选举定时器
-    m_electionTimer.stop();
-    // 重新设置选举定时器，定时器的超时时间是一个随机的选举超时时间
-    m_electionTimer = CycleTimer(GetRandomizedElectionTimeout(), [this] {
+    // 每次收到 leader 的消息都会重置，定时器还在时间轮上时只需要以新的随机超时时间重新计时，O(1)
+    if (m_electionTimer) {
+        m_electionTimer.reset(GetRandomizedElectionTimeout());
+        return;
+    }
+    // 成为 leader 时停止了选举定时器，重新创建，定时器的超时时间是一个随机的选举超时时间
+    m_electionTimer = TimerWheel::GetInstance().addTimer(GetRandomizedElectionTimeout(), [this] {
         std::unique_lock<Mutextype> lock(m_mutex);
         // 如果当前节点的状态不是领导者，那么将其状态变为候选者，并开始新的选举
         // 如果当前节点是领导者，则无需进行选举
-        if (m_state != RaftState::Leader) {
+        // learner 只接收日志，不发起选举
+        if (m_state != RaftState::Leader && !m_learner) {
+            // 开启预投票时先确认能够赢得选举，再增加任期，失败的预投票不会打断现有的 leader
+            if (s_pre_vote) {
+                becomePreCandidate();
+                startPreVote();
+                return;
+            }
             // 如果当前节点的状态不是领导者，那么将其状态变为候选者，并开始新的选举
             becomeCandidate();
             // 开始新的选举，这是一个异步操作，不会阻塞选举定时器
@@ -626,16 +1626,6 @@ void RaftNode::rescheduleElection() {
     });
 }
 
-void RaftNode::resetHeartbeatTimer() {
-    m_heartbeatTimer.stop();
-    m_heartbeatTimer = CycleTimer(GetRandomizedElectionTimeout(), [this] {
-        std::unique_lock<Mutextype> lock(m_mutex);
-        if (m_state == RaftState::Leader) {
-            broadcastHeartbeat();
-        }
-    });
-}
-
 static uint64_t RaftNode::GetStableHeartbeatTimeout() {
     return s_timer_heartbeat;
 }
@@ -646,24 +1636,38 @@ static uint64_t RaftNode::GetRandomizedElectionTimeout() {
     return dist(engine);
 }
 
-void RaftNode::persist(Snapshot::ptr snap) {
+int64_t RaftNode::persistAsync(Snapshot::ptr snap) {
     HardState hs{};
     hs.vote = m_votedFor;
     hs.term = m_currentTerm;
     hs.commit = m_logs.committed();
-    m_persister->persist(hs, m_logs.allEntries(), snap);
+    // 只持久化新追加的日志，持久化的开销和追加的日志量成正比，而不是和日志总量成正比
+    // 持久化请求按提交顺序落盘，提交之后就可以认为这些日志不再需要重复提交
+    auto entries = m_logs.unstableEntries();
+    m_logs.stableTo(m_logs.lastIndex());
+    return m_persister->submit(hs, std::move(entries), std::move(snap));
 }
 
 void RaftNode::persistStateAndSnapshot(int64_t index, const std::string& snap) {
+    // 持锁之前压缩，快照文件和发送给 follower 的都是压缩后的数据
+    std::string compressed;
+    Codec codec = MaybeCompress(snap, compressed);
+
     std::unique_lock<Mutextype> lock(m_mutex);
 
     // 创建一个快照，快照的创建基于给定的索引和快照数据
-    auto snapshot = m_logs.createSnapshot(index, snap);
+    auto snapshot = m_logs.createSnapshot(index, codec == Codec::None ? snap : compressed);
 
     if (snapshot) {
+        snapshot->codec = codec;
         m_logs.compact(snapshot->metadata.index);
         SPDLOG_LOGGER_DEBUG(Logger, "starts to restore snapshot [index: {}, term:{}]", snapshot->metadata.index, snapshot->metadata.term);
-        persist(snapshot);
+        int64_t ticket = persistAsync(snapshot);
+        // 快照写盘期间不持锁，不阻塞日志复制和提交
+        lock.unlock();
+        if (!m_persister->wait(ticket)) {
+            SPDLOG_LOGGER_ERROR(Logger, "Node [{}] persist snapshot [index: {}, term: {}] failed", m_id, snapshot->metadata.index, snapshot->metadata.term);
+        }
     }
 }
 
@@ -672,13 +1676,113 @@ void RaftNode::persistSnapshot(Snapshot::ptr snap) {
     if (snap) {
         m_logs.compact(snap->metadata.index);
         SPDLOG_LOGGER_DEBUG(Logger, "starts to restore snapshot [index: {}, term:{}]", snap->metadata.index, snap->metadata.term);
-        persist(snap);
+        int64_t ticket = persistAsync(snap);
+        // 快照写盘期间不持锁
+        lock.unlock();
+        if (!m_persister->wait(ticket)) {
+            SPDLOG_LOGGER_ERROR(Logger, "Node [{}] persist snapshot [index: {}, term: {}] failed", m_id, snap->metadata.index, snap->metadata.term);
+        }
     }
 }
 
 std::optional<Entry> RaftNode::propose(const std::string& data) {
-    std::unique_lock<Mutextype> lock(m_mutex);
-    return Propose(data);
+    if (!isLeader()) {
+        return std::nullopt;
+    }
+    // 交给攒批协程，和并发的提议一起追加、落盘
+    auto request = std::make_shared<ProposeRequest>();
+    // 在调用者的协程里压缩，之后日志在内存、WAL 和网络中都只保存压缩后的数据
+    request->codec = MaybeCompress(data, request->data);
+    if (request->codec == Codec::None) {
+        request->data = data;
+    }
+    if (!m_proposeChan.push(request)) {
+        return std::nullopt;
+    }
+    std::optional<Entry> entry;
+    if (!request->done.pop(entry)) {
+        return std::nullopt;
+    }
+    return entry;
+}
+
+void RaftNode::proposer() {
+    std::shared_ptr<ProposeRequest> request;
+    while (m_proposeChan.pop(request)) {
+        std::vector<std::shared_ptr<ProposeRequest>> batch;
+        batch.push_back(std::move(request));
+        // 先取走已经在排队的提议，不够一批时最多再等 linger 毫秒
+        const size_t batchSize = std::max<uint32_t>(s_propose_batch_size, 1);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(s_propose_linger);
+        while (batch.size() < batchSize) {
+            if (m_proposeChan.TryPop(request)) {
+                batch.push_back(std::move(request));
+                continue;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline || !m_proposeChan.TimedPop(request, deadline - now)) {
+                break;
+            }
+            batch.push_back(std::move(request));
+        }
+
+        std::unique_lock<Mutextype> lock(m_mutex);
+        std::vector<Entry> entries;
+        if (m_state == Leader && m_leadTransferee != -1) {
+            SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] is transferring leadership to Node [{}], dropping {} proposals", m_id, m_leadTransferee, batch.size());
+        } else if (m_state == Leader) {
+            entries.reserve(batch.size());
+            for (auto& r : batch) {
+                entries.push_back(Entry{.index = m_logs.lastIndex() + 1 + static_cast<int64_t>(entries.size()), .term = m_currentTerm, .data = std::move(r->data), .codec = r->codec});
+            }
+            // 一次追加整批日志，一次持久化
+            m_logs.append(entries);
+        } else {
+            SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] no leader at term {}, dropping {} proposals", m_id, m_currentTerm, batch.size());
+        }
+        int64_t ticket = entries.empty() ? 0 : persistAsync();
+        const int64_t term = m_currentTerm;
+        lock.unlock();
+
+        if (!entries.empty()) {
+            // 不等本地落盘就唤醒复制协程发送新的日志，本地写盘和 follower 的网络往返、写盘同时进行
+            triggerReplication();
+        }
+        // 释放锁后等待落盘；日志可能已经发给了 follower，落盘失败时不能只让提议失败，和其他持久化失败一样停止节点
+        if (!entries.empty()) {
+            mustWaitPersisted(ticket);
+        }
+        const bool ok = !entries.empty();
+        if (!entries.empty()) {
+            SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] appends a batch of {} entries [{} - {}], persisted: {}", m_id, entries.size(), entries.front().index, entries.back().index, ok);
+            ++m_proposeBatches;
+            m_proposedEntries += entries.size();
+        }
+        const int64_t last = entries.empty() ? 0 : entries.back().index;
+        // 先通知调用者再推进提交，调用者拿到索引之前日志不会因为这一批的落盘而提交
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (ok) {
+                entries[i].data.clear();
+                batch[i]->done << std::optional<Entry>(std::move(entries[i]));
+            } else {
+                batch[i]->done << std::optional<Entry>();
+            }
+        }
+        if (ok) {
+            lock.lock();
+            // 落盘之后 leader 自己才算作这批日志的一个副本
+            if (m_state == Leader && m_currentTerm == term && last > m_durableIndex) {
+                m_durableIndex = last;
+                maybeCommit();
+            }
+            lock.unlock();
+        }
+    }
+}
+
+double RaftNode::getAverageProposeBatchSize() const {
+    uint64_t batches = m_proposeBatches;
+    return batches ? static_cast<double>(m_proposedEntries) / batches : 0;
 }
 
 std::optional<Entry> RaftNode::Propose(const std::string& data) {
@@ -693,10 +1797,8 @@ std::optional<Entry> RaftNode::Propose(const std::string& data) {
     entry.index = m_logs.lastIndex() +1;
     entry.data = data;
     
-    // 将新的日志条目添加到日志中
+    // 将新的日志条目添加到日志中，由调用者负责持久化和广播
     m_logs.append(entry);
-    // 广播心跳消息，通知其他节点有新的日志条目
-    broadcastHeartbeat();
     // 打印一条调试信息，包含新日志条目的索引和任期
     SPDLOG_LOGGER_DEBUG(Logger, "Node [{}] receives a new log entry [index: {}, term: {}]", m_id, entry.index, entry.term);
     return entry;
@@ -6,15 +6,21 @@
 #define RR_RAFT_RAFT_NODE_H
 
 #include <string>
+#include <atomic>
 #include <map>
+#include <deque>
+#include <set>
 #include <cstdint>
 #include <vector>
 #include "RaftRegistry/rpc/rpc_server.h"
+#include "RaftRegistry/common/timer_wheel.h"
 #include "entry.h"
 #include "snapshot.h"
 #include "RaftRegistry/rpc/serializer.h"
 #include "raft_peer.h"
 #include "raft_log.h"
+#include "progress.h"
+#include "heartbeat.h"
 
 namespace RR::raft {
 using namespace RR::rpc;
@@ -24,6 +30,8 @@ using namespace RR::rpc;
  */
 enum RaftState {
     Follower,
+    // 正在进行预投票，任期还没有增加
+    PreCandidate,
     Candidate,
     Leader
 };
@@ -32,11 +40,14 @@ enum RaftState {
 struct ApplyMsg {
     enum MsgType {
         ENTRY,
-        SNAPSHOT
+        SNAPSHOT,
+        // 一段连续的已提交日志，index 和 term 为最后一条日志的索引和任期
+        ENTRIES
     };
 
     ApplyMsg() = default;
     explicit ApplyMsg(const Entry& entry) : type(ENTRY), data(entry.data), index(entry.index), term(entry.term) {}
+    explicit ApplyMsg(std::vector<Entry> ents) : type(ENTRIES), index(ents.back().index), term(ents.back().term), entries(std::move(ents)) {}
     explicit ApplyMsg(const Snapshot& snap) : type(SNAPSHOT), data(snap.data), index(snap.metadata.index), term(snap.metadata.term) {}
 
     /**
@@ -47,7 +58,7 @@ struct ApplyMsg {
      */
     template <typename T>
     T as() {
-        rpc::Serializer serializer(data);
+        rpc::Serializer serializer(data.data(), static_cast<int>(data.size()));
         T t;
         serializer >> t;
         return t;
@@ -63,6 +74,9 @@ struct ApplyMsg {
             case SNAPSHOT:
                 typeStr = "SNAPSHOT";
                 break;
+            case ENTRIES:
+                typeStr = fmt::format("ENTRIES({})", entries.size());
+                break;
             default:
                 typeStr = "UNEXPECTED";
                 break;
@@ -72,9 +86,12 @@ struct ApplyMsg {
     }
 
     MsgType type = ENTRY;
-    std::string data{};
+    // ENTRY 消息和日志共享数据，SNAPSHOT 消息为快照数据
+    Payload data{};
     int64_t index{};
     int64_t term{};
+    // ENTRIES 消息中的日志
+    std::vector<Entry> entries{};
 }
 
 /**
@@ -94,6 +111,15 @@ public:
      */
     RaftNode(std::map<int64_t, std::string>& servers, int64_t id, Persister::ptr persister, co::co_chan<ApplyMsg> applyChan);
 
+    /**
+     * @brief 创建一个寄宿在共享 rpc 服务器上的 raft 组，用于一个进程运行多个 raft 组（multi-raft）
+     * @param host 共享的 rpc 服务器，方法以 GroupMethod(name, group) 注册在上面，由宿主负责绑定和启动
+     * @param group 组号，同一个组在所有节点上的组号相同
+     * @param peers 其他节点，和同一节点上的其他组共享连接
+     * @param coalescer 宿主上所有组共享的心跳合并器，由宿主负责启动
+     */
+    RaftNode(rpc::RpcServer* host, int64_t group, const std::map<int64_t, RaftPeer::ptr>& peers, int64_t id, Persister::ptr persister, co::co_chan<ApplyMsg> applyChan, HeartbeatCoalescer::ptr coalescer);
+
     ~RaftNode();
 
     /**
@@ -119,7 +145,34 @@ public:
     void addPeer(int64_t id, Address::ptr address);
 
     /**
-     * @brief 返回当前节点是否是leader
+     * @brief 增加raft节点，使用已经创建好的 RaftPeer
+     */
+    void addPeer(int64_t id, RaftPeer::ptr peer);
+
+    /**
+     * @brief 增加一个 learner 节点
+     *
+     * @details learner 接收日志和快照的复制，可以提供有界陈旧读，但是不参与投票，也不计入提交和选举的多数派，
+     *          增加 learner 不会增加提交的延迟。节点启动时 raft.learners 中的节点会作为 learner 加入
+     */
+    void addLearner(int64_t id, Address::ptr address);
+
+    /**
+     * @brief 把 learner 提升为有投票权的节点
+     *
+     * @details 成员关系是每个节点本地的静态配置，需要在所有节点上执行；
+     *          leader 上只有 learner 的日志追上了提交索引才允许提升
+     * @return 节点不是 learner 或者日志还没有追上时返回 false
+     */
+    bool promoteLearner(int64_t id);
+
+    /**
+     * @brief 节点是否是 learner，id 为自己时返回自己是否是 learner
+     */
+    bool isLearner(int64_t id);
+
+    /**
+     * @brief 返回当前节点是否是leader，不加锁
      * 
      * @return true 当前节点是leader
      * @return false 当前节点不是leader
@@ -127,39 +180,112 @@ public:
     bool isLeader();
 
     /**
-     * @brief 获取当前节点状态
+     * @brief 获取当前节点状态，不加锁，状态机每应用一条日志都会调用
      * 
      * @return currentTerm 任期，isLeader 是否为 leader
      */
     std::pair<int64_t, bool> getState();
 
+    /**
+     * @brief 获取 leader 上每个 follower 的复制状态和落后的日志条数，用于监控慢节点
+     *
+     * @return 不是 leader 时返回空
+     */
+    std::map<int64_t, ProgressStatus> getProgress();
+
     /**
      * @brief 获取当前节点的leader id
      * 
      * @return int64_t 
      */
-    int64_t getLeaderId() const { return m_leaderId;}
+    int64_t getLeaderId() const { return m_leaderHint.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 获取所属的 raft 组号，单组部署时为0
+     */
+    int64_t getGroup() const { return m_group; }
 
     /**
-     * @brief 发起一条消息
+     * @brief 获取处理该节点 rpc 请求的服务器，单组部署时为自己
+     */
+    rpc::RpcServer* getServer() const { return m_host; }
+
+    /**
+     * @brief 发起一条消息，日志落盘后才返回
+     *
+     * @details 并发的提议由攒批协程合并成一次追加和一次落盘，每个调用者得到自己的索引和任期。
+     *          开启 raft.compression.enable 时数据在这里压缩一次，应用到状态机之前才解压
      * @return 如果该节点不是 Leader 返回 std::nullopt
      */
     std::optional<Entry> propose(const std::string& data);
 
     template <typename T>
     std::optional<Entry> propose(const T& data) {
-        std::unique_lock<Mutextype> lock(m_mutex);
         rpc::Serializer s;
         s << data;
         s.reset();
-        return Propose(s.toString());
+        return propose(s.toString());
     }
 
+    /**
+     * @brief 状态机应用完 index 及之前的日志后调用，推进 applied
+     */
+    void appliedTo(int64_t index);
+
+    /**
+     * @brief 平均每批合并了多少条提议
+     */
+    double getAverageProposeBatchSize() const;
+
+    /**
+     * @brief ReadIndex 线性一致性读，读请求不写入日志
+     * 
+     * @details leader 记录当前的提交索引，通过一轮心跳向多数节点确认自己仍然是 leader。
+     *          并发的读请求合并到同一轮确认中。开启 raft.read.lease 时，租约有效期内直接返回提交索引。
+     *          follower 通过 READ_INDEX rpc 向 leader 请求索引，之后在本地读取。
+     *          调用者需要等待状态机应用到返回的索引之后再读取
+     * @return 可以安全读取的索引，如果不知道 leader 或者确认失败返回 std::nullopt
+     */
+    std::optional<int64_t> readIndex();
+
+    /**
+     * @brief 把领导权转移给 targetId，用于滚动重启时避免等待选举超时
+     *
+     * @details leader 停止接受新的提议，通过 replicateOneRound 让目标节点追上日志，
+     *          然后发送 TimeoutNow 让目标节点跳过选举超时和预投票立即发起选举。
+     *          目标节点在一个选举超时时间内没有追上日志，或者发起选举后没有当选，leader 恢复接受提议
+     * @return 目标节点是否已经发起选举；自己不是 leader、目标节点不存在或者已经有进行中的转移时返回 false
+     */
+    bool transferLeadership(int64_t targetId);
+
+    /**
+     * @brief 获取 follower 最近一次从 leader 得知的提交索引，以及收到该消息的时间(ms)
+     *
+     * @details 用于有界陈旧读，估计本地状态落后于 leader 的程度；还没有收到过 leader 的消息时时间为 0
+     */
+    std::pair<int64_t, uint64_t> getLeaderCommit();
+
+    /**
+     * @brief 获取应用到 applied 的状态最后一次是最新的时间(ms)
+     *
+     * @details 即最近一次从 leader 得知的提交索引不超过 applied 的时间，此时 leader 提交的日志都已经被应用；
+     *          用于按时间限制有界陈旧读，还不知道时返回 0。applied 需要单调递增
+     */
+    uint64_t getAppliedTime(int64_t applied);
+
     /**
      * @brief 处理远端 raft 节点的投票请求
      */
     RequestVoteReply handleRequestVote(RequestVoteArgs request);
 
+    /**
+     * @brief 处理远端 raft 节点的预投票请求
+     *
+     * @details 只判断如果对方发起选举自己是否会投票，不改变任期、不记录投票、不持久化；
+     *          在一个选举超时时间内收到过 leader 消息的节点拒绝预投票
+     */
+    RequestVoteReply handlePreVote(RequestVoteArgs request);
+
     /**
      * @brief 处理远端 raft 节点的日志追加请求
      */
@@ -170,6 +296,41 @@ public:
      */
     InstallSnapshotReply handleInstallSnapshot(InstallSnapshotArgs request);
 
+    /**
+     * @brief 处理 follower 的 ReadIndex 请求
+     */
+    ReadIndexReply handleReadIndex(ReadIndexArgs request);
+
+    /**
+     * @brief 处理 leader 转移领导权时的 TimeoutNow 请求，立即发起选举
+     */
+    TimeoutNowReply handleTimeoutNow(TimeoutNowArgs request);
+
+    /**
+     * @brief 处理管理员的领导权转移请求
+     */
+    TransferLeadershipReply handleTransferLeadership(TransferLeadershipArgs request);
+
+    /**
+     * @brief leader 的一次心跳，由心跳合并器每个心跳周期调用一次
+     *
+     * @details 日志已经追上、没有在途请求的节点只需要精简心跳，放入 out 由合并器按目标节点合并发送；
+     *          其他节点仍然通过 replicateOneRound 发送完整的 AppendEntries。关闭 raft.heartbeat.coalesce 时全部走后者
+     * @param out key 为目标节点 id
+     */
+    void tickHeartbeat(std::map<int64_t, std::vector<HeartbeatArgs>>& out);
+
+    /**
+     * @brief 处理 leader 的精简心跳，和空的 AppendEntries 一样重置选举定时器并推进提交索引
+     */
+    HeartbeatReply handleHeartbeat(const HeartbeatArgs& request);
+
+    /**
+     * @brief 处理精简心跳的回复，更新租约的确认时间
+     * @param sendTime 心跳的发送时间
+     */
+    void handleHeartbeatReply(int64_t peerId, const HeartbeatArgs& request, const HeartbeatReply& reply, uint64_t sendTime);
+
     /**
      * @brief 获取节点id
      * 
@@ -180,6 +341,7 @@ public:
     /**
      * @brief 持久化，加锁
      * 
+     * @details 开启 raft.compression.enable 时快照数据在加锁之前压缩
      * @param index 将该index之前的日志都删除
      * @param snap 快照数据
      */
@@ -219,8 +381,25 @@ private:
      * 
      * @param term 任期
      * @param leaderId 任期领导人id，如果还未选举出来则为-1
+     * @return 持久化请求的序号，不等待落盘
      */
-    void becomeFollower(int64_t term, int64_t leaderId=  -1);
+    int64_t becomeFollower(int64_t term, int64_t leaderId=  -1);
+
+    /**
+     * @brief 把任期、状态和 leader id 发布到原子变量上，供不加锁的 getState/isLeader/getLeaderId 读取
+     * @note 持有 m_mutex 时，每次修改 m_currentTerm、m_state 或 m_leaderId 之后调用
+     */
+    void publishState();
+
+    /**
+     * @brief 在 m_host 上注册 raft 的 rpc 方法
+     */
+    void registerMethods();
+
+    /**
+     * @brief 转为pre-candidate，不增加任期，不持久化
+     */
+    void becomePreCandidate();
 
     /**
      * @brief 转为candidate
@@ -238,38 +417,136 @@ private:
     void rescheduleElection();
 
     /**
-     * @brief 重置心跳定时器
+     * @brief follower 记录从 leader 得知的提交索引和得知的时间
      */
-    void resetHeartbeatTimer();
+    void updateLeaderCommit(int64_t commit);
 
     /**
      * @brief 对一个节点发起复制请求;用于领导者节点向其他节点复制日志条目
      * 
+     * @details Replicate 状态下发送后立即推进 nextIndex，不等回复就可以继续发送，
+     *          同时在途的请求数量和日志字节数由 raft.replication.max_inflight 和 raft.replication.max_inflight_bytes 限制，
+     *          单个请求的日志字节数由 raft.replication.max_msg_bytes 限制；被拒绝后回到 Probe 状态逐个探测。
+     *          对方落后于快照时进入 Snapshot 状态，快照发送结束之前不再发送日志。
+     *          对方落后于快照时，按 raft.snapshot.chunk_size 分块从快照文件中读取并发送，速度受 raft.snapshot.rate_limit 限制
      * @param peerId 目标节点的id
      */
     void replicateOneRound(int64_t peerId);
 
+    /**
+     * @brief leader 根据多数节点已经复制的索引推进提交索引，不加锁
+     *
+     * @details leader 不等自己落盘就向 follower 发送日志，自己的副本以 m_durableIndex 为准，和 m_matchIndex 分开计算
+     */
+    void maybeCommit();
+
+    /**
+     * @brief 提交和选举需要的票数，只计算有投票权的节点（包括自己），不加锁
+     */
+    int64_t quorum() const;
+
+    /**
+     * @brief leader 的租约是否有效，不加锁
+     *
+     * @details 以多数节点（包括自己）最近确认领导地位的请求的发送时间为起点，
+     *          raft.timer.election.base 减去 raft.read.clock_drift 为租约的长度
+     */
+    bool leaseValid();
+
+    /**
+     * @brief 让节点回到 Probe 状态，丢弃所有在途请求，从 matchIndex 之后重新探测
+     */
+    void becomeProbe(int64_t peerId);
+
+    /**
+     * @brief 等待持久化请求落盘，不加锁；落盘失败时停止节点，RPC 处理函数在回复之前调用
+     */
+    void mustWaitPersisted(int64_t ticket);
+
     /**
      * @brief 用来往applyCh中push提交的日志,将已提交的日志条目应用到状态机
+     *
+     * @details 每次把一段连续的已提交日志作为一条 ENTRIES 消息发给状态机，不等待应用完成，
+     *          applied 由状态机通过 appliedTo 推进
      */
     void applier();
 
     /**
      * @brief 开始选举，发起异步投票
+     * @param leadershipTransfer 是否是收到 TimeoutNow 后发起的选举
      */
-    void startElection();
+    void startElection(bool leadershipTransfer = false);
 
     /**
-     * @brief 广播心跳
+     * @brief 开始预投票，以下一个任期询问其他节点，获得多数同意后才真正发起选举
+     */
+    void startPreVote();
+
+    /**
+     * @brief 向所有节点发送一轮 AppendEntries，成为 leader 时立即宣告领导地位
      */
     void broadcastHeartbeat();
 
     /**
-     * @brief 持久化，内部调用，不加锁
+     * @brief 一轮 ReadIndex 的领导地位确认
+     */
+    struct ReadBatch {
+        // 这一轮的读请求可以读取的索引
+        int64_t index = 0;
+        // 发起确认时的任期
+        int64_t term = 0;
+        bool done = false;
+        bool ok = false;
+    };
+
+    /**
+     * @brief leader 上的 ReadIndex，加锁
+     * @return 如果该节点不是 Leader 或者确认失败返回 std::nullopt
+     */
+    std::optional<int64_t> leaderReadIndex();
+
+    /**
+     * @brief 向多数节点确认领导地位，完成后唤醒这一轮的所有读请求
+     */
+    void confirmLeadership(std::shared_ptr<ReadBatch> batch);
+
+    /**
+     * @brief 排队中的一条提议
+     */
+    struct ProposeRequest {
+        std::string data;
+        // data 的压缩编码
+        Codec codec = Codec::None;
+        // 落盘之后返回日志的索引和任期（不带数据），失败时返回 std::nullopt
+        co::co_chan<std::optional<Entry>> done{1};
+    };
+
+    /**
+     * @brief 提议的攒批协程
+     *
+     * @details 从 m_proposeChan 中取出排队的提议，最多 raft.propose.batch_size 条，不够时最多等待 raft.propose.linger 毫秒，
+     *          整批追加到日志并持久化一次，然后分别通知每个调用者
+     */
+    void proposer();
+
+    /**
+     * @brief 单个节点的复制协程，等待新日志的通知并发起复制
+     */
+    void replicator(int64_t peerId);
+
+    /**
+     * @brief 通知所有复制协程有新的日志，不阻塞
+     */
+    void triggerReplication();
+
+    /**
+     * @brief 提交持久化请求，内部调用，不加锁，不等待落盘
      * 
-     * @param snap 
+     * @details 持久化硬状态，并把还没有持久化的日志追加到 WAL。持久化请求按提交的顺序落盘，
+     *          等待一个请求落盘也就等待了之前提交的所有请求；持有 m_mutex 时不等待落盘
+     * @return 持久化请求的序号，释放锁之后通过 m_persister->wait() 等待落盘
      */
-    void persist(Snapshot::ptr snap = nullptr);
+    int64_t persistAsync(Snapshot::ptr snap = nullptr);
 
     /**
      * @brief 发起一条消息，不加锁
@@ -285,8 +562,16 @@ private:
     Mutextype m_mutex;
     // 节点状态，初始为 Follower
     RaftState m_state = Follower;
+    // m_currentTerm << 2 | m_state，由 publishState 更新，不加锁读取
+    std::atomic<uint64_t> m_stateWord{0};
+    // m_leaderId 的副本，由 publishState 更新，不加锁读取
+    std::atomic<int64_t> m_leaderHint{-1};
     // 节点的唯一id
     int64_t m_id;
+    // 所属的 raft 组号
+    int64_t m_group = 0;
+    // 注册 rpc 方法的服务器，单组部署时为自己，multi-raft 时为宿主共享的服务器
+    rpc::RpcServer* m_host;
     // 任期内的leader id，用于follower返回给客户端，让客户端重定向请求到leader，-1表示无leader
     int64_t m_leaderId = -1;
     // 节点已知最新的任期（节点首次启动时，初始化为0，单调递增）
@@ -295,16 +580,41 @@ private:
     int64_t m_votedFor = -1;
     // 日志条目，每个条目包含了用于状态机的命令，以及leader接收到该条目时的任期（初始索引为1）
     RaftLog m_logs;
-    // 保存其他节点，key为节点id，value为节点信息
+    // 保存其他节点，key为节点id，value为节点信息，包括 learner
     std::map<int64_t, RaftPeer::ptr> m_peers;
+    // m_peers 中的 learner 节点的 id
+    std::set<int64_t> m_learners;
+    // 自己是否是 learner，learner 不发起选举也不投票
+    bool m_learner = false;
     // 对于每一台服务器，发送到该服务器的下一个日志条目的索引（初始值为领导人最后的日志条目的索引+1）
     std::map<int64_t, int64_t> m_nextIndex;
     // 对于每一台服务器，已知的已经复制到该服务器的最高日志条目的索引（初始值为0，单调递增）
     std::map<int64_t, int64_t> m_matchIndex;
+    // leader 自己已经落盘的最后一条日志的索引，提交时代替 leader 的 matchIndex
+    int64_t m_durableIndex = 0;
+    // 对于每一台服务器，最近一次被承认领导地位的 AppendEntries 请求的发送时间，用于计算租约
+    std::map<int64_t, uint64_t> m_ackTime;
+    // follower 最近一次收到 leader 消息的时间，开启租约读时用于拒绝投票
+    uint64_t m_lastLeaderContact = 0;
+    // follower 最近一次从 leader 得知的提交索引
+    int64_t m_leaderCommit = 0;
+    // follower 从 leader 得知的提交索引和最后一次得知该索引的时间，提交索引递增
+    std::deque<std::pair<int64_t, uint64_t>> m_commitTimes;
+    // 对于每一台服务器，正在发送的快照的索引和已经发送到的偏移，重连后从这里继续
+    std::map<int64_t, std::pair<int64_t, int64_t>> m_snapshotSends;
+    // 对于每一台服务器，日志复制的状态和在途请求的窗口
+    std::map<int64_t, Progress> m_progress;
+    // 等待攒批的提议
+    co::co_chan<std::shared_ptr<ProposeRequest>> m_proposeChan{1024};
+    // 已经持久化的提议批次数和日志数，用来计算平均每批的大小
+    std::atomic<uint64_t> m_proposeBatches{0};
+    std::atomic<uint64_t> m_proposedEntries{0};
+    // 对于每一台服务器，通知复制协程有新日志的通道，容量为 1，用来合并突发的提议
+    std::map<int64_t, co::co_chan<bool>> m_replicateChans;
     // 选举定时器，超时后节点将转换为candidate，然后发起投票
-    CycleTimerTocken m_electionTimer;
-    // 心跳定时器，leader定期发送心跳给follower
-    CycleTimerTocken m_heartbeatTimer;
+    WheelTimer m_electionTimer;
+    // 心跳合并器，周期性地调用 tickHeartbeat；单组部署时为自己创建的，multi-raft 时为宿主上所有组共享的
+    HeartbeatCoalescer::ptr m_coalescer;
     // 持久化
     Persister::ptr m_persister;
     // 用于以下两个场景：
@@ -313,6 +623,16 @@ private:
     co::co_condition_variable m_applyCond;
     // 用来已通过raft达成共识的已提交的提议给其他组件的通道
     co::co_chan<ApplyMsg> m_applyChan;
+    // 还没有开始确认的一轮 ReadIndex，新到达的读请求加入这一轮
+    std::shared_ptr<ReadBatch> m_pendingRead;
+    // ReadIndex 的确认完成或者领导状态改变时通知
+    co::co_condition_variable m_readCond;
+    // 正在接收领导权的节点id，-1表示没有进行中的转移；转移期间 leader 不接受新的提议
+    int64_t m_leadTransferee = -1;
+    // 在这个时间(ms)之前不能使用租约读：发出 TimeoutNow 之后目标节点可能无视租约当选，和转移是否成功无关
+    uint64_t m_leaseBlockedUntil = 0;
+    // 接收领导权的节点的日志复制有进展或者领导状态改变时通知
+    co::co_condition_variable m_transferCond;
 
 }
 
@@ -47,6 +47,17 @@ RaftPeer::RaftPeer(int64_t id, Address::ptr address) : m_id(id), m_address(std::
     m_client->setTimeout(s_rpc_timeout);
 }
 
+RaftPeer::RaftPeer(int64_t id, Address::ptr address, int64_t group, rpc::RpcClient::ptr client)
+    : m_id(id), m_group(group), m_client(std::move(client)), m_address(std::move(address)) {
+}
+
+rpc::RpcClient::ptr RaftPeer::NewClient() {
+    auto client = std::make_shared<rpc::RpcClient>();
+    client->setHeartbeat(false);
+    client->setTimeout(s_rpc_timeout);
+    return client;
+}
+
 bool RaftPeer::connect() {
     if (!m_client->isClosed()) { // 如果客户端没有关闭，则返回true
         return true;
@@ -67,7 +78,7 @@ std::optional<RequestVoteReply> RaftPeer::requestVote (const RequestVoteArgs& ar
         return std::nullopt;
     }
 
-    rpc::Result<RequestVoteArgs> result = m_client->call<RequestVoteReply>(REQUEST_VOTE, args); // 调用RPC请求
+    rpc::Result<RequestVoteArgs> result = m_client->call<RequestVoteReply>(GroupMethod(REQUEST_VOTE, m_group), args); // 调用RPC请求
     if (result.getCode() == rpc::RpcState::RPC_SUCCESS) { // 调用成功
         return result.getVal();
     }
@@ -80,12 +91,29 @@ std::optional<RequestVoteReply> RaftPeer::requestVote (const RequestVoteArgs& ar
     return std::nullopt;
 }
 
+std::optional<RequestVoteReply> RaftPeer::preVote(const RequestVoteArgs& args) {
+    if (!connect()) {
+        return std::nullopt;
+    }
+
+    rpc::Result<RequestVoteReply> result = m_client->call<RequestVoteReply>(GroupMethod(PRE_VOTE, m_group), args);
+    if (result.getCode() == rpc::RpcState::RPC_SUCCESS) {
+        return result.getVal();
+    }
+    if (result.getCode() == rpc::RpcState::RPC_CLOSED) {
+        m_client->close();
+    }
+
+    SPDLOG_LOGGER_DEBUG(Logger, "rpc call node[{}] method [{}] failed, code is {}, msg is {}, prevoteargs is {}", m_id, PRE_VOTE, result.getCode(), result.getMsg(), args.toString());
+    return std::nullopt;
+}
+
 std::optional<AppendEntriesReply> RaftPeer::appendEntries(const AppendEntriesArgs& args) {
     if (!connect()) { // 确保与远程节点连接
         return std::nullopt;
     }
 
-    rpc::Result<AppendEntriesReply> result = m_client->call<RequestVoteReply>(APPEND_ENTRIES, args);
+    rpc::Result<AppendEntriesReply> result = m_client->call<RequestVoteReply>(GroupMethod(APPEND_ENTRIES, m_group), args);
     if (result.getCode() == rpc::RpcState::RPC_SUCCESS) {
         return result.getVal();
     }
@@ -102,7 +130,7 @@ std::optional<InstallSnapshotReply> RaftPeer::installSnapshot(const InstallSnaps
         return std::nullopt;
     }
 
-    rpc::Result<InstallSnapshotReply> result = m_client->call<InstallSnapshotReply>(INSTALL_SNAPSHOT, args);
+    rpc::Result<InstallSnapshotReply> result = m_client->call<InstallSnapshotReply>(GroupMethod(INSTALL_SNAPSHOT, m_group), args);
     if (result.getCode() == rpc::RpcState::RPC_SUCCESS) {
         return result.getVal();
     }
@@ -114,4 +142,72 @@ std::optional<InstallSnapshotReply> RaftPeer::installSnapshot(const InstallSnaps
     return std::nullopt;
 }
 
+std::optional<ReadIndexReply> RaftPeer::readIndex(const ReadIndexArgs& args) {
+    if (!connect()) {
+        return std::nullopt;
+    }
+
+    rpc::Result<ReadIndexReply> result = m_client->call<ReadIndexReply>(GroupMethod(READ_INDEX, m_group), args);
+    if (result.getCode() == rpc::RpcState::RPC_SUCCESS) {
+        return result.getVal();
+    }
+    if (result.getCode() == rpc::RpcState::RPC_CLOSED) {
+        m_client->close();
+    }
+
+    SPDLOG_LOGGER_DEBUG(Logger, "rpc call node[{}] method [{}] failed, code is {}, msg is {}, readindexargs is {}", m_id, READ_INDEX, result.getCode(), result.getMsg(), args.toString());
+    return std::nullopt;
+}
+
+std::optional<TimeoutNowReply> RaftPeer::timeoutNow(const TimeoutNowArgs& args) {
+    if (!connect()) {
+        return std::nullopt;
+    }
+
+    rpc::Result<TimeoutNowReply> result = m_client->call<TimeoutNowReply>(GroupMethod(TIMEOUT_NOW, m_group), args);
+    if (result.getCode() == rpc::RpcState::RPC_SUCCESS) {
+        return result.getVal();
+    }
+    if (result.getCode() == rpc::RpcState::RPC_CLOSED) {
+        m_client->close();
+    }
+
+    SPDLOG_LOGGER_DEBUG(Logger, "rpc call node[{}] method [{}] failed, code is {}, msg is {}, timeoutnowargs is {}", m_id, TIMEOUT_NOW, result.getCode(), result.getMsg(), args.toString());
+    return std::nullopt;
+}
+
+std::optional<TransferLeadershipReply> RaftPeer::transferLeadership(const TransferLeadershipArgs& args) {
+    if (!connect()) {
+        return std::nullopt;
+    }
+
+    rpc::Result<TransferLeadershipReply> result = m_client->call<TransferLeadershipReply>(GroupMethod(TRANSFER_LEADERSHIP, m_group), args);
+    if (result.getCode() == rpc::RpcState::RPC_SUCCESS) {
+        return result.getVal();
+    }
+    if (result.getCode() == rpc::RpcState::RPC_CLOSED) {
+        m_client->close();
+    }
+
+    SPDLOG_LOGGER_DEBUG(Logger, "rpc call node[{}] method [{}] failed, code is {}, msg is {}, transferleadershipargs is {}", m_id, TRANSFER_LEADERSHIP, result.getCode(), result.getMsg(), args.toString());
+    return std::nullopt;
+}
+
+std::optional<HeartbeatsReply> RaftPeer::heartbeats(const HeartbeatsArgs& args) {
+    if (!connect()) {
+        return std::nullopt;
+    }
+
+    rpc::Result<HeartbeatsReply> result = m_client->call<HeartbeatsReply>(HEARTBEATS, args);
+    if (result.getCode() == rpc::RpcState::RPC_SUCCESS) {
+        return result.getVal();
+    }
+    if (result.getCode() == rpc::RpcState::RPC_CLOSED) {
+        m_client->close();
+    }
+
+    SPDLOG_LOGGER_DEBUG(Logger, "rpc call node[{}] method [{}] failed, code is {}, msg is {}, heartbeatsargs is {}", m_id, HEARTBEATS, result.getCode(), result.getMsg(), args.toString());
+    return std::nullopt;
+}
+
 } // namespace RR::raft
\ No newline at end of file
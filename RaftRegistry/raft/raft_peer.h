@@ -13,19 +13,33 @@
 namespace RR::raft {
 
 inline const std::string REQUEST_VOTE ="RaftNode::handleRequestVote";
+inline const std::string PRE_VOTE = "RaftNode::handlePreVote";
 inline const std::string APPEND_ENTRIES = "RaftNode::handleAppendEntries";
 inline const std::string INSTALL_SNAPSHOT = "RaftNode::handleInstallSnapshot";
+inline const std::string READ_INDEX = "RaftNode::handleReadIndex";
+inline const std::string TIMEOUT_NOW = "RaftNode::handleTimeoutNow";
+inline const std::string TRANSFER_LEADERSHIP = "RaftNode::handleTransferLeadership";
+// 节点级别的方法，一条消息携带多个组的心跳，不带组号
+inline const std::string HEARTBEATS = "HeartbeatCoalescer::handleHeartbeats";
 
 /**
- * @brief RequestVote rpc 调用的参数
+ * @brief 一个进程内有多个 raft 组时，各组的方法注册在同一个 rpc 服务器上，方法名带上组号区分；组号为0时就是原来的方法名
+ */
+inline std::string GroupMethod(const std::string& name, int64_t group) {
+    return group ? name + "#" + std::to_string(group) : name;
+}
+
+/**
+ * @brief RequestVote rpc 调用的参数，PreVote 也使用它，此时 term 为候选人下一个任期
  */
 struct RequestVoteArgs {
     int64_t term;   // 候选人任期
     int64_t candidateId;    // 候选人ID
     int64_t lastLogIndex;   // 候选人最后一条日志的索引
     int64_t lastLogTerm;    // 候选人最后一条日志的任期
+    bool leadershipTransfer = false;    // 是否是 leader 主动转移领导权发起的选举，此时不因为最近收到过 leader 的消息而拒绝投票
     std::string toString() const {
-        return fmt::format("{Term: {}, candidateId: {}, lastLogIndex: {}, lastLogTerm: {}}", term, candidateId, lastLogIndex, lastLogTerm);
+        return fmt::format("{Term: {}, candidateId: {}, lastLogIndex: {}, lastLogTerm: {}, leadershipTransfer: {}}", term, candidateId, lastLogIndex, lastLogTerm, leadershipTransfer);
     }
 };
 
@@ -72,32 +86,163 @@ struct AppendEntriesReply {
     bool success = false;   // 如果跟随者所含有的条目和prevLogIndex和prevLogTerm匹配，那么返回true
     int64_t term;   // 当前任期，如果大于leader的任期，则leader会转变为跟随者
     int64_t leaderId;   // 当前任期的leader ID
-    int64_t nextIndex;  // 下次希望接收的index
+    int64_t nextIndex;  // 下次希望接收的index，日志冲突时为冲突任期的第一条日志的索引
+    int64_t conflictTerm = 0;   // prevLogIndex 处冲突日志的任期，对方日志太短时为0
     std::string toString() const {
-        std::string str = fmt.format("success: {}, term: {}, leaderId: {}, nextIndex: {}", success, term, leaderId, nextIndex);
+        std::string str = fmt.format("success: {}, term: {}, leaderId: {}, nextIndex: {}, conflictTerm: {}", success, term, leaderId, nextIndex, conflictTerm);
         return "{" + str + "}";
     }
 };
 
+/**
+ * @brief InstallSnapshot rpc 调用的参数，快照文件被切分成多块依次发送
+ */
 struct InstallSnapshotArgs {
     int64_t term;   // 领导人的任期号
     int64_t leaderId;   // 领导人id，以便跟随者重定向请求
-    Snapshot snapshot;  // 快照
+    SnapshotMeta metadata;  // 快照的元数据
+    int64_t offset; // 这一块数据在快照文件中的偏移
+    std::string data;   // 快照文件中从 offset 开始的一块数据
+    bool done;  // 是否是最后一块
     std::string toString() const {
-        std::string str = fmt::format("term: {}, leaderId: {}, snapshot: {}", term, leaderId, snapshot.toString());
+        std::string str = fmt::format("term: {}, leaderId: {}, snapshot: [index: {}, term: {}], offset: {}, size: {}, done: {}", term, leaderId, metadata.index, metadata.term, offset, data.size(), done);
         return "{" + str + "}";
     }
 };
 
+/**
+ * @brief InstallSnapshot rpc 调用的返回值
+ */
 struct InstallSnapshotReply {
     int64_t term;   // 当前任期号，便于leader更新自己
     int64_t leaderId;   // 当前任期的leader ID
+    int64_t nextOffset = 0; // 跟随者期望的下一块数据的偏移，leader 从这里继续发送
+    bool done = false;  // 跟随者已经安装了快照，或者不再需要这个快照
+    std::string toString() const {
+        std::string str = fmt::format("term: {}, leaderId: {}, nextOffset: {}, done: {}", term, leaderId, nextOffset, done);
+        return "{" + str + "}";
+    }
+};
+
+/**
+ * @brief ReadIndex rpc 调用的参数，follower 向 leader 请求可以安全读取的索引
+ */
+struct ReadIndexArgs {
+    int64_t nodeId;   // 发起请求的节点id
+    std::string toString() const {
+        std::string str = fmt::format("nodeId: {}", nodeId);
+        return "{" + str + "}";
+    }
+};
+
+/**
+ * @brief ReadIndex rpc 调用的返回值
+ */
+struct ReadIndexReply {
+    bool success = false;   // leader 确认了自己的领导地位
+    int64_t leaderId = -1;  // 当前任期的leader ID
+    int64_t index = 0;  // 可以安全读取的索引，follower 应用到该索引之后才能读取
+    std::string toString() const {
+        std::string str = fmt::format("success: {}, leaderId: {}, index: {}", success, leaderId, index);
+        return "{" + str + "}";
+    }
+};
+
+/**
+ * @brief TimeoutNow rpc 调用的参数，leader 转移领导权时通知目标节点立即发起选举
+ */
+struct TimeoutNowArgs {
+    int64_t term;   // leader的任期
+    int64_t leaderId;   // leader的id
     std::string toString() const {
         std::string str = fmt::format("term: {}, leaderId: {}", term, leaderId);
         return "{" + str + "}";
     }
 };
 
+/**
+ * @brief TimeoutNow rpc 调用的返回值
+ */
+struct TimeoutNowReply {
+    int64_t term = 0;   // 收到请求时节点的任期
+    bool success = false;   // 是否已经发起选举
+    std::string toString() const {
+        std::string str = fmt::format("term: {}, success: {}", term, success);
+        return "{" + str + "}";
+    }
+};
+
+/**
+ * @brief TransferLeadership 管理 rpc 调用的参数，滚动重启前把领导权转移给其他节点
+ */
+struct TransferLeadershipArgs {
+    int64_t targetId;   // 接收领导权的节点id
+    std::string toString() const {
+        std::string str = fmt::format("targetId: {}", targetId);
+        return "{" + str + "}";
+    }
+};
+
+/**
+ * @brief TransferLeadership 管理 rpc 调用的返回值
+ */
+struct TransferLeadershipReply {
+    bool success = false;   // 目标节点是否已经追上日志并发起了选举
+    int64_t leaderId = -1;  // 收到请求的节点不是 leader 时，告诉调用者当前的 leader
+    std::string toString() const {
+        std::string str = fmt::format("success: {}, leaderId: {}", success, leaderId);
+        return "{" + str + "}";
+    }
+};
+
+/**
+ * @brief 一个组发给一个节点的精简心跳，只在对方的日志已经追上时代替空的 AppendEntries
+ */
+struct HeartbeatArgs {
+    int64_t group;  // raft 组号
+    int64_t term;   // leader的任期
+    int64_t leaderId;   // leader的id
+    int64_t commit; // 提交索引，不超过对方已经匹配的索引，对方可以直接提交
+    std::string toString() const {
+        std::string str = fmt::format("group: {}, term: {}, leaderId: {}, commit: {}", group, term, leaderId, commit);
+        return "{" + str + "}";
+    }
+};
+
+/**
+ * @brief 精简心跳的回复
+ */
+struct HeartbeatReply {
+    int64_t group;  // raft 组号
+    int64_t term = 0;   // 当前任期，如果大于leader的任期，则leader会转变为跟随者
+    bool success = false;   // 是否承认了 leader 的领导地位，组不存在时为 false
+    std::string toString() const {
+        std::string str = fmt::format("group: {}, term: {}, success: {}", group, term, success);
+        return "{" + str + "}";
+    }
+};
+
+/**
+ * @brief 合并的心跳，一个心跳周期内发往同一个节点的所有组的心跳放在一条消息里
+ */
+struct HeartbeatsArgs {
+    int64_t from;   // 发送心跳的节点id
+    std::vector<HeartbeatArgs> heartbeats;
+    std::string toString() const {
+        return fmt::format("{{from: {}, heartbeats: {}}}", from, heartbeats.size());
+    }
+};
+
+/**
+ * @brief 合并的心跳的回复，和请求中的心跳一一对应
+ */
+struct HeartbeatsReply {
+    std::vector<HeartbeatReply> replies;
+    std::string toString() const {
+        return fmt::format("{{replies: {}}}", replies.size());
+    }
+};
+
 /**
  * @brief RaftNode 通过 RaftPeer 调用远端 Raft 节点，封装了 rpc 请求
  */
@@ -107,12 +252,35 @@ public:
 
     RaftPeer(int64_t id, Address::ptr address);
 
+    /**
+     * @brief 创建 raft 组 group 的远端节点，和同一节点上的其他组共享 client 的连接
+     */
+    RaftPeer(int64_t id, Address::ptr address, int64_t group, rpc::RpcClient::ptr client);
+
+    /**
+     * @brief 创建一个按照 raft.rpc 配置初始化的 rpc 客户端，供多个组共享
+     */
+    static rpc::RpcClient::ptr NewClient();
+
     std::optional<RequestVoteReply> requestVote (const RequestVoteArgs& args);
 
+    std::optional<RequestVoteReply> preVote(const RequestVoteArgs& args);
+
     std::optional<AppendEntriesReply> appendEntries(const AppendEntriesArgs& args);
 
     std::optional<InstallSnapshotReply> installSnapshot(const InstallSnapshotArgs& args);
 
+    std::optional<ReadIndexReply> readIndex(const ReadIndexArgs& args);
+
+    std::optional<TimeoutNowReply> timeoutNow(const TimeoutNowArgs& args);
+
+    std::optional<TransferLeadershipReply> transferLeadership(const TransferLeadershipArgs& args);
+
+    /**
+     * @brief 发送合并的心跳，节点级别的方法，和所属的组无关
+     */
+    std::optional<HeartbeatsReply> heartbeats(const HeartbeatsArgs& args);
+
     Address::ptr getAddress() const { return m_address;}
 
 private:
@@ -120,6 +288,7 @@ private:
 
 private:
     int64_t m_id;   // raftNode的id
+    int64_t m_group = 0;    // 所属的 raft 组，调用的方法名带上组号
     rpc::RpcClient::ptr m_client;
     Address::ptr m_address;
 };
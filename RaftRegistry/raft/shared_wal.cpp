@@ -0,0 +1,233 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include "shared_wal.h"
+#include <spdlog/spdlog.h>
+#include "RaftRegistry/common/config.h"
+
+namespace RR::raft {
+static auto Logger = GetLoggerInstance();
+
+// 组提交的等待时间，0 表示不额外等待，只合并刷盘期间到达的请求
+static ConfigVar<uint32_t>::ptr g_group_commit_linger = Config::LookUp<uint32_t>("raft.persist.group_commit.linger", 0, "raft group commit linger time(ms)");
+// 一次组提交的字节上限，达到上限后不再等待
+static ConfigVar<uint64_t>::ptr g_group_commit_bytes = Config::LookUp<uint64_t>("raft.persist.group_commit.bytes", 4 * 1024 * 1024, "raft group commit max bytes per fdatasync");
+
+static uint32_t s_group_commit_linger;
+static uint64_t s_group_commit_bytes;
+
+namespace {
+struct SharedWALIniter {
+    SharedWALIniter() {
+        s_group_commit_linger = g_group_commit_linger->getValue();
+        g_group_commit_linger->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft group commit linger changed from {} to {}", old_value, new_value);
+            s_group_commit_linger = new_value;
+        });
+
+        s_group_commit_bytes = g_group_commit_bytes->getValue();
+        g_group_commit_bytes->addListener([](const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft group commit bytes changed from {} to {}", old_value, new_value);
+            s_group_commit_bytes = new_value;
+        });
+    }
+};
+
+[[maybe_unused]] static SharedWALIniter s_initer;
+}
+
+SharedWAL::SharedWAL(const std::filesystem::path& dir) : m_wal(dir) {}
+
+SharedWAL::~SharedWAL() {
+    std::unique_lock<MutexType> lock(m_queueMutex);
+    m_stop = true;
+    m_submitCond.notify_all();
+    bool running = m_syncerRunning;
+    lock.unlock();
+    // 组提交协程持有 this，等它把已经提交的请求全部落盘并退出之后才能析构成员
+    if (running) {
+        m_stopped >> nullptr;
+    }
+}
+
+int64_t SharedWAL::submit(int64_t group, std::vector<Entry> entries, Callback callback) {
+    std::unique_lock<MutexType> lock(m_queueMutex);
+    // 第一次提交时启动组提交协程；出错之后协程已经退出，请求直接失败
+    if (!m_syncerRunning && !m_broken) {
+        m_syncerRunning = true;
+        go [this] {
+            syncer();
+        };
+    }
+
+    int64_t bytes = 0;
+    for (const Entry& entry : entries) {
+        bytes += static_cast<int64_t>(entry.data.size() + sizeof(Entry));
+    }
+    m_pendingBytes += bytes;
+    m_pending.push_back(Request{.seq = ++m_submitted, .group = group, .bytes = bytes, .entries = std::move(entries), .callback = std::move(callback)});
+    m_submitCond.notify_one();
+    return m_submitted;
+}
+
+bool SharedWAL::wait(int64_t seq) {
+    std::unique_lock<MutexType> lock(m_queueMutex);
+    // 关闭时组提交协程会先把已经提交的请求落盘，所以只在它退出之后才放弃等待
+    while (m_durable < seq && !m_broken && (!m_stop || m_syncerRunning)) {
+        m_durableCond.wait(lock);
+    }
+    return m_durable >= seq;
+}
+
+bool SharedWAL::save(int64_t group, const std::vector<Entry>& entries) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    return m_wal.save(group, entries);
+}
+
+std::optional<std::vector<Entry>> SharedWAL::readAll(int64_t group, int64_t lastSnapshotIndex, int64_t lastSnapshotTerm) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    return m_wal.readAll(group, lastSnapshotIndex, lastSnapshotTerm);
+}
+
+std::vector<Entry> SharedWAL::read(int64_t group, int64_t low, int64_t high, int64_t maxBytes) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    return m_wal.read(group, low, high, maxBytes);
+}
+
+void SharedWAL::release(int64_t group, int64_t index) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    m_wal.release(group, index);
+}
+
+int64_t SharedWAL::pendingSize(int64_t group) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    return m_wal.pendingSize(group);
+}
+
+bool SharedWAL::pinned(int64_t group) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    return m_wal.pinned().count(group);
+}
+
+void SharedWAL::setCompactor(int64_t group, Compactor compactor) {
+    std::unique_lock<MutexType> lock(m_mutex);
+    if (compactor) {
+        m_compactors[group] = std::move(compactor);
+    } else {
+        m_compactors.erase(group);
+        m_notified.erase(group);
+    }
+}
+
+void SharedWAL::syncer() {
+    // 只复制通道，退出时通知析构函数之后不能再访问任何成员
+    auto stopped = m_stopped;
+    {
+        std::unique_lock<MutexType> lock(m_queueMutex);
+        syncLoop(lock);
+        m_syncerRunning = false;
+        m_durableCond.notify_all();
+    }
+    stopped << true;
+}
+
+void SharedWAL::syncLoop(std::unique_lock<MutexType>& lock) {
+    while (true) {
+        while (m_pending.empty() && !m_stop) {
+            m_submitCond.wait(lock);
+        }
+        // 关闭之后把剩下的请求落盘再退出，已经拿到序号的请求不会被悄悄丢掉
+        if (m_pending.empty() || m_broken) {
+            break;
+        }
+
+        // 请求量还没有达到上限时等待一会儿，让更多的请求合并到这一次刷盘中
+        if (!m_stop && s_group_commit_linger && m_pendingBytes < static_cast<int64_t>(s_group_commit_bytes)) {
+            lock.unlock();
+            co_sleep(s_group_commit_linger);
+            lock.lock();
+        }
+
+        // 取出不超过字节上限的一批请求，至少取一个
+        std::vector<Request> batch;
+        int64_t bytes = 0;
+        size_t count = 0;
+        while (count < m_pending.size()) {
+            if (count && bytes + m_pending[count].bytes > static_cast<int64_t>(s_group_commit_bytes)) {
+                break;
+            }
+            bytes += m_pending[count].bytes;
+            ++count;
+        }
+        batch.assign(std::make_move_iterator(m_pending.begin()), std::make_move_iterator(m_pending.begin() + count));
+        m_pending.erase(m_pending.begin(), m_pending.begin() + count);
+        m_pendingBytes -= bytes;
+
+        // 刷盘期间不持有队列锁，新的请求可以继续提交，下一轮一起刷盘
+        lock.unlock();
+        bool ok = flush(batch);
+        lock.lock();
+
+        if (!ok) {
+            SPDLOG_LOGGER_CRITICAL(Logger, "persist requests [{}, {}] failed, wal is broken", batch.front().seq, batch.back().seq);
+            m_broken = true;
+        } else {
+            m_durable = batch.back().seq;
+        }
+        m_durableCond.notify_all();
+    }
+}
+
+bool SharedWAL::flush(std::vector<Request>& batch) {
+    {
+        std::unique_lock<MutexType> lock(m_mutex);
+        // 所有组的日志写进同一个段，整批只做一次 fdatasync
+        for (const Request& request : batch) {
+            if (!m_wal.append(request.group, request.entries)) {
+                return false;
+            }
+        }
+        if (!m_wal.sync()) {
+            return false;
+        }
+    }
+
+    // 回调会保存硬状态和快照，快照之后还会调用 release，不能持有 m_mutex
+    std::map<int64_t, int64_t> latest;
+    for (const Request& request : batch) {
+        latest[request.group] = request.seq;
+    }
+    for (Request& request : batch) {
+        if (request.callback && !request.callback(latest[request.group] == request.seq)) {
+            return false;
+        }
+    }
+    compact();
+    return true;
+}
+
+void SharedWAL::compact() {
+    std::vector<Compactor> compactors;
+    {
+        std::unique_lock<MutexType> lock(m_mutex);
+        for (const auto& [group, seq] : m_wal.pinned()) {
+            auto iter = m_compactors.find(group);
+            if (iter == m_compactors.end()) {
+                continue;
+            }
+            // 快照之后还拖住同一个段时（比如还有没有提交的日志）不重复通知，该组再应用日志时由状态机自己检查
+            auto [notified, inserted] = m_notified.emplace(group, seq);
+            if (!inserted && notified->second == seq) {
+                continue;
+            }
+            notified->second = seq;
+            compactors.push_back(iter->second);
+        }
+    }
+    for (const Compactor& compactor : compactors) {
+        compactor();
+    }
+}
+
+} // namespace RR::raft
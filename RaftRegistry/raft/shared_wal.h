@@ -0,0 +1,167 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_RAFT_SHARED_WAL_H
+#define RR_RAFT_SHARED_WAL_H
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <libgo/libgo.h>
+#include "RaftRegistry/raft/entry.h"
+#include "RaftRegistry/raft/wal.h"
+
+namespace RR::raft {
+
+/**
+ * @brief 多个 raft 组共享的 WAL 和组提交协程
+ *
+ * @details 所有组的持久化请求进入同一个队列，后台协程把一段时间内（或达到字节上限前）提交的请求合并，
+ *          把各个组的日志写进同一个 WAL 后只做一次 fdatasync，所以刷盘次数和组的数量无关。
+ *          请求按提交的顺序落盘，刷盘之后依次调用请求的回调，由各组的 Persister 保存硬状态和快照。
+ *          只有一个组时由 Persister 自己创建，多个组时由宿主创建后传给每个组的 Persister。
+ */
+class SharedWAL {
+public:
+    using ptr = std::shared_ptr<SharedWAL>;
+    using MutexType = co::co_mutex;
+    /**
+     * @brief 请求落盘之后调用，latest 表示这是该组在这一批里的最后一个请求；返回 false 表示持久化出错
+     */
+    using Callback = std::function<bool(bool latest)>;
+    /**
+     * @brief 组拖住了旧的段时调用，要求该组尽快做快照；在组提交协程中调用，不能阻塞
+     */
+    using Compactor = std::function<void()>;
+
+    /**
+     * @param dir WAL 的段文件目录
+     */
+    explicit SharedWAL(const std::filesystem::path& dir);
+
+    /**
+     * @brief 等组提交协程把已经提交的请求全部落盘并退出
+     */
+    ~SharedWAL();
+
+    /**
+     * @brief 提交一个组的持久化请求，不等待落盘
+     *
+     * @param entries 新追加的日志，追加到 WAL 中；如果和该组已写入的日志重叠，重叠部分被覆盖
+     * @param callback 落盘之后在组提交协程中调用
+     * @return 请求的序号，用于 wait
+     */
+    int64_t submit(int64_t group, std::vector<Entry> entries, Callback callback);
+
+    /**
+     * @brief 等待序号为 seq 的持久化请求落盘
+     * @return 落盘成功返回 true，持久化出错或者已经关闭返回 false
+     */
+    bool wait(int64_t seq);
+
+    /**
+     * @brief 追加一个组的日志并立即刷盘，不经过组提交队列，只用于启动时迁移旧格式的数据
+     */
+    bool save(int64_t group, const std::vector<Entry>& entries);
+
+    /**
+     * @brief 回放一个组的日志，见 WAL::readAll
+     */
+    std::optional<std::vector<Entry>> readAll(int64_t group, int64_t lastSnapshotIndex, int64_t lastSnapshotTerm);
+
+    /**
+     * @brief 读取一个组 [low, high) 的已持久化日志，见 WAL::read
+     */
+    std::vector<Entry> read(int64_t group, int64_t low, int64_t high, int64_t maxBytes = INT64_MAX);
+
+    /**
+     * @brief 一个组的快照已经持久化，删除不再需要的段，见 WAL::release
+     */
+    void release(int64_t group, int64_t index);
+
+    /**
+     * @brief 一个组上一次快照之后写入 WAL 的字节数
+     */
+    int64_t pendingSize(int64_t group);
+
+    /**
+     * @brief 一个组是否拖住了旧的段，见 WAL::pinned
+     */
+    bool pinned(int64_t group);
+
+    /**
+     * @brief 设置一个组的压缩回调，传入空函数表示取消
+     * @details 每次刷盘之后检查拖住旧段的组，同一个组拖住同一个段只通知一次；
+     *          没有写入的组不会自己检查快照的条件，只能由这里通知
+     */
+    void setCompactor(int64_t group, Compactor compactor);
+
+private:
+    // 一次持久化请求
+    struct Request {
+        int64_t seq;
+        int64_t group;
+        // 日志的大致字节数
+        int64_t bytes;
+        std::vector<Entry> entries;
+        Callback callback;
+    };
+
+    /**
+     * @brief 组提交协程，批量处理持久化请求，退出时通过 m_stopped 通知析构函数
+     */
+    void syncer();
+
+    /**
+     * @brief 组提交的主循环，持有队列锁调用；关闭之后把剩下的请求落盘再返回
+     */
+    void syncLoop(std::unique_lock<MutexType>& lock);
+
+    /**
+     * @brief 将一批请求的日志写入 WAL，只做一次 fdatasync，然后依次调用回调
+     */
+    bool flush(std::vector<Request>& batch);
+
+    /**
+     * @brief 通知拖住旧段的组做快照
+     */
+    void compact();
+
+private:
+    // 保护 WAL 和压缩回调
+    MutexType m_mutex;
+    // 每个组的压缩回调
+    std::map<int64_t, Compactor> m_compactors;
+    // 每个组上一次被通知时拖住的最旧的段的序号
+    std::map<int64_t, int64_t> m_notified;
+    // 保护持久化请求队列
+    MutexType m_queueMutex;
+    // 有新的持久化请求
+    co::co_condition_variable m_submitCond;
+    // 有请求落盘
+    co::co_condition_variable m_durableCond;
+    // 等待落盘的请求
+    std::vector<Request> m_pending;
+    // 等待落盘的请求的大致字节数
+    int64_t m_pendingBytes = 0;
+    // 最后一个提交的请求的序号
+    int64_t m_submitted = 0;
+    // 最后一个落盘的请求的序号
+    int64_t m_durable = 0;
+    // 持久化出错，之后所有请求都失败
+    bool m_broken = false;
+    bool m_stop = false;
+    bool m_syncerRunning = false;
+    // 组提交协程退出时写入，析构函数等待它
+    co::co_chan<bool> m_stopped{1};
+    WAL m_wal;
+};
+
+} // namespace RR::raft
+
+#endif // RR_RAFT_SHARED_WAL_H
@@ -4,6 +4,10 @@
 
 #include "RaftRegistry/raft/snapshot.h"
 #include "RaftRegistry/common/util.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
 #include <spdlog/spdlog.h>
 
 namespace RR::raft {
@@ -89,13 +93,15 @@ std::vector<std::string> Snapshotter::checkSuffix(const std::vector<std::string>
 }
 
 bool Snapshotter::save(const Snapshot& snapshot) {
-    // 创建快照文件名
-    // 快照名格式 %016ld-%016ld%s
-    std::unique_ptr<char[]> snapName = std::make_unique<char[]>(16+1+16+m_snap_suffix.size()+1);
-    sprintf(&snapName[0],"%016ld-%016ld%s",snapshot.metadata.term, snapshot.metadata.index, m_snap_suffix.c_str());
-    std::string filename = m_dir / snapName.get();
+    std::filesystem::path filename = snapPath(snapshot.metadata);
+    // 快照文件只会被完整地 rename 进来，同名的快照已经存在（例如通过 install 接收的快照）就不用重复写
+    if (std::filesystem::exists(filename)) {
+        return true;
+    }
 
-    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    // 先写临时文件，刷盘后再 rename，崩溃时不会留下写了一半的快照
+    std::filesystem::path tmp = tempPath(snapshot.metadata);
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
     if (fd < 0) {
         return false;
     }
@@ -108,14 +114,130 @@ bool Snapshotter::save(const Snapshot& snapshot) {
     std::string data = s.str();
     // 将数据写入文件
     if (write(fd, data.c_str(), data.size()) < 0) {
+        close(fd);
         return false;
     }
 
     // 数据写入磁盘
-    fsync(fd);
+    if (fsync(fd) < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "fsync {} failed: {}", tmp.string(), strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+    if (rename(tmp.c_str(), filename.c_str()) < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "rename {} failed: {}", tmp.string(), strerror(errno));
+        return false;
+    }
+    return SyncDir(m_dir);
+}
+
+std::optional<SnapshotMeta> Snapshotter::latest() {
+    for (auto& name : snapNames()) {
+        SnapshotMeta meta{};
+        if (sscanf(name.c_str(), "%ld-%ld", &meta.term, &meta.index) == 2) {
+            return meta;
+        }
+    }
+    return std::nullopt;
+}
+
+int64_t Snapshotter::size(const SnapshotMeta& meta) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(snapPath(meta), ec);
+    return ec ? -1 : static_cast<int64_t>(size);
+}
+
+std::optional<std::string> Snapshotter::readChunk(const SnapshotMeta& meta, int64_t offset, int64_t size) {
+    std::ifstream file(snapPath(meta), std::ios::binary);
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+    file.seekg(offset, file.beg);
+    std::string data;
+    data.resize(size);
+    file.read(&data[0], size);
+    data.resize(file.gcount());
+    return data;
+}
+
+int64_t Snapshotter::receive(const SnapshotMeta& meta, int64_t offset, const std::string& data) {
+    std::filesystem::path path = tempPath(meta);
+    std::error_code ec;
+    auto current = static_cast<int64_t>(std::filesystem::exists(path) ? std::filesystem::file_size(path, ec) : 0);
+    if (ec) {
+        current = 0;
+    }
+    // 不连续的数据不写入，告诉发送方从哪里继续
+    if (offset != 0 && offset != current) {
+        return current;
+    }
 
+    int flags = O_WRONLY | O_CREAT | O_APPEND;
+    if (offset == 0) {
+        // 重新开始接收，之前没有接收完的快照都作废
+        for (auto& iter : std::filesystem::directory_iterator(path.parent_path())) {
+            if (iter.path() != path) {
+                std::filesystem::remove(iter.path(), ec);
+            }
+        }
+        flags |= O_TRUNC;
+    }
+    int fd = open(path.c_str(), flags, 0600);
+    if (fd < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "open snapshot temp file {} failed: {}", path.string(), strerror(errno));
+        return offset == 0 ? 0 : current;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            SPDLOG_LOGGER_ERROR(Logger, "write snapshot temp file {} failed: {}", path.string(), strerror(errno));
+            break;
+        }
+        written += n;
+    }
     close(fd);
-    return true;
+    return offset + static_cast<int64_t>(written);
+}
+
+bool Snapshotter::install(const SnapshotMeta& meta) {
+    std::filesystem::path tmp = tempPath(meta);
+    int fd = open(tmp.c_str(), O_WRONLY);
+    if (fd < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "open snapshot temp file {} failed: {}", tmp.string(), strerror(errno));
+        return false;
+    }
+    if (fsync(fd) < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "fsync snapshot temp file {} failed: {}", tmp.string(), strerror(errno));
+        close(fd);
+        return false;
+    }
+    close(fd);
+    if (rename(tmp.c_str(), snapPath(meta).c_str()) < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "rename {} failed: {}", tmp.string(), strerror(errno));
+        return false;
+    }
+    return SyncDir(m_dir);
+}
+
+std::filesystem::path Snapshotter::snapPath(const SnapshotMeta& meta) {
+    // 快照名格式 %016ld-%016ld%s
+    std::unique_ptr<char[]> snapName = std::make_unique<char[]>(16+1+16+m_snap_suffix.size()+1);
+    sprintf(&snapName[0],"%016ld-%016ld%s", meta.term, meta.index, m_snap_suffix.c_str());
+    return m_dir / snapName.get();
+}
+
+std::filesystem::path Snapshotter::tempPath(const SnapshotMeta& meta) {
+    std::filesystem::path dir = m_dir / "tmp";
+    if (!std::filesystem::exists(dir)) {
+        std::filesystem::create_directories(dir);
+    }
+    return dir / snapPath(meta).filename();
 }
 
 std::unique_ptr<Snapshot> Snapshotter::read(const std::string& snapname) {
@@ -7,6 +7,8 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <optional>
+#include "RaftRegistry/common/compress.h"
 #include "RaftRegistry/rpc/serializer.h"
 
 namespace RR::raft {
@@ -40,18 +42,37 @@ struct Snapshot {
     SnapshotMeta metadata;
     // 快照的数据部分，存储了使用者状态的序列化表示
     std::string data;
+    // data 的压缩编码，快照文件和分块发送的都是压缩后的数据
+    Codec codec = Codec::None;
     
     bool empty() const {
         return metadata.index == 0;
     }
 
+    /**
+     * @brief 解压 data，解压后 codec 为 None
+     * @return 数据损坏时返回 false
+     */
+    bool decompress() {
+        if (codec == Codec::None) {
+            return true;
+        }
+        auto raw = Decompress(codec, data);
+        if (!raw) {
+            return false;
+        }
+        data = std::move(*raw);
+        codec = Codec::None;
+        return true;
+    }
+
     friend rpc::Serializer& operator<<(rpc::Serializer& serializer, const Snapshot& snap) {
-        serializer << snap.metadata << snap.data;
+        serializer << snap.metadata << snap.codec << snap.data;
         return serializer;
     }
 
     friend rpc::Serializer& operator>>(rpc::Serializer& serializer, Snapshot& snap) {
-        serializer >> snap.metadata >> snap.data;
+        serializer >> snap.metadata >> snap.codec >> snap.data;
         return serializer;
     }
 };
@@ -88,7 +109,47 @@ struct Snapshotter {
     */
     Snapshot::ptr loadSnap();
 
+    /**
+     * @brief 获取最新的快照的元数据，只解析文件名，不读取快照内容
+     */
+    std::optional<SnapshotMeta> latest();
+
+    /**
+     * @brief 快照文件的大小，文件不存在时返回 -1
+     */
+    int64_t size(const SnapshotMeta& meta);
+
+    /**
+     * @brief 从快照文件的 offset 处读取最多 size 字节，用于分块发送快照
+     * @return 读到文件末尾时返回空字符串，文件不存在时返回 std::nullopt
+     */
+    std::optional<std::string> readChunk(const SnapshotMeta& meta, int64_t offset, int64_t size);
+
+    /**
+     * @brief 把接收到的一块快照数据追加到临时文件
+     *
+     * @details offset 必须等于临时文件当前的大小，否则不写入；offset 为 0 时重新开始接收，
+     *          同时删除其他快照的临时文件。断线重连后发送方可以根据返回值从断点继续发送
+     * @return 临时文件当前的大小，即下一块数据期望的 offset
+     */
+    int64_t receive(const SnapshotMeta& meta, int64_t offset, const std::string& data);
+
+    /**
+     * @brief 临时文件接收完成后刷盘，并原子地替换为正式的快照文件
+     */
+    bool install(const SnapshotMeta& meta);
+
 private:
+    /**
+     * @brief 快照文件的路径，文件名格式 %016ld-%016ld%s（任期-索引-后缀）
+     */
+    std::filesystem::path snapPath(const SnapshotMeta& meta);
+
+    /**
+     * @brief 正在写入或接收的快照的临时文件路径，临时文件放在单独的子目录中，不会被当作快照加载
+     */
+    std::filesystem::path tempPath(const SnapshotMeta& meta);
+
     /**
     * @brief 获取按逻辑顺序排列的快照文件名列表
     * @return std::vector<std::string> 快照文件名列表
@@ -0,0 +1,416 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include "RaftRegistry/raft/wal.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <spdlog/spdlog.h>
+#include "RaftRegistry/common/config.h"
+#include "RaftRegistry/common/util.h"
+
+namespace RR::raft {
+static auto Logger = GetLoggerInstance();
+
+// 单个段文件的大小上限，超过后切换到新的段
+static ConfigVar<uint64_t>::ptr g_wal_segment_size = Config::LookUp<uint64_t>("raft.wal.segment_size", 64 * 1024 * 1024, "raft wal segment size(byte)");
+
+// 一个组的日志所在的段之后超过这么多个段时，要求该组尽快做快照，避免一个冷的组拖住所有段
+static ConfigVar<uint32_t>::ptr g_wal_max_pinned_segments = Config::LookUp<uint32_t>("raft.wal.max_pinned_segments", 4, "raft wal max segments after the oldest segment a group still needs");
+
+static uint64_t s_wal_segment_size;
+static uint32_t s_wal_max_pinned_segments;
+
+namespace {
+struct WALIniter {
+    WALIniter() {
+        s_wal_segment_size = g_wal_segment_size->getValue();
+        g_wal_segment_size->addListener([](const uint64_t& old_value, const uint64_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft wal segment size changed from {} to {}", old_value, new_value);
+            s_wal_segment_size = new_value;
+        });
+
+        s_wal_max_pinned_segments = g_wal_max_pinned_segments->getValue();
+        g_wal_max_pinned_segments->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            SPDLOG_LOGGER_INFO(Logger, "raft wal max pinned segments changed from {} to {}", old_value, new_value);
+            s_wal_max_pinned_segments = new_value;
+        });
+    }
+};
+
+[[maybe_unused]] static WALIniter s_initer;
+
+// 记录头：length(u32) + crc32(u32)
+constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t) * 2;
+}
+
+WAL::WAL(const std::filesystem::path& dir) : m_dir(dir) {}
+
+WAL::~WAL() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+std::optional<std::vector<Entry>> WAL::readAll(int64_t group, int64_t lastSnapshotIndex, int64_t lastSnapshotTerm) {
+    if (!m_loaded && !load()) {
+        return std::nullopt;
+    }
+    if (!m_lastIndex.count(group) && lastSnapshotIndex == 0) {
+        return std::nullopt;
+    }
+    // 快照之前的记录已经被覆盖，只记下来不删除段，保持重启之后估算的 pendingSize，避免旧段被这个组一直拖住
+    int64_t& released = m_released[group];
+    released = std::max(released, lastSnapshotIndex);
+
+    // 第一个元素保存快照的最后一条日志，和 RaftLog 的约定一致
+    std::vector<Entry> entries;
+    entries.push_back(Entry{.index = lastSnapshotIndex, .term = lastSnapshotTerm});
+    for (auto& iter : replay(group, lastSnapshotIndex + 1, INT64_MAX, false)) {
+        if (iter.first != entries.back().index + 1) {
+            SPDLOG_LOGGER_CRITICAL(Logger, "wal {} of group {} has a gap at index {}, expected {}", m_dir.string(), group, iter.first, entries.back().index + 1);
+            exit(EXIT_FAILURE);
+        }
+        entries.push_back(std::move(iter.second));
+    }
+    return entries;
+}
+
+bool WAL::append(int64_t group, const std::vector<Entry>& entries) {
+    if (entries.empty()) {
+        return true;
+    }
+    if (!m_loaded && !load()) {
+        return false;
+    }
+    if (m_fd < 0 && !cut()) {
+        return false;
+    }
+
+    std::string buf;
+    int64_t& lastIndex = m_lastIndex[group];
+    // 新日志覆盖了已写入的日志，先写一条截断记录
+    if (entries.front().index <= lastIndex) {
+        encodeRecord(buf, group, true, [&](rpc::Serializer& s) {
+            s << entries.front().index;
+        });
+    }
+    for (const Entry& entry : entries) {
+        encodeRecord(buf, group, false, [&](rpc::Serializer& s) {
+            s << entry;
+        });
+    }
+
+    if (!write(buf)) {
+        return false;
+    }
+
+    Segment& segment = m_segments.back();
+    int64_t& maxIndex = segment.maxIndex[group];
+    maxIndex = std::max(maxIndex, entries.back().index);
+    lastIndex = entries.back().index;
+    m_pendingSize[group] += static_cast<int64_t>(buf.size());
+
+    // 当前段写满了，切换到新的段
+    if (segment.size >= static_cast<int64_t>(s_wal_segment_size)) {
+        return cut();
+    }
+    return true;
+}
+
+bool WAL::sync() {
+    if (m_fd < 0) {
+        return true;
+    }
+    if (fdatasync(m_fd) < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "fdatasync wal segment {} failed: {}", m_segments.back().path.string(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void WAL::release(int64_t group, int64_t index) {
+    int64_t& released = m_released[group];
+    released = std::max(released, index);
+    m_pendingSize[group] = 0;
+
+    // 只能删除前缀，中间的段可能包含对前面段的截断记录；段内每个组的日志都被快照覆盖之后才能删除
+    size_t count = 0;
+    while (count + 1 < m_segments.size()) {
+        const Segment& segment = m_segments[count];
+        bool covered = std::all_of(segment.maxIndex.begin(), segment.maxIndex.end(), [this](const std::pair<const int64_t, int64_t>& max) {
+            auto iter = m_released.find(max.first);
+            return iter != m_released.end() && max.second <= iter->second;
+        });
+        if (!covered) {
+            break;
+        }
+        ++count;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        std::error_code ec;
+        std::filesystem::remove(m_segments[i].path, ec);
+        if (ec) {
+            SPDLOG_LOGGER_WARN(Logger, "remove wal segment {} failed: {}", m_segments[i].path.string(), ec.message());
+        }
+        m_size -= m_segments[i].size;
+    }
+    m_segments.erase(m_segments.begin(), m_segments.begin() + count);
+}
+
+int64_t WAL::pendingSize(int64_t group) const {
+    auto iter = m_pendingSize.find(group);
+    return iter == m_pendingSize.end() ? 0 : iter->second;
+}
+
+std::map<int64_t, int64_t> WAL::pinned() const {
+    std::map<int64_t, int64_t> groups;
+    // 只看之后还有超过上限个段的旧段，从旧到新，记下每个组拖住的最旧的段
+    const size_t limit = m_segments.size() > s_wal_max_pinned_segments ? m_segments.size() - s_wal_max_pinned_segments : 0;
+    for (size_t i = 0; i < limit; ++i) {
+        for (const auto& [group, index] : m_segments[i].maxIndex) {
+            auto iter = m_released.find(group);
+            if (iter == m_released.end() || index > iter->second) {
+                groups.emplace(group, m_segments[i].seq);
+            }
+        }
+    }
+    return groups;
+}
+
+int64_t WAL::lastIndex(int64_t group) const {
+    auto iter = m_lastIndex.find(group);
+    return iter == m_lastIndex.end() ? 0 : iter->second;
+}
+
+std::vector<Entry> WAL::read(int64_t group, int64_t low, int64_t high, int64_t maxBytes) {
+    std::vector<Entry> entries;
+    for (auto& iter : replay(group, low, high, true, maxBytes)) {
+        entries.push_back(std::move(iter.second));
+    }
+    return entries;
+}
+
+std::map<int64_t, Entry> WAL::replay(int64_t group, int64_t low, int64_t high, bool skip, int64_t maxBytes) {
+    std::map<int64_t, Entry> found;
+    // 保留的日志数据的字节数
+    int64_t bytes = 0;
+    for (const Segment& segment : m_segments) {
+        auto max = segment.maxIndex.find(group);
+        if (max == segment.maxIndex.end()) {
+            continue;
+        }
+        // 读取淘汰的日志时，整个段都在 low 之前就不会包含需要的日志；被淘汰的日志已经提交，不会再被后面的截断记录覆盖
+        if (skip && max->second < low) {
+            continue;
+        }
+        std::ifstream in(segment.path, std::ios::binary);
+        std::string data(std::istreambuf_iterator<char>(in), {});
+        decode(data, segment.path, [&](Record& record) {
+            if (record.group != group) {
+                return;
+            }
+            // 新写入的日志和截断记录都会覆盖该索引及之后的日志
+            for (auto iter = found.lower_bound(record.index); iter != found.end(); iter = found.erase(iter)) {
+                bytes -= static_cast<int64_t>(iter->second.data.size());
+            }
+            if (record.truncate || record.index < low || record.index >= high) {
+                return;
+            }
+            // 超过上限之后不再保留之后的日志；后面的段仍然要扫描，覆盖已经保留的日志的记录还要生效
+            const auto size = static_cast<int64_t>(record.entry.data.size());
+            if (!found.empty() && bytes + size > maxBytes) {
+                high = record.index;
+                return;
+            }
+            bytes += size;
+            found.emplace(record.index, std::move(record.entry));
+        });
+    }
+    return found;
+}
+
+size_t WAL::decode(const std::string& data, const std::filesystem::path& path, const std::function<void(Record&)>& callback) {
+    size_t pos = 0;
+    while (pos + RECORD_HEADER_SIZE <= data.size()) {
+        uint32_t length;
+        uint32_t crc;
+        memcpy(&length, &data[pos], sizeof(length));
+        memcpy(&crc, &data[pos + sizeof(length)], sizeof(crc));
+        length = EndianCast(length);
+        crc = EndianCast(crc);
+        if (length == 0 || pos + RECORD_HEADER_SIZE + length > data.size()) {
+            break;
+        }
+        const char* body = &data[pos + RECORD_HEADER_SIZE];
+        if (Crc32(body, length) != crc) {
+            break;
+        }
+        pos += RECORD_HEADER_SIZE + length;
+
+        rpc::Serializer s(body + 1, static_cast<int>(length - 1));
+        Record record;
+        const auto type = static_cast<RecordType>(body[0]);
+        if (type == GROUP_ENTRY || type == GROUP_TRUNCATE) {
+            s >> record.group;
+        }
+        if (type == ENTRY || type == GROUP_ENTRY) {
+            s >> record.entry;
+            record.index = record.entry.index;
+        } else if (type == TRUNCATE || type == GROUP_TRUNCATE) {
+            s >> record.index;
+            record.truncate = true;
+        } else {
+            SPDLOG_LOGGER_WARN(Logger, "unexpected wal record type {} in {}", static_cast<int>(type), path.string());
+            continue;
+        }
+        callback(record);
+    }
+    return pos;
+}
+
+bool WAL::load() {
+    m_loaded = true;
+    if (!std::filesystem::exists(m_dir)) {
+        std::filesystem::create_directories(m_dir);
+        return true;
+    }
+
+    // 收集所有段文件，按序号升序排列
+    for (auto& iter : std::filesystem::directory_iterator(m_dir)) {
+        if (iter.status().type() != std::filesystem::file_type::regular) {
+            continue;
+        }
+        std::string name = iter.path().filename().string();
+        int64_t seq = 0;
+        int64_t first = 0;
+        if (!name.ends_with(m_suffix) || sscanf(name.c_str(), "%ld-%ld", &seq, &first) != 2) {
+            SPDLOG_LOGGER_WARN(Logger, "skip unexpected non wal file {}", name);
+            continue;
+        }
+        m_segments.push_back(Segment{.seq = seq, .maxIndex = {}, .size = 0, .path = iter.path()});
+    }
+    std::sort(m_segments.begin(), m_segments.end(), [](const Segment& a, const Segment& b) {
+        return a.seq < b.seq;
+    });
+
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        Segment& segment = m_segments[i];
+        std::ifstream in(segment.path, std::ios::binary);
+        std::string data(std::istreambuf_iterator<char>(in), {});
+
+        size_t pos = decode(data, segment.path, [&](Record& record) {
+            int64_t& maxIndex = segment.maxIndex[record.group];
+            maxIndex = std::max(maxIndex, record.index);
+            m_lastIndex[record.group] = record.truncate ? record.index - 1 : record.index;
+        });
+
+        if (pos != data.size()) {
+            if (i + 1 != m_segments.size()) {
+                SPDLOG_LOGGER_CRITICAL(Logger, "wal segment {} is corrupted at offset {}", segment.path.string(), pos);
+                return false;
+            }
+            // 最后一个段的尾部是崩溃时写了一半的记录，直接截掉
+            SPDLOG_LOGGER_WARN(Logger, "truncate torn record of wal segment {} at offset {}", segment.path.string(), pos);
+            std::filesystem::resize_file(segment.path, pos);
+        }
+        segment.size = static_cast<int64_t>(pos);
+        m_size += segment.size;
+    }
+    // 重启之后每个组的快照还没有加载，全部当作没有被快照覆盖，下一次快照之后再删除旧的段
+    for (auto& iter : m_lastIndex) {
+        m_pendingSize[iter.first] = m_size;
+    }
+
+    if (!m_segments.empty()) {
+        m_fd = open(m_segments.back().path.c_str(), O_WRONLY | O_APPEND);
+        if (m_fd < 0) {
+            SPDLOG_LOGGER_ERROR(Logger, "open wal segment {} failed", m_segments.back().path.string());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WAL::cut() {
+    int64_t seq = m_segments.empty() ? 0 : m_segments.back().seq + 1;
+    // 段名格式 %016ld-%016ld.wal
+    std::unique_ptr<char[]> name = std::make_unique<char[]>(16 + 1 + 16 + m_suffix.size() + 1);
+    sprintf(&name[0], "%016ld-%016ld%s", seq, lastIndex(0) + 1, m_suffix.c_str());
+    std::filesystem::path path = m_dir / name.get();
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) {
+        SPDLOG_LOGGER_ERROR(Logger, "create wal segment {} failed", path.string());
+        return false;
+    }
+
+    // 新建的文件需要对目录刷盘，否则崩溃后目录项可能丢失
+    if (!SyncDir(m_dir)) {
+        close(fd);
+        return false;
+    }
+
+    if (m_fd >= 0) {
+        // 旧的段不会再写入，关闭前刷盘
+        if (fdatasync(m_fd) < 0) {
+            SPDLOG_LOGGER_ERROR(Logger, "fdatasync wal segment {} failed: {}", m_segments.back().path.string(), strerror(errno));
+            close(fd);
+            return false;
+        }
+        close(m_fd);
+    }
+    m_fd = fd;
+    m_segments.push_back(Segment{.seq = seq, .maxIndex = {}, .size = 0, .path = path});
+    return true;
+}
+
+void WAL::encodeRecord(std::string& buf, int64_t group, bool truncate, const std::function<void(rpc::Serializer&)>& payload) {
+    // 组 0 使用不带组号的记录，和只有一个组的格式相同
+    RecordType type;
+    rpc::Serializer s;
+    if (group == 0) {
+        type = truncate ? TRUNCATE : ENTRY;
+    } else {
+        type = truncate ? GROUP_TRUNCATE : GROUP_ENTRY;
+        s << group;
+    }
+    payload(s);
+    s.reset();
+
+    std::string body;
+    std::string data = s.toString();
+    body.reserve(data.size() + 1);
+    body.push_back(static_cast<char>(type));
+    body += data;
+
+    uint32_t length = EndianCast(static_cast<uint32_t>(body.size()));
+    uint32_t crc = EndianCast(Crc32(body.data(), body.size()));
+    buf.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    buf.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    buf += body;
+}
+
+bool WAL::write(const std::string& buf) {
+    size_t written = 0;
+    while (written < buf.size()) {
+        ssize_t n = ::write(m_fd, buf.data() + written, buf.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            SPDLOG_LOGGER_ERROR(Logger, "write wal segment {} failed: {}", m_segments.back().path.string(), strerror(errno));
+            return false;
+        }
+        written += n;
+    }
+    m_segments.back().size += static_cast<int64_t>(buf.size());
+    m_size += static_cast<int64_t>(buf.size());
+    return true;
+}
+
+} // namespace RR::raft
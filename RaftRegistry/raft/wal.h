@@ -0,0 +1,193 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_RAFT_WAL_H
+#define RR_RAFT_WAL_H
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include "entry.h"
+
+namespace RR::raft {
+
+/**
+ * @brief 分段的预写日志（write-ahead log）
+ *
+ * @details 日志被切分为多个固定大小的段文件，文件名格式为 %016ld-%016ld.wal（段序号-创建时组 0 的下一个日志索引）。
+ *          每次持久化只把新追加的日志以记录的形式追加到当前段的末尾，然后 fdatasync，
+ *          所以一次持久化的开销只和追加的日志量有关，和日志总量无关。
+ *          一个 WAL 可以被多个 raft 组共享，所有组的记录写进同一个段，一次 fdatasync 持久化所有组的日志。
+ *
+ *          每条记录的格式为：
+ *          +----------------+----------------+--------+-------------------------+
+ *          |  length(u32)   |   crc32(u32)   |  type  |      payload byte[]     |
+ *          +----------------+----------------+--------+-------------------------+
+ *          length 为 type + payload 的长度，crc32 为 type + payload 的校验和。
+ *          ENTRY 记录的 payload 为一个序列化的 Entry；
+ *          TRUNCATE 记录的 payload 为一个 int64 索引，表示该索引及其之后的日志被覆盖（日志冲突时产生）。
+ *          这两种记录属于组 0，和只有一个组的格式相同；其他组使用 GROUP_ENTRY 和 GROUP_TRUNCATE，payload 前面多一个 int64 组号。
+ *          WAL 没有单独的版本号，记录或者 Entry 的格式变化时需要增加 Persister::FORMAT_VERSION。
+ *
+ * @note 不是线程安全的，由 SharedWAL 加锁保护
+ */
+class WAL {
+public:
+    enum RecordType : uint8_t {
+        ENTRY = 1,
+        TRUNCATE = 2,
+        GROUP_ENTRY = 3,
+        GROUP_TRUNCATE = 4
+    };
+
+    explicit WAL(const std::filesystem::path& dir);
+
+    ~WAL();
+
+    /**
+     * @brief 回放所有段，恢复一个组的日志
+     *
+     * @param group 组号
+     * @param lastSnapshotIndex 快照中最后一条日志的索引，该索引及之前的日志会被跳过
+     * @param lastSnapshotTerm 快照中最后一条日志的任期
+     * @return 第一个元素为快照的最后一条日志（只有index和term），之后为快照之后的日志；
+     *         如果 WAL 中没有该组的记录并且没有快照，返回 std::nullopt；段文件损坏时也返回 std::nullopt
+     */
+    std::optional<std::vector<Entry>> readAll(int64_t group, int64_t lastSnapshotIndex = 0, int64_t lastSnapshotTerm = 0);
+
+    /**
+     * @brief 追加一个组的日志，不刷盘
+     *
+     * @details 如果 entries 的第一条日志的索引不大于该组已写入的最后一条日志的索引，说明发生了日志覆盖，
+     *          会先写入一条截断记录
+     */
+    bool append(int64_t group, const std::vector<Entry>& entries);
+
+    /**
+     * @brief 将当前段刷盘，之前 append 的日志全部持久化
+     */
+    bool sync();
+
+    /**
+     * @brief 追加一个组的日志并刷盘
+     */
+    bool save(int64_t group, const std::vector<Entry>& entries) {
+        return append(group, entries) && sync();
+    }
+
+    /**
+     * @brief 从段文件中读取一个组 [low, high) 的日志，截断记录和回放时一样生效
+     *
+     * @details 用于读取已经从内存中淘汰的日志，需要扫描可能包含这些日志的段，开销较大
+     * @param maxBytes 日志数据的总字节数上限，至少返回一条日志
+     * @return 按索引升序排列的日志，WAL 中没有的日志不会出现在结果里
+     */
+    std::vector<Entry> read(int64_t group, int64_t low, int64_t high, int64_t maxBytes = INT64_MAX);
+
+    /**
+     * @brief 记录一个组索引不大于 index 的日志已经被快照覆盖，并删除所有组的记录都已经被快照覆盖的段（不包括正在写入的段）
+     * @note 必须在包含 index 的快照持久化之后调用
+     */
+    void release(int64_t group, int64_t index);
+
+    /**
+     * @brief 所有段文件的总字节数
+     */
+    int64_t size() const { return m_size; }
+
+    /**
+     * @brief 一个组上一次 release 之后写入的字节数，即该组还没有被快照覆盖的日志大小
+     */
+    int64_t pendingSize(int64_t group) const;
+
+    /**
+     * @brief 拖住旧段的组：组的日志还没有被快照覆盖，而日志所在的段之后已经有超过上限（raft.wal.max_pinned_segments）个段
+     * @details 写入很少的组很久都达不到快照的阈值，但它的日志会让所有组共享的段都无法删除，这些组需要尽快做快照
+     * @return key 为组号，value 为该组拖住的最旧的段的序号
+     */
+    std::map<int64_t, int64_t> pinned() const;
+
+    /**
+     * @brief 一个组已写入的最后一条日志的索引
+     */
+    int64_t lastIndex(int64_t group) const;
+
+private:
+    struct Segment {
+        // 段序号，单调递增
+        int64_t seq;
+        // 段内每个组的日志的最大索引，截断记录的索引也计算在内，key 为组号
+        std::map<int64_t, int64_t> maxIndex;
+        // 段文件大小
+        int64_t size;
+        std::filesystem::path path;
+    };
+
+    // 解码之后的一条记录
+    struct Record {
+        int64_t group = 0;
+        // 截断记录为 true，此时只有 index 有效
+        bool truncate = false;
+        int64_t index = 0;
+        Entry entry;
+    };
+
+    /**
+     * @brief 扫描所有段，恢复段的元数据和每个组的最后一条日志的索引，截掉最后一个段尾部写了一半的记录
+     */
+    bool load();
+
+    /**
+     * @brief 依次解码 data 中的记录，遇到不完整或者校验失败的记录时停止，无法识别的记录会被跳过
+     * @return 最后一条完整记录之后的偏移
+     */
+    static size_t decode(const std::string& data, const std::filesystem::path& path, const std::function<void(Record&)>& callback);
+
+    /**
+     * @brief 回放一个组 [low, high) 的日志，skip 为 true 时跳过最大索引小于 low 的段
+     * @details 保留的日志数据超过 maxBytes 之后缩小 high，不再保留之后的日志，至少保留一条
+     */
+    std::map<int64_t, Entry> replay(int64_t group, int64_t low, int64_t high, bool skip, int64_t maxBytes = INT64_MAX);
+
+    /**
+     * @brief 创建一个新的段并作为当前写入段
+     */
+    bool cut();
+
+    /**
+     * @brief 将一条记录追加到缓冲区
+     */
+    static void encodeRecord(std::string& buf, int64_t group, bool truncate, const std::function<void(rpc::Serializer&)>& payload);
+
+    /**
+     * @brief 将缓冲区写入当前段
+     */
+    bool write(const std::string& buf);
+
+private:
+    const std::filesystem::path m_dir;
+    // 按序号升序排列的段，最后一个为当前写入的段
+    std::vector<Segment> m_segments;
+    // 当前写入段的文件描述符
+    int m_fd = -1;
+    // 是否已经扫描过段文件
+    bool m_loaded = false;
+    // 每个组已写入的最后一条日志的索引，key 为组号
+    std::map<int64_t, int64_t> m_lastIndex;
+    // 每个组已经被快照覆盖的最大索引
+    std::map<int64_t, int64_t> m_released;
+    // 每个组上一次 release 之后写入的字节数
+    std::map<int64_t, int64_t> m_pendingSize;
+    // 所有段的总大小
+    int64_t m_size = 0;
+    const std::string m_suffix = ".wal";
+};
+
+} // namespace RR::raft
+
+#endif // RR_RAFT_WAL_H
@@ -89,7 +89,7 @@ bool RpcClient::connect(Address::ptr address) {
     // 如果启用自动心跳，设置心跳定时器
     if (m_autoHeartbeat) {
         // 设置心跳包发送定时器，每30秒执行一次
-        m_heartTimer = CycleTimer(30'000, [this] {
+        m_heartTimer = TimerWheel::GetInstance().addTimer(30'000, [this] {
             SPDLOG_LOGGER_DEBUG(Logger, "heart beat");
             if (m_isHeartClose) { // 如果之前的心跳包没有收到响应，则认为服务器已关闭
                 SPDLOG_LOGGER_DEBUG(Logger, "server closed");
@@ -12,6 +12,7 @@
 #include <string>
 #include <map>
 #include "RaftRegistry/common/util.h"
+#include "RaftRegistry/common/timer_wheel.h"
 #include "RaftRegistry/rpc/rpc_session.h"
 #include "RaftRegistry/rpc/protocol.h"
 #include "RaftRegistry/rpc/serializer.h"
@@ -326,7 +327,7 @@ private:
     // 消息发送通道，用于收集外部请求并发送给服务器
     co::co_chan<Protocol::ptr> m_chan;
     // 心跳定时器，用于定期发送心跳包维持连接
-    CycleTimerTocken m_heartTimer;
+    WheelTimer m_heartTimer;
     // 订阅监听器
     PubsubListener::ptr m_listener;
     // 订阅的频道, key 为频道名，value 为订阅的频道；其中 value 为 true 表示协程主动取消订阅， false 表示订阅有客户端关闭而被动种植
@@ -88,7 +88,7 @@ void RpcServer::start() {
         m_registry->getSocket()->setRecvTimeout(30'000); // 设置注册中心socket的接收超时时间
 
         // 设置心跳包定时器，每30秒向注册中心发送一次心跳包
-        m_heartbeatTimer = CycleTimer(30'000, [this] {
+        m_heartbeatTimer = TimerWheel::GetInstance().addTimer(30'000, [this] {
             SPDLOG_LOGGER_DEBUG(Logger, "heartbeat");
             // 创建心跳包协议消息
             Protocol::ptr proto = Protocol::Create(Protocol::MsgType::HEARTBEAT_PACKET,"");
@@ -226,8 +226,8 @@ void RpcServer::handleClient(Socket::ptr client) {
         SPDLOG_LOGGER_DEBUG(Logger, "client: {} closed", client->toString());
         client->close(); // 关闭客户端socket// 关闭客户端socket
     };
-    // 开启心跳定时器，设置超时时间为m_aliveTime
-    co_timer_id heartTimer = m_timer.ExpireAt(std::chrono::milliseconds(m_aliveTime), on_close); // 创建一个定时器
+    // 开启心跳定时器，设置超时时间为m_aliveTime，只触发一次
+    WheelTimer heartTimer = TimerWheel::GetInstance().addTimer(m_aliveTime, on_close, 1);
 
     // 创建协程通道，用于限制并发处理客户端请求数量
     co::co_chan<bool> wait_queue(s_concurrent_number);
@@ -235,6 +235,7 @@ void RpcServer::handleClient(Socket::ptr client) {
     while (true) {
         Protocol::ptr request = session->recvProtocol(); // 接收客户端请求
         if (!request) { // 如果接收失败
+            heartTimer.stop(); // 连接已经关闭，不再需要超时检测
             client->close(); // 关闭客户端socket
             break; // 退出循环
         }
@@ -242,9 +243,8 @@ void RpcServer::handleClient(Socket::ptr client) {
         // 将true发送到协程通道，如果通道已满，则协程会等待
         wait_queue << true;
 
-        // 更新心跳定时器，防止连接因超时而关闭
-        heartTimer.StopTimer(); // 停止当前的计时器
-        heartTimer = m_timer.ExpireAt(std::chrono::milliseconds(m_aliveTime), on_close); // 创建新的定时器;
+        // 更新心跳定时器，防止连接因超时而关闭；在时间轮上重新计时，不用每个请求都创建新的定时器
+        heartTimer.reset();
         
         go [request, client, session, wait_queue, this] {
             wait_queue >> nullptr; // 从协程通道中取出一个值
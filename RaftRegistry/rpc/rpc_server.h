@@ -10,6 +10,7 @@
 #include "RaftRegistry/rpc/rpc_session.h"
 #include "RaftRegistry/net/address.h"
 #include "RaftRegistry/common/traits.h"
+#include "RaftRegistry/common/timer_wheel.h"
 #include "RaftRegistry/rpc/rpc.h"
 #include "RaftRegistry/rpc/protocol.h"
 #include <functional>
@@ -180,7 +181,7 @@ private:
     // 服务中心连接
     RpcSession::ptr m_registry;
     // 服务中心心跳定时器
-    CycleTimerTocken m_heartbeatTimer;
+    WheelTimer m_heartbeatTimer;
     // 开放服务端口
     uint32_t m_port;
     // 和客户端的心跳时间， 默认40s
@@ -0,0 +1,41 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#ifndef RR_TESTS_CHECK_H
+#define RR_TESTS_CHECK_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+/**
+ * @brief 条件不成立时打印位置并退出，和 assert 不同，不受 NDEBUG 影响
+ */
+#define RR_CHECK(cond)                                                                      \
+    do {                                                                                    \
+        if (!(cond)) {                                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);        \
+            exit(EXIT_FAILURE);                                                             \
+        }                                                                                   \
+    } while (0)
+
+#define RR_CHECK_EQ(a, b) RR_CHECK((a) == (b))
+
+namespace RR::test {
+
+/**
+ * @brief 在系统临时目录下创建一个空目录，已经存在时先删除
+ */
+inline std::filesystem::path TempDir(const std::string& name) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / ("rr-" + name + "-" + std::to_string(getpid()));
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return dir;
+}
+
+} // namespace RR::test
+
+#endif // RR_TESTS_CHECK_H
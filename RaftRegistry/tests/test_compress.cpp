@@ -0,0 +1,89 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include <random>
+#include "RaftRegistry/common/compress.h"
+#include "check.h"
+
+using namespace RR;
+
+namespace {
+
+void CheckRoundTrip(const std::string& data) {
+    for (Codec codec : {Codec::None, Codec::LZ}) {
+        std::string compressed = Compress(codec, data);
+        auto raw = Decompress(codec, compressed);
+        RR_CHECK(raw);
+        RR_CHECK(*raw == data);
+    }
+}
+
+std::string RandomBytes(std::mt19937& rng, size_t size) {
+    std::string data(size, '\0');
+    for (char& c : data) {
+        c = static_cast<char>(rng());
+    }
+    return data;
+}
+
+/**
+ * @brief 各种长度和重复程度的数据压缩之后都能解压回原样
+ */
+void TestRoundTrip() {
+    std::mt19937 rng(20261016);
+    CheckRoundTrip("");
+    CheckRoundTrip("a");
+    CheckRoundTrip("abc");
+    CheckRoundTrip(std::string(1 << 20, 'x'));
+
+    // 重复较多的文本，压缩之后明显变小
+    std::string json;
+    for (int i = 0; i < 2000; ++i) {
+        json += R"({"service":"registry","instance":")" + std::to_string(i % 17) + R"(","status":"UP"},)";
+    }
+    CheckRoundTrip(json);
+    RR_CHECK(Compress(Codec::LZ, json).size() < json.size() / 4);
+
+    // 匹配跨过很长的距离、字面量和匹配交替出现
+    for (size_t size : {15, 16, 255, 256, 4096, 70000}) {
+        std::string block = RandomBytes(rng, size);
+        CheckRoundTrip(block + "separator" + block + block.substr(0, size / 2));
+    }
+}
+
+/**
+ * @brief 不可压缩的数据也能解压回原样，只多出很少的字节
+ */
+void TestIncompressible() {
+    std::mt19937 rng(42);
+    for (size_t size : {1, 7, 64, 1000, 65536, 1 << 20}) {
+        std::string data = RandomBytes(rng, size);
+        CheckRoundTrip(data);
+        RR_CHECK(Compress(Codec::LZ, data).size() <= data.size() + data.size() / 255 + 16);
+    }
+}
+
+/**
+ * @brief 损坏的数据解压失败，不会越界或者分配过大的内存
+ */
+void TestCorrupted() {
+    std::string json(4096, '{');
+    std::string compressed = Compress(Codec::LZ, json);
+    RR_CHECK(!Decompress(Codec::LZ, compressed.substr(0, 2)));
+    RR_CHECK(!Decompress(Codec::LZ, compressed.substr(0, compressed.size() - 1)));
+    // 原始长度被改成很大的值
+    std::string huge = compressed;
+    huge[0] = '\x7f';
+    RR_CHECK(!Decompress(Codec::LZ, huge));
+    RR_CHECK(!Decompress(static_cast<Codec>(200), compressed));
+}
+
+} // namespace
+
+int main() {
+    TestRoundTrip();
+    TestIncompressible();
+    TestCorrupted();
+    return 0;
+}
@@ -0,0 +1,96 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include "RaftRegistry/raft/progress.h"
+#include "check.h"
+
+using namespace RR::raft;
+
+namespace {
+
+/**
+ * @brief 数量达到上限时满，释放之后可以继续添加，环形缓冲区绕回之后顺序不变
+ */
+void TestCount() {
+    Inflights inflights(3);
+    RR_CHECK(!inflights.full());
+    inflights.add(10);
+    inflights.add(20);
+    inflights.add(30);
+    RR_CHECK(inflights.full());
+    RR_CHECK_EQ(inflights.count(), 3u);
+    // 满了之后的添加被忽略
+    inflights.add(40);
+    RR_CHECK_EQ(inflights.count(), 3u);
+
+    // 只释放最后一条日志的索引不大于 index 的请求
+    inflights.freeTo(15);
+    RR_CHECK_EQ(inflights.count(), 2u);
+    RR_CHECK(!inflights.full());
+    inflights.freeTo(15);
+    RR_CHECK_EQ(inflights.count(), 2u);
+
+    // 绕回缓冲区的开头
+    inflights.add(40);
+    RR_CHECK(inflights.full());
+    inflights.freeTo(30);
+    RR_CHECK_EQ(inflights.count(), 1u);
+    inflights.add(50);
+    inflights.add(60);
+    RR_CHECK(inflights.full());
+    inflights.freeTo(50);
+    RR_CHECK_EQ(inflights.count(), 1u);
+    inflights.freeTo(100);
+    RR_CHECK_EQ(inflights.count(), 0u);
+
+    inflights.add(70);
+    inflights.reset();
+    RR_CHECK_EQ(inflights.count(), 0u);
+    RR_CHECK(!inflights.full());
+}
+
+/**
+ * @brief 字节数达到上限时也算满，释放请求时扣掉对应的字节数
+ */
+void TestBytes() {
+    Inflights inflights(10, 100);
+    inflights.add(1, 40);
+    inflights.add(2, 40);
+    RR_CHECK(!inflights.full());
+    RR_CHECK_EQ(inflights.bytes(), 80);
+    inflights.add(3, 20);
+    RR_CHECK(inflights.full());
+    RR_CHECK_EQ(inflights.bytes(), 100);
+
+    inflights.freeTo(1);
+    RR_CHECK(!inflights.full());
+    RR_CHECK_EQ(inflights.bytes(), 60);
+    // 单个请求超过上限也会被记录，之后暂停发送
+    inflights.add(4, 500);
+    RR_CHECK(inflights.full());
+    RR_CHECK_EQ(inflights.bytes(), 560);
+    inflights.freeTo(4);
+    RR_CHECK_EQ(inflights.count(), 0u);
+    RR_CHECK_EQ(inflights.bytes(), 0);
+
+    // 上限为 0 时不限制字节数
+    Inflights unlimited(2, 0);
+    unlimited.add(1, 1 << 30);
+    RR_CHECK(!unlimited.full());
+    unlimited.add(2, 1);
+    RR_CHECK(unlimited.full());
+
+    inflights.add(5, 100);
+    inflights.reset();
+    RR_CHECK_EQ(inflights.bytes(), 0);
+    RR_CHECK(!inflights.full());
+}
+
+} // namespace
+
+int main() {
+    TestCount();
+    TestBytes();
+    return 0;
+}
@@ -0,0 +1,158 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include <fstream>
+#include "RaftRegistry/raft/persister.h"
+#include "check.h"
+
+using namespace RR;
+using namespace RR::raft;
+
+namespace {
+
+// 最初的单文件格式中的日志
+struct LegacyEntry {
+    int64_t index = 0;
+    int64_t term = 0;
+    std::string data;
+
+    friend rpc::Serializer& operator << (rpc::Serializer& s, const LegacyEntry& e) {
+        s << e.index << e.term << e.data;
+        return s;
+    }
+};
+
+void WriteFile(const std::filesystem::path& path, rpc::Serializer& s) {
+    s.reset();
+    std::string data = s.toString();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+/**
+ * @brief 写入旧格式的 raft_state：硬状态 + 全部日志，第一条日志是快照最后一条日志的占位
+ */
+void WriteLegacyState(const std::filesystem::path& dir, const HardState& hs, int64_t lastSnapshotIndex, int64_t lastSnapshotTerm, int64_t last) {
+    std::vector<LegacyEntry> entries{LegacyEntry{.index = lastSnapshotIndex, .term = lastSnapshotTerm}};
+    for (int64_t i = lastSnapshotIndex + 1; i <= last; ++i) {
+        entries.push_back(LegacyEntry{.index = i, .term = hs.term, .data = "legacy " + std::to_string(i)});
+    }
+    rpc::Serializer s;
+    s << hs << entries;
+    WriteFile(dir / "raft_state", s);
+}
+
+/**
+ * @brief 写入旧格式的快照文件：meta + data，没有压缩编码
+ */
+void WriteLegacySnapshot(const std::filesystem::path& dir, int64_t index, int64_t term, const std::string& data) {
+    std::filesystem::create_directories(dir / "snapshot");
+    char name[64];
+    snprintf(name, sizeof(name), "%016ld-%016ld.snap", term, index);
+    rpc::Serializer s;
+    s << SnapshotMeta{.index = index, .term = term} << data;
+    WriteFile(dir / "snapshot" / name, s);
+}
+
+void CheckVersion(const std::filesystem::path& dir) {
+    std::ifstream in(dir / "version");
+    uint32_t version = 0;
+    RR_CHECK(in >> version);
+    RR_CHECK_EQ(version, Persister::FORMAT_VERSION);
+    RR_CHECK(!std::filesystem::exists(dir / "raft_state"));
+    RR_CHECK(!std::filesystem::exists(dir / "snapshot.v0"));
+}
+
+void CheckEntries(Persister& persister, int64_t lastSnapshotIndex, int64_t lastSnapshotTerm, int64_t last, int64_t term) {
+    auto entries = persister.loadEntries();
+    RR_CHECK(entries);
+    RR_CHECK_EQ(entries->size(), static_cast<size_t>(last - lastSnapshotIndex + 1));
+    RR_CHECK_EQ(entries->front().index, lastSnapshotIndex);
+    RR_CHECK_EQ(entries->front().term, lastSnapshotTerm);
+    for (size_t i = 1; i < entries->size(); ++i) {
+        const Entry& entry = (*entries)[i];
+        RR_CHECK_EQ(entry.index, lastSnapshotIndex + static_cast<int64_t>(i));
+        RR_CHECK_EQ(entry.term, term);
+        RR_CHECK(entry.data.view() == "legacy " + std::to_string(entry.index));
+    }
+}
+
+/**
+ * @brief 只有 raft_state 时迁移硬状态和全部日志
+ */
+void TestMigrateWithoutSnapshot() {
+    auto dir = test::TempDir("persister-legacy");
+    const HardState hs{.term = 3, .vote = 2, .commit = 4};
+    WriteLegacyState(dir, hs, 0, 0, 6);
+    {
+        Persister persister(dir);
+        CheckVersion(dir);
+        RR_CHECK(persister.loadHardState() == hs);
+        RR_CHECK(!persister.loadSnapshot());
+        CheckEntries(persister, 0, 0, 6, 3);
+    }
+    // 迁移之后按当前格式直接打开
+    Persister persister(dir);
+    RR_CHECK(persister.loadHardState() == hs);
+    CheckEntries(persister, 0, 0, 6, 3);
+    std::filesystem::remove_all(dir);
+}
+
+/**
+ * @brief 有旧快照时快照写成当前格式，WAL 中只保留快照之后的日志
+ */
+void TestMigrateWithSnapshot() {
+    auto dir = test::TempDir("persister-legacy-snap");
+    const HardState hs{.term = 5, .vote = 1, .commit = 8};
+    WriteLegacyState(dir, hs, 3, 2, 9);
+    // 旧的快照比 raft_state 中的快照占位更新，更早的日志也要跳过
+    WriteLegacySnapshot(dir, 2, 2, "old state");
+    WriteLegacySnapshot(dir, 5, 5, "kv state");
+    {
+        Persister persister(dir);
+        CheckVersion(dir);
+        RR_CHECK(persister.loadHardState() == hs);
+        auto snapshot = persister.loadSnapshot();
+        RR_CHECK(snapshot);
+        RR_CHECK_EQ(snapshot->metadata.index, 5);
+        RR_CHECK_EQ(snapshot->metadata.term, 5);
+        RR_CHECK_EQ(snapshot->data, "kv state");
+        CheckEntries(persister, 5, 5, 9, 5);
+    }
+    Persister persister(dir);
+    auto snapshot = persister.loadSnapshot();
+    RR_CHECK(snapshot);
+    RR_CHECK_EQ(snapshot->metadata.index, 5);
+    CheckEntries(persister, 5, 5, 9, 5);
+    std::filesystem::remove_all(dir);
+}
+
+/**
+ * @brief 迁移中途崩溃：快照目录已经改名，但版本文件还没有写入，下次启动从头重新迁移
+ */
+void TestResumeMigration() {
+    auto dir = test::TempDir("persister-legacy-resume");
+    const HardState hs{.term = 4, .vote = 3, .commit = 6};
+    WriteLegacyState(dir, hs, 0, 0, 7);
+    WriteLegacySnapshot(dir, 2, 4, "kv state");
+    std::filesystem::rename(dir / "snapshot", dir / "snapshot.v0");
+    Persister persister(dir);
+    CheckVersion(dir);
+    RR_CHECK(persister.loadHardState() == hs);
+    auto snapshot = persister.loadSnapshot();
+    RR_CHECK(snapshot);
+    RR_CHECK_EQ(snapshot->metadata.index, 2);
+    RR_CHECK_EQ(snapshot->data, "kv state");
+    CheckEntries(persister, 2, 4, 7, 4);
+    std::filesystem::remove_all(dir);
+}
+
+} // namespace
+
+int main() {
+    TestMigrateWithoutSnapshot();
+    TestMigrateWithSnapshot();
+    TestResumeMigration();
+    return 0;
+}
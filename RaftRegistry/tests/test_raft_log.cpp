@@ -0,0 +1,146 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include <random>
+#include <fmt/format.h>
+#include "RaftRegistry/common/config.h"
+#include "RaftRegistry/raft/raft_log.h"
+#include "RaftRegistry/raft/wal.h"
+#include "check.h"
+
+using namespace RR;
+using namespace RR::raft;
+
+namespace {
+
+// 每条日志的数据都是 100 字节
+std::string EntryData(int64_t index) {
+    return fmt::format("{:0>100}", index);
+}
+
+void CheckEntries(const std::vector<Entry>& entries, int64_t low, size_t count) {
+    RR_CHECK_EQ(entries.size(), count);
+    for (size_t i = 0; i < count; ++i) {
+        RR_CHECK_EQ(entries[i].index, low + static_cast<int64_t>(i));
+        RR_CHECK(entries[i].data.view() == EntryData(entries[i].index));
+    }
+}
+
+/**
+ * @brief 淘汰的日志从 WAL 中读回来，读取时就按字节数限制，至少返回一条
+ */
+void TestEvictedSlice() {
+    Config::LookUp<uint64_t>("raft.log.cache_bytes")->setValue(300);
+    auto dir = test::TempDir("raft-log-evict");
+    // 先写入版本文件，再直接写 WAL，重启之后的日志都已经落盘
+    {
+        Persister persister(dir);
+    }
+    {
+        std::vector<Entry> entries;
+        for (int64_t i = 1; i <= 20; ++i) {
+            entries.push_back(Entry{.index = i, .term = 1, .data = Payload(EntryData(i))});
+        }
+        WAL wal(dir / "wal");
+        RR_CHECK(wal.save(0, entries));
+    }
+
+    auto persister = std::make_shared<Persister>(dir);
+    RaftLog log(persister);
+    RR_CHECK_EQ(log.lastIndex(), 20);
+    log.commitTo(20);
+    // 应用之后只在内存中保留 300 字节，[1, 17] 被淘汰
+    log.appliedTo(20);
+
+    CheckEntries(log.entries(1, RaftLog::NO_LIMIT), 1, 20);
+    CheckEntries(log.entries(1, 250), 1, 2);
+    // 单条日志超过上限也会返回
+    CheckEntries(log.entries(1, 50), 1, 1);
+    // 跨过淘汰的边界：16、17 从 WAL 读取，18 在内存中
+    CheckEntries(log.entries(16, 350), 16, 3);
+    CheckEntries(log.entries(18, 150), 18, 1);
+    CheckEntries(log.slice(5, 10, 3), 5, 3);
+    CheckEntries(log.slice(5, 10, RaftLog::NO_LIMIT, 0), 5, 1);
+    CheckEntries(log.slice(15, 21, RaftLog::NO_LIMIT), 15, 6);
+    std::filesystem::remove_all(dir);
+}
+
+/**
+ * @brief 原来的做法：从 prevLogIndex 开始逐条向前比较任期，找到冲突任期的第一条日志
+ */
+int64_t LinearFindConflict(RaftLog& log, int64_t prevLogIndex) {
+    if (prevLogIndex > log.lastIndex()) {
+        return log.lastIndex() + 1;
+    }
+    const int64_t conflictTerm = log.term(prevLogIndex);
+    int64_t index = prevLogIndex;
+    while (index - 1 >= log.firstIndex() && log.term(index - 1) == conflictTerm) {
+        --index;
+    }
+    return index;
+}
+
+void CheckFindConflict(RaftLog& log) {
+    for (int64_t index = log.firstIndex(); index <= log.lastIndex() + 2; ++index) {
+        RR_CHECK_EQ(log.findConflict(index, log.term(index) + 1), LinearFindConflict(log, index));
+    }
+}
+
+/**
+ * @brief 按任期起始索引定位的结果和逐条比较的结果相同，包括压缩和覆盖日志之后
+ */
+void TestFindConflict() {
+    std::mt19937 rng(20261016);
+    for (int round = 0; round < 50; ++round) {
+        auto dir = test::TempDir("raft-log-conflict");
+        {
+            Persister persister(dir);
+        }
+        const int64_t last = std::uniform_int_distribution<int64_t>(1, 60)(rng);
+        int64_t term = 1;
+        {
+            std::vector<Entry> entries;
+            for (int64_t i = 1; i <= last; ++i) {
+                // 大约每 3 条日志换一个任期，任期可能跳过几个
+                if (rng() % 3 == 0) {
+                    term += 1 + rng() % 3;
+                }
+                entries.push_back(Entry{.index = i, .term = term});
+            }
+            WAL wal(dir / "wal");
+            RR_CHECK(wal.save(0, entries));
+        }
+
+        RaftLog log(std::make_shared<Persister>(dir));
+        RR_CHECK_EQ(log.lastIndex(), last);
+        CheckFindConflict(log);
+
+        // 新 leader 的日志覆盖一段后缀
+        const int64_t from = std::uniform_int_distribution<int64_t>(1, last)(rng);
+        const int64_t count = std::uniform_int_distribution<int64_t>(0, 10)(rng);
+        std::vector<Entry> entries;
+        for (int64_t i = from; i < from + count; ++i) {
+            if (rng() % 2 == 0) {
+                ++term;
+            }
+            entries.push_back(Entry{.index = i, .term = term});
+        }
+        log.append(entries);
+        CheckFindConflict(log);
+
+        // 压缩掉一段前缀，快照之前的任期不再参与
+        const int64_t compact = std::uniform_int_distribution<int64_t>(log.firstIndex(), log.lastIndex())(rng);
+        RR_CHECK(log.compact(compact));
+        CheckFindConflict(log);
+        std::filesystem::remove_all(dir);
+    }
+}
+
+} // namespace
+
+int main() {
+    TestEvictedSlice();
+    TestFindConflict();
+    return 0;
+}
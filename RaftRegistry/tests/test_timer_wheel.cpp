@@ -0,0 +1,103 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include <atomic>
+#include <vector>
+#include "RaftRegistry/common/timer_wheel.h"
+#include "check.h"
+
+using namespace RR;
+
+namespace {
+
+// 刻度 10ms，一圈 80ms，间隔更长的定时器要等后面的轮次
+constexpr uint64_t TICK = 10;
+constexpr size_t SLOTS = 8;
+
+/**
+ * @brief 定时器按到期时间的先后触发，包括超过一圈的定时器
+ */
+void TestOrdering() {
+    TimerWheel wheel(TICK, SLOTS);
+    co::co_mutex mutex;
+    std::vector<uint64_t> fired;
+    std::vector<WheelTimer> timers;
+    for (uint64_t interval : {120, 30, 250, 70, 170}) {
+        timers.push_back(wheel.addTimer(interval, [interval, &mutex, &fired] {
+            std::unique_lock<co::co_mutex> lock(mutex);
+            fired.push_back(interval);
+        }, 1));
+    }
+    RR_CHECK_EQ(wheel.size(), 5u);
+    co_sleep(400);
+    std::unique_lock<co::co_mutex> lock(mutex);
+    RR_CHECK((fired == std::vector<uint64_t>{30, 70, 120, 170, 250}));
+    RR_CHECK_EQ(wheel.size(), 0u);
+    for (auto& timer : timers) {
+        RR_CHECK(timer.isCancel());
+    }
+}
+
+/**
+ * @brief 停止的定时器不再触发，回调中可以停止自己，重置之后从现在开始重新计时
+ */
+void TestCancel() {
+    TimerWheel wheel(TICK, SLOTS);
+    std::atomic<int> stopped = 0;
+    std::atomic<int> kept = 0;
+    WheelTimer stop = wheel.addTimer(50, [&stopped] {
+        ++stopped;
+    });
+    WheelTimer keep = wheel.addTimer(50, [&kept] {
+        ++kept;
+    }, 1);
+    stop.stop();
+    RR_CHECK(stop.isCancel());
+    RR_CHECK_EQ(wheel.size(), 1u);
+
+    // 第 3 次触发时在回调中停止自己
+    std::atomic<int> self = 0;
+    auto holder = std::make_shared<WheelTimer>();
+    *holder = wheel.addTimer(20, [&self, holder] {
+        if (++self == 3) {
+            holder->stop();
+        }
+    });
+
+    // 60ms 时重置，原来 100ms 到期，重置之后 160ms 才到期
+    std::atomic<int> reset = 0;
+    WheelTimer delayed = wheel.addTimer(100, [&reset] {
+        ++reset;
+    }, 1);
+    co_sleep(60);
+    delayed.reset();
+    co_sleep(70);
+    RR_CHECK_EQ(reset.load(), 0);
+    co_sleep(150);
+    RR_CHECK_EQ(reset.load(), 1);
+
+    RR_CHECK_EQ(stopped.load(), 0);
+    RR_CHECK_EQ(kept.load(), 1);
+    RR_CHECK_EQ(self.load(), 3);
+    RR_CHECK(holder->isCancel());
+    RR_CHECK_EQ(wheel.size(), 0u);
+    // 停止之后重置不会重新启动
+    stop.reset();
+    RR_CHECK(stop.isCancel());
+    RR_CHECK_EQ(wheel.size(), 0u);
+    // 回调持有自己的定时器，解开循环引用
+    *holder = WheelTimer();
+}
+
+} // namespace
+
+int main() {
+    go [] {
+        TestOrdering();
+        TestCancel();
+        co_sched.Stop();
+    };
+    co_sched.Start();
+    return 0;
+}
@@ -0,0 +1,239 @@
+//
+// File created on: 2026/10/16
+// Author: Zizhou
+
+#include <fstream>
+#include <fmt/format.h>
+#include "RaftRegistry/common/config.h"
+#include "RaftRegistry/raft/wal.h"
+#include "check.h"
+
+using namespace RR;
+using namespace RR::raft;
+
+namespace {
+
+std::vector<Entry> MakeEntries(int64_t low, int64_t high, int64_t term) {
+    std::vector<Entry> entries;
+    for (int64_t i = low; i < high; ++i) {
+        entries.push_back(Entry{.index = i, .term = term, .data = Payload(fmt::format("entry {} of term {}", i, term))});
+    }
+    return entries;
+}
+
+/**
+ * @brief 检查 entries 中从 pos 开始的日志是 [low, high)，任期为 term，数据和 MakeEntries 生成的一致
+ */
+void CheckEntries(const std::vector<Entry>& entries, size_t pos, int64_t low, int64_t high, int64_t term) {
+    RR_CHECK(entries.size() >= pos + static_cast<size_t>(high - low));
+    for (int64_t i = low; i < high; ++i, ++pos) {
+        RR_CHECK_EQ(entries[pos].index, i);
+        RR_CHECK_EQ(entries[pos].term, term);
+        RR_CHECK(entries[pos].data.view() == fmt::format("entry {} of term {}", i, term));
+    }
+}
+
+std::filesystem::path LastSegment(const std::filesystem::path& dir) {
+    std::filesystem::path last;
+    for (auto& iter : std::filesystem::directory_iterator(dir)) {
+        if (iter.path().extension() == ".wal" && iter.path() > last) {
+            last = iter.path();
+        }
+    }
+    return last;
+}
+
+void AppendBytes(const std::filesystem::path& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+/**
+ * @brief 最后一条记录只写了一半或者校验和不对时，回放到它之前为止，截掉之后新写入的日志可以正常回放
+ */
+void TestTornTail(const std::string& tail) {
+    auto dir = test::TempDir("wal-torn");
+    {
+        WAL wal(dir);
+        RR_CHECK(!wal.readAll(0));
+        RR_CHECK(wal.save(0, MakeEntries(1, 11, 1)));
+    }
+    const std::filesystem::path segment = LastSegment(dir);
+    const auto size = std::filesystem::file_size(segment);
+    AppendBytes(segment, tail);
+    {
+        WAL wal(dir);
+        auto entries = wal.readAll(0);
+        RR_CHECK(entries);
+        RR_CHECK_EQ(entries->size(), 11u);
+        CheckEntries(*entries, 1, 1, 11, 1);
+        RR_CHECK_EQ(wal.lastIndex(0), 10);
+        RR_CHECK_EQ(std::filesystem::file_size(segment), size);
+        RR_CHECK(wal.save(0, MakeEntries(11, 16, 1)));
+    }
+    {
+        WAL wal(dir);
+        auto entries = wal.readAll(0);
+        RR_CHECK(entries);
+        RR_CHECK_EQ(entries->size(), 16u);
+        CheckEntries(*entries, 1, 1, 16, 1);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+/**
+ * @brief 覆盖已写入的日志时写入截断记录，重启之后回放和读取都只看到新的日志
+ */
+void TestTruncate() {
+    auto dir = test::TempDir("wal-truncate");
+    {
+        WAL wal(dir);
+        RR_CHECK(!wal.readAll(0));
+        RR_CHECK(wal.save(0, MakeEntries(1, 11, 1)));
+        // 6 及之后的日志被新 leader 的日志覆盖，8 之后的旧日志也不再有效
+        RR_CHECK(wal.save(0, MakeEntries(6, 8, 2)));
+        RR_CHECK_EQ(wal.lastIndex(0), 7);
+    }
+    WAL wal(dir);
+    auto entries = wal.readAll(0);
+    RR_CHECK(entries);
+    RR_CHECK_EQ(entries->size(), 8u);
+    CheckEntries(*entries, 1, 1, 6, 1);
+    CheckEntries(*entries, 6, 6, 8, 2);
+
+    // 跳过快照之前的日志
+    entries = wal.readAll(0, 4, 1);
+    RR_CHECK(entries);
+    RR_CHECK_EQ(entries->size(), 4u);
+    RR_CHECK_EQ(entries->front().index, 4);
+    RR_CHECK_EQ(entries->front().term, 1);
+    CheckEntries(*entries, 1, 5, 6, 1);
+    CheckEntries(*entries, 2, 6, 8, 2);
+
+    // 读取淘汰的日志时截断记录同样生效
+    auto read = wal.read(0, 3, 10);
+    RR_CHECK_EQ(read.size(), 5u);
+    CheckEntries(read, 0, 3, 6, 1);
+    CheckEntries(read, 3, 6, 8, 2);
+
+    // 重启之后继续覆盖
+    RR_CHECK(wal.save(0, MakeEntries(7, 9, 3)));
+    WAL reopened(dir);
+    entries = reopened.readAll(0);
+    RR_CHECK(entries);
+    RR_CHECK_EQ(entries->size(), 9u);
+    CheckEntries(*entries, 1, 1, 6, 1);
+    CheckEntries(*entries, 6, 6, 7, 2);
+    CheckEntries(*entries, 7, 7, 9, 3);
+    std::filesystem::remove_all(dir);
+}
+
+/**
+ * @brief read 按字节数上限只保留前面的日志，至少保留一条；被截断记录覆盖的日志不计入字节数
+ */
+void TestReadBudget() {
+    auto dir = test::TempDir("wal-budget");
+    WAL wal(dir);
+    std::vector<Entry> small;
+    for (int64_t i = 1; i <= 3; ++i) {
+        small.push_back(Entry{.index = i, .term = 1, .data = Payload(std::string(10, 'a'))});
+    }
+    RR_CHECK(wal.save(0, small));
+    std::vector<Entry> large;
+    for (int64_t i = 2; i <= 4; ++i) {
+        large.push_back(Entry{.index = i, .term = 2, .data = Payload(std::string(1000, 'b'))});
+    }
+    RR_CHECK(wal.save(0, large));
+
+    RR_CHECK_EQ(wal.read(0, 1, 5).size(), 4u);
+    // 覆盖之后 1 为 10 字节，2 为 1000 字节，3 超过上限
+    auto read = wal.read(0, 1, 5, 1500);
+    RR_CHECK_EQ(read.size(), 2u);
+    RR_CHECK_EQ(read[0].term, 1);
+    RR_CHECK_EQ(read[1].index, 2);
+    RR_CHECK_EQ(read[1].term, 2);
+    // 第一条日志超过上限也会返回
+    read = wal.read(0, 2, 5, 10);
+    RR_CHECK_EQ(read.size(), 1u);
+    RR_CHECK_EQ(read[0].index, 2);
+    RR_CHECK_EQ(read[0].term, 2);
+    std::filesystem::remove_all(dir);
+}
+
+/**
+ * @brief 多个组共享段：各组的回放和截断互不影响，段内所有组都被快照覆盖之后才删除，冷的组拖住旧段时被报告出来
+ */
+void TestGroups() {
+    // 每次写入之后都切换到新的段
+    Config::LookUp<uint64_t>("raft.wal.segment_size")->setValue(1);
+    Config::LookUp<uint32_t>("raft.wal.max_pinned_segments")->setValue(2);
+    auto dir = test::TempDir("wal-groups");
+    auto segments = [&dir] {
+        return std::distance(std::filesystem::directory_iterator(dir), std::filesystem::directory_iterator());
+    };
+    {
+        WAL wal(dir);
+        RR_CHECK(wal.save(0, MakeEntries(1, 2, 1)));
+        RR_CHECK(wal.save(7, MakeEntries(1, 2, 1)));
+        for (int64_t i = 2; i <= 5; ++i) {
+            RR_CHECK(wal.save(0, MakeEntries(i, i + 1, 1)));
+        }
+        // 覆盖组 7 的日志不影响组 0
+        RR_CHECK(wal.save(7, MakeEntries(1, 2, 2)));
+    }
+
+    WAL wal(dir);
+    auto group0 = wal.readAll(0);
+    RR_CHECK(group0);
+    RR_CHECK_EQ(group0->size(), 6u);
+    CheckEntries(*group0, 1, 1, 6, 1);
+    auto group7 = wal.readAll(7);
+    RR_CHECK(group7);
+    RR_CHECK_EQ(group7->size(), 2u);
+    CheckEntries(*group7, 1, 1, 2, 2);
+    RR_CHECK(!wal.readAll(3));
+    // 段 0 到 6 保存了日志，段 7 是正在写入的空段
+    RR_CHECK_EQ(segments(), 8);
+
+    // 之后已经超过 2 个段的旧段里，两个组都有没有被快照覆盖的日志
+    auto pinned = wal.pinned();
+    RR_CHECK_EQ(pinned.size(), 2u);
+    RR_CHECK_EQ(pinned[0], 0);
+    RR_CHECK_EQ(pinned[7], 1);
+
+    // 组 0 做了快照，段 0 可以删除，段 1 还有组 7 的日志
+    wal.release(0, 5);
+    RR_CHECK_EQ(segments(), 7);
+    pinned = wal.pinned();
+    RR_CHECK_EQ(pinned.size(), 1u);
+    RR_CHECK_EQ(pinned[7], 1);
+
+    // 组 7 也做了快照，除了正在写入的段都可以删除
+    wal.release(7, 1);
+    RR_CHECK_EQ(segments(), 1);
+    RR_CHECK(wal.pinned().empty());
+
+    WAL reopened(dir);
+    group0 = reopened.readAll(0, 5, 1);
+    RR_CHECK(group0);
+    RR_CHECK_EQ(group0->size(), 1u);
+    group7 = reopened.readAll(7, 1, 2);
+    RR_CHECK(group7);
+    RR_CHECK_EQ(group7->size(), 1u);
+    std::filesystem::remove_all(dir);
+}
+
+} // namespace
+
+int main() {
+    // 记录头只写了一部分
+    TestTornTail(std::string("\x10\x00", 2));
+    // 长度超过文件的剩余部分
+    TestTornTail(std::string("\x00\x00\x00\x40\x00\x00\x00\x00\x01\x02\x03", 11));
+    // 长度完整但是校验和不对
+    TestTornTail(std::string("\x00\x00\x00\x03\x12\x34\x56\x78\x01\x02\x03", 11));
+    TestTruncate();
+    TestReadBudget();
+    TestGroups();
+    return 0;
+}